@@ -0,0 +1,531 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "node.h"
+#include "node_arena.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "autodiff.h"
+#include "population_evaluator.h"
+#include "precision.h"
+#include "random.h"
+#include "util.h"
+#if SYMBOLIC_AMP_HAS_AMP
+#include "amp_interpreter.h"
+#endif
+
+using namespace std;
+
+// sweeps rows, tree depth, number of variables and threads for every evaluator and reports nodes/s
+// (node evaluations per second, over all rows) with warm-up runs, repetitions and their spread.
+// usage: symbolic-amp-bench [--rows=1000,100000] [--depths=3,5,7] [--variables=2,8] [--threads=1,4]
+//                           [--trees=100] [--warmup=1] [--repetitions=5] [--evaluators=block,population]
+//                           [--json=results.json|-] [--quick]
+namespace
+{
+    struct options
+    {
+        vector<int> rows = { 1000, 10000, 100000 };
+        vector<int> depths = { 3, 5, 7 };
+        vector<int> variables = { 2, 8 };
+        vector<int> threads = { 1, static_cast<int>(max(1u, thread::hardware_concurrency())) };
+        vector<string> evaluators;
+        int trees = 100;
+        int warmup = 1;
+        int repetitions = 5;
+        string json;
+    };
+
+    // prepares an evaluator for a population (compilation, buffers) outside of the timed region and returns the timed part
+    typedef function<function<void()>(const vector<node*>& trees, const dataset& data, int threads)> setup_function;
+
+    // largest divergence, in ulps of the evaluation precision, of the values of the trees from the double precision path
+    typedef function<uint64_t(const vector<node*>& trees, const dataset& data)> divergence_function;
+
+    struct evaluator_entry
+    {
+        string name;
+        bool threaded;   // runs once per thread count of the sweep, otherwise only single-threaded
+        setup_function setup;
+        divergence_function divergence;  // empty for double precision evaluators
+    };
+
+    uint64_t float_divergence(const vector<node*>& trees, const dataset& data)
+    {
+        float_dataset single(data);
+        uint64_t max_ulp = 0;
+        for (auto t : trees)
+        {
+            auto reference = interpreter::evaluate(t, 0, data.rows(), data);
+            auto values = float_interpreter::evaluate(t, 0, data.rows(), single);
+            max_ulp = max(max_ulp, compare_precision(reference.data(), values.data(), data.rows()).max_ulp);
+        }
+        return max_ulp;
+    }
+
+    vector<evaluator_entry> evaluators()
+    {
+        vector<evaluator_entry> entries;
+
+        // one row at a time, the original evaluation mode
+        entries.push_back({ "row", false, [](const vector<node*>& trees, const dataset& data, int) {
+            auto programs = make_shared<vector<vector<instruction>>>();
+            for (auto t : trees)
+                programs->push_back(interpreter::compile(t, data));
+            auto rows = data.rows();
+            return [programs, rows]() {
+                volatile double sink = 0;
+                for (auto& code : *programs)
+                    for (int row = 0; row < rows; ++row)
+                        sink = interpreter::evaluate(code, row);
+                (void)sink;
+            };
+        } });
+
+        // columnar evaluation on a single thread
+        entries.push_back({ "block", false, [](const vector<node*>& trees, const dataset& data, int) {
+            auto programs = make_shared<vector<vector<instruction>>>();
+            size_t length = 0;
+            for (auto t : trees)
+            {
+                programs->push_back(interpreter::compile(t, data));
+                length = max(length, programs->back().size());
+            }
+            auto buffer = make_shared<simd::aligned_vector<double>>(length * interpreter::block_size);
+            auto result = make_shared<vector<double>>(data.rows());
+            auto rows = data.rows();
+            return [programs, buffer, result, rows]() {
+                for (auto& code : *programs)
+                    interpreter::evaluate(code, 0, rows, result->data(), buffer->data());
+            };
+        } });
+
+        // native code on a single thread, compiled outside of the timed region; programs the jit cannot compile
+        // fall back to the columnar interpreter
+        entries.push_back({ "jit", false, [](const vector<node*>& trees, const dataset& data, int) {
+            auto programs = make_shared<vector<vector<instruction>>>();
+            auto compiled = make_shared<vector<shared_ptr<jit_program>>>();
+            size_t length = 0;
+            for (auto t : trees)
+            {
+                programs->push_back(interpreter::compile(t, data));
+                compiled->push_back(jit_compiler::compile(programs->back()));
+                length = max(length, programs->back().size());
+            }
+            auto columns = make_shared<vector<const double*>>();
+            for (int i = 0; i < data.cols(); ++i)
+                columns->push_back(data.column(i));
+            auto buffer = make_shared<simd::aligned_vector<double>>(length * interpreter::block_size);
+            auto result = make_shared<vector<double>>(data.rows());
+            auto rows = data.rows();
+            return [programs, compiled, columns, buffer, result, rows]() {
+                for (size_t i = 0; i < programs->size(); ++i)
+                {
+                    if ((*compiled)[i])
+                        (*compiled)[i]->evaluate(columns->data(), 0, rows, result->data());
+                    else
+                        interpreter::evaluate((*programs)[i], 0, rows, result->data(), buffer->data());
+                }
+            };
+        } });
+
+        // columnar evaluation on a single thread of the trees with their multiplications turned into analytic quotients
+        // and their divisions into powers, so the node counts stay the same while the vectorized functions do the work
+        entries.push_back({ "functions", false, [](const vector<node*>& trees, const dataset& data, int) {
+            auto programs = make_shared<vector<vector<instruction>>>();
+            size_t length = 0;
+            for (auto t : trees)
+            {
+                auto tree = linear_tree::FromNode(t);
+                for (int i = 0; i < tree.GetLength(); ++i)
+                {
+                    if (tree[i].opcode == MUL)
+                        tree[i].opcode = AQ;
+                    else if (tree[i].opcode == DIV)
+                        tree[i].opcode = POW;
+                }
+                programs->push_back(interpreter::compile(tree, data));
+                length = max(length, programs->back().size());
+            }
+            auto buffer = make_shared<simd::aligned_vector<double>>(length * interpreter::block_size);
+            auto result = make_shared<vector<double>>(data.rows());
+            auto rows = data.rows();
+            return [programs, buffer, result, rows]() {
+                for (auto& code : *programs)
+                    interpreter::evaluate(code, 0, rows, result->data(), buffer->data());
+            };
+        } });
+
+        // values plus the jacobian with respect to every weight and constant, single-threaded
+        entries.push_back({ "jacobian", false, [](const vector<node*>& trees, const dataset& data, int) {
+            auto programs = make_shared<vector<vector<instruction>>>();
+            size_t length = 0, parameters = 0;
+            for (auto t : trees)
+            {
+                programs->push_back(interpreter::compile(t, data));
+                length = max(length, programs->back().size());
+                parameters = max(parameters, autodiff::parameters(programs->back()).size());
+            }
+            auto buffer = make_shared<simd::aligned_vector<double>>(2 * length * interpreter::block_size);
+            auto result = make_shared<vector<double>>(data.rows());
+            auto jacobian = make_shared<vector<double>>(parameters * data.rows());
+            auto rows = data.rows();
+            return [programs, buffer, result, jacobian, rows]() {
+                for (auto& code : *programs)
+                    autodiff::jacobian(code, 0, rows, result->data(), jacobian->data(), buffer->data());
+            };
+        } });
+
+        // columnar evaluation of the whole population on the thread pool
+        entries.push_back({ "population", true, [](const vector<node*>& trees, const dataset& data, int threads) {
+            auto evaluator = make_shared<population_evaluator>(threads);
+            auto programs = make_shared<vector<vector<instruction>>>(evaluator->compile_population(trees, data));
+            auto values = make_shared<vector<vector<double>>>(trees.size(), vector<double>(data.rows()));
+            auto columns = make_shared<vector<double*>>();
+            for (auto& v : *values)
+                columns->push_back(v.data());
+            auto rows = data.rows();
+            return [evaluator, programs, values, columns, rows]() {
+                evaluator->evaluate_population(*programs, 0, rows, *columns);
+            };
+        } });
+
+        // fused evaluation and fitness reduction on the thread pool (the last variable is the target)
+        entries.push_back({ "fitness", true, [](const vector<node*>& trees, const dataset& data, int threads) {
+            auto evaluator = make_shared<population_evaluator>(threads);
+            auto programs = make_shared<vector<vector<instruction>>>(evaluator->compile_population(trees, data));
+            auto target = data.column(data.cols() - 1);
+            auto rows = data.rows();
+            return [evaluator, programs, target, rows]() {
+                evaluator->evaluate_fitness(*programs, target, 0, rows);
+            };
+        } });
+
+        // single precision columnar evaluation of the whole population on the thread pool
+        entries.push_back({ "float", true, [](const vector<node*>& trees, const dataset& data, int threads) {
+            auto single = make_shared<float_dataset>(data);
+            auto evaluator = make_shared<float_population_evaluator>(threads);
+            auto programs = make_shared<vector<vector<basic_instruction<float>>>>(evaluator->compile_population(trees, *single));
+            auto values = make_shared<vector<vector<float>>>(trees.size(), vector<float>(data.rows()));
+            auto columns = make_shared<vector<float*>>();
+            for (auto& v : *values)
+                columns->push_back(v.data());
+            auto rows = data.rows();
+            return [single, evaluator, programs, values, columns, rows]() {
+                evaluator->evaluate_population(*programs, 0, rows, *columns);
+            };
+        }, float_divergence });
+
+        // fitness in single precision, and evaluated in single precision but reduced in double precision
+        entries.push_back({ "float-fitness", true, [](const vector<node*>& trees, const dataset& data, int threads) {
+            auto single = make_shared<float_dataset>(data);
+            auto evaluator = make_shared<float_population_evaluator>(threads);
+            auto programs = make_shared<vector<vector<basic_instruction<float>>>>(evaluator->compile_population(trees, *single));
+            auto target = single->column(single->cols() - 1);
+            auto rows = data.rows();
+            return [single, evaluator, programs, target, rows]() {
+                evaluator->evaluate_fitness(*programs, target, 0, rows);
+            };
+        }, float_divergence });
+
+        entries.push_back({ "mixed-fitness", true, [](const vector<node*>& trees, const dataset& data, int threads) {
+            auto single = make_shared<float_dataset>(data);
+            auto evaluator = make_shared<mixed_population_evaluator>(threads);
+            auto programs = make_shared<vector<vector<basic_instruction<float>>>>(evaluator->compile_population(trees, *single));
+            auto target = data.column(data.cols() - 1);
+            auto rows = data.rows();
+            return [single, evaluator, programs, target, rows]() {
+                evaluator->evaluate_fitness(*programs, target, 0, rows);
+            };
+        }, float_divergence });
+
+#if SYMBOLIC_AMP_HAS_AMP
+        entries.push_back({ "amp", false, [](const vector<node*>& trees, const dataset& data, int) {
+            auto interp = make_shared<amp_interpreter>(data);
+            auto population = make_shared<vector<node*>>(trees);
+            return [interp, population]() {
+                for (auto t : *population)
+                {
+                    auto values = interp->evaluate(t);
+                    values->synchronize();
+                }
+            };
+        } });
+
+        entries.push_back({ "amp-float", false, [](const vector<node*>& trees, const dataset& data, int) {
+            auto single = make_shared<float_dataset>(data);
+            auto interp = make_shared<float_amp_interpreter>(*single);
+            auto population = make_shared<vector<node*>>(trees);
+            return [single, interp, population]() {
+                for (auto t : *population)
+                {
+                    auto values = interp->evaluate(t);
+                    values->synchronize();
+                }
+            };
+        }, float_divergence });
+#endif
+        return entries;
+    }
+
+    struct summary
+    {
+        double mean, stddev, min, median, max;
+    };
+
+    summary summarize(vector<double> values)
+    {
+        summary s;
+        sort(begin(values), end(values));
+        auto n = values.size();
+        s.mean = accumulate(begin(values), end(values), 0.0) / n;
+        double ss = 0;
+        for (auto v : values)
+            ss += (v - s.mean) * (v - s.mean);
+        s.stddev = n > 1 ? sqrt(ss / (n - 1)) : 0;
+        s.min = values.front();
+        s.max = values.back();
+        s.median = n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+        return s;
+    }
+
+    struct result
+    {
+        string evaluator;
+        int rows, depth, variables, threads, trees;
+        unsigned long long nodes;
+        summary seconds;
+        summary nodes_per_second;
+        long long max_ulp;  // -1 for double precision evaluators
+    };
+
+    vector<int> parse_list(const string& value)
+    {
+        vector<int> list;
+        stringstream ss(value);
+        string item;
+        while (getline(ss, item, ','))
+            list.push_back(stoi(item));
+        return list;
+    }
+
+    vector<string> parse_names(const string& value)
+    {
+        vector<string> list;
+        stringstream ss(value);
+        string item;
+        while (getline(ss, item, ','))
+            list.push_back(item);
+        return list;
+    }
+
+    options parse(int argc, char* argv[])
+    {
+        options opt;
+        for (int i = 1; i < argc; ++i)
+        {
+            string arg = argv[i];
+            auto eq = arg.find('=');
+            auto key = arg.substr(0, eq);
+            auto value = eq == string::npos ? string() : arg.substr(eq + 1);
+            if (key == "--rows") opt.rows = parse_list(value);
+            else if (key == "--depths") opt.depths = parse_list(value);
+            else if (key == "--variables") opt.variables = parse_list(value);
+            else if (key == "--threads") opt.threads = parse_list(value);
+            else if (key == "--evaluators") opt.evaluators = parse_names(value);
+            else if (key == "--trees") opt.trees = stoi(value);
+            else if (key == "--warmup") opt.warmup = stoi(value);
+            else if (key == "--repetitions") opt.repetitions = stoi(value);
+            else if (key == "--json") opt.json = value;
+            else if (key == "--quick")
+            {
+                // small sweep that exercises every evaluator, used as a smoke test
+                opt.rows = { 1000 };
+                opt.depths = { 4 };
+                opt.variables = { 2 };
+                opt.threads = { 1, 2 };
+                opt.trees = 10;
+                opt.warmup = 1;
+                opt.repetitions = 3;
+            }
+            else
+                throw invalid_argument("unknown option " + arg);
+        }
+        if (opt.repetitions < 1)
+            throw invalid_argument("at least one repetition is needed");
+        return opt;
+    }
+
+    string escape(const string& s)
+    {
+        string r;
+        for (auto c : s)
+        {
+            if (c == '"' || c == '\\')
+                r += '\\';
+            r += c;
+        }
+        return r;
+    }
+
+    void write_summary(ostream& out, const char* name, const summary& s)
+    {
+        out << "\"" << name << "\": { \"mean\": " << s.mean << ", \"stddev\": " << s.stddev << ", \"min\": " << s.min
+            << ", \"median\": " << s.median << ", \"max\": " << s.max << " }";
+    }
+
+    void write_json(ostream& out, const options& opt, const vector<result>& results)
+    {
+        auto now = time(nullptr);
+        char date[32];
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+        string compiler;
+#if defined(__clang__)
+        compiler = "clang " __clang_version__;
+#elif defined(__GNUC__)
+        compiler = "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+        compiler = "msvc " + to_string(_MSC_VER);
+#endif
+
+        out << setprecision(9);
+        out << "{\n  \"context\": {\n";
+        out << "    \"date\": \"" << date << "\",\n";
+        out << "    \"compiler\": \"" << escape(compiler) << "\",\n";
+        out << "    \"simd_width\": " << simd::width << ",\n";
+        out << "    \"block_size\": " << interpreter::block_size << ",\n";
+        out << "    \"hardware_threads\": " << thread::hardware_concurrency() << ",\n";
+        out << "    \"amp\": " << (SYMBOLIC_AMP_HAS_AMP ? "true" : "false") << ",\n";
+        out << "    \"warmup\": " << opt.warmup << ",\n";
+        out << "    \"repetitions\": " << opt.repetitions << "\n  },\n";
+        out << "  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            auto& r = results[i];
+            out << (i ? ",\n" : "\n") << "    { \"evaluator\": \"" << escape(r.evaluator) << "\", \"rows\": " << r.rows << ", \"depth\": " << r.depth
+                << ", \"variables\": " << r.variables << ", \"threads\": " << r.threads << ", \"trees\": " << r.trees << ", \"nodes\": " << r.nodes << ", ";
+            write_summary(out, "seconds", r.seconds);
+            out << ", ";
+            write_summary(out, "nodes_per_second", r.nodes_per_second);
+            if (r.max_ulp >= 0)
+                out << ", \"max_ulp\": " << r.max_ulp;
+            out << " }";
+        }
+        out << "\n  ]\n}\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    options opt;
+    try
+    {
+        opt = parse(argc, argv);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        return 2;
+    }
+
+    auto entries = evaluators();
+    if (!opt.evaluators.empty())
+    {
+        for (auto& name : opt.evaluators)
+        {
+            if (none_of(begin(entries), end(entries), [&](const evaluator_entry& e) { return e.name == name; }))
+            {
+                cerr << "unknown evaluator " << name << endl;
+                return 2;
+            }
+        }
+        entries.erase(remove_if(begin(entries), end(entries), [&](const evaluator_entry& e) {
+            return find(begin(opt.evaluators), end(opt.evaluators), e.name) == end(opt.evaluators);
+        }), end(entries));
+    }
+
+    // with --json=- the table goes to stderr, so stdout is valid json
+    auto& log = opt.json == "-" ? cerr : cout;
+    vector<result> results;
+    log << left << setw(14) << "evaluator" << right << setw(9) << "rows" << setw(7) << "depth" << setw(6) << "vars" << setw(9) << "threads"
+         << setw(14) << "Mnodes/s" << setw(10) << "stddev" << setw(12) << "min" << setw(12) << "median" << setw(12) << "max" << setw(13) << "max ulp" << endl;
+    for (auto nvars : opt.variables)
+    {
+        for (auto nrows : opt.rows)
+        {
+            for (auto depth : opt.depths)
+            {
+                auto rnd = make_unique<rng>();
+                rnd->seed(1234);
+                auto data = util::random_dataset(rnd.get(), nvars, nrows);
+                node_arena arena;
+                vector<node*> trees(opt.trees);
+                generate(begin(trees), end(trees), [&]() { return node::Random(rnd.get(), data, depth, &arena); });
+                unsigned long long nodes = 0;
+                for (auto t : trees)
+                    nodes += t->GetLength();
+
+                for (auto& entry : entries)
+                {
+                    auto max_ulp = entry.divergence ? static_cast<long long>(min<uint64_t>(entry.divergence(trees, data), numeric_limits<long long>::max())) : -1;
+                    for (auto nthreads : opt.threads)
+                    {
+                        if (!entry.threaded && nthreads != opt.threads.front())
+                            continue;
+                        auto threads = entry.threaded ? nthreads : 1;
+                        auto run = entry.setup(trees, data, threads);
+                        for (int i = 0; i < opt.warmup; ++i)
+                            run();
+
+                        vector<double> seconds, speeds;
+                        for (int i = 0; i < opt.repetitions; ++i)
+                        {
+                            auto start = chrono::steady_clock::now();
+                            run();
+                            auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                            seconds.push_back(elapsed);
+                            speeds.push_back(static_cast<double>(nodes) * nrows / max(elapsed, 1e-9));
+                        }
+
+                        result r{ entry.name, nrows, depth, nvars, threads, opt.trees, nodes, summarize(seconds), summarize(speeds), max_ulp };
+                        results.push_back(r);
+                        log << left << setw(14) << r.evaluator << right << setw(9) << nrows << setw(7) << depth << setw(6) << nvars << setw(9) << threads
+                             << fixed << setprecision(1) << setw(14) << r.nodes_per_second.mean / 1e6 << setw(10) << r.nodes_per_second.stddev / 1e6
+                             << setw(12) << r.nodes_per_second.min / 1e6 << setw(12) << r.nodes_per_second.median / 1e6 << setw(12) << r.nodes_per_second.max / 1e6 << defaultfloat << setw(13) << (max_ulp >= 0 ? to_string(max_ulp) : "-") << endl;
+                    }
+                }
+            }
+        }
+    }
+
+    if (opt.json == "-")
+    {
+        write_json(cout, opt, results);
+    }
+    else if (!opt.json.empty())
+    {
+        ofstream out(opt.json);
+        write_json(out, opt, results);
+        if (!out)
+        {
+            cerr << "cannot write " << opt.json << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
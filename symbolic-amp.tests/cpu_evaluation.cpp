@@ -0,0 +1,1108 @@
+#include "CppUnitTest.h"
+
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+#include "../symbolic-amp/interpreter.h"
+#include "../symbolic-amp/population_evaluator.h"
+#include "../symbolic-amp/program_cache.h"
+#include "../symbolic-amp/evolution_engine.h"
+#include "../symbolic-amp/instrumentation.h"
+#include "../symbolic-amp/backend.h"
+#include "../symbolic-amp/subtree_cache.h"
+#include "../symbolic-amp/linear_tree.h"
+#include "../symbolic-amp/incremental_evaluator.h"
+#include "../symbolic-amp/jit.h"
+#include "../symbolic-amp/autodiff.h"
+#include "../symbolic-amp/coefficient_optimizer.h"
+#include "../symbolic-amp/precision.h"
+#include "../symbolic-amp/simd_math.h"
+#include "../symbolic-amp/random.h"
+#include "../symbolic-amp/node.h"
+#include "../symbolic-amp/dataset.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace std;
+
+namespace symbolicamptests
+{
+    TEST_CLASS(CpuEvaluationTests)
+    {
+    public:
+        TEST_METHOD(BlockEvaluationCorrectnessTest)
+        {
+            auto nrows = 1000; // not a multiple of the block size, so the last block is partial
+            auto nvars = 3;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset();
+            for (int i = 0; i < nvars; ++i)
+            {
+                auto values = vector<double>(nrows);
+                generate(begin(values), end(values), [&] { return rand->next_double(); });
+                data.add("x" + std::to_string(i + 1), values);
+            }
+
+            for (int t = 0; t < 20; ++t)
+            {
+                auto tree = node::Random(rand.get(), data, 6);
+                auto instructions = interpreter::compile(tree, data);
+                auto evaluation = interpreter::evaluate(tree, 0, nrows, data);
+                for (auto row = 0; row < nrows; ++row)
+                {
+                    auto v = interpreter::evaluate(instructions, row);
+                    if (std::isfinite(v))
+                        Assert::AreEqual(v, evaluation[row], 1e-12 * std::max(1.0, std::abs(v)), L"Block and row-wise values should be the same", LINE_INFO());
+                }
+                delete tree;
+            }
+        }
+
+        TEST_METHOD(PopulationEvaluationTest)
+        {
+            auto nrows = 10000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto values = vector<double>(nrows);
+            generate(begin(values), end(values), [&] { return rand->next_double(); });
+            auto data = dataset();
+            data.add("x1", values);
+            data.add("x2", values);
+
+            // fewer trees than threads, so the rows of a single tree have to be split across workers
+            auto trees = vector<node*>(3);
+            generate(begin(trees), end(trees), [&]() { return node::Random(rand.get(), data, 8); });
+
+            population_evaluator evaluator(4, 1000);
+            auto columns = evaluator.evaluate_population(trees, data, 100, nrows - 100);
+            for (size_t i = 0; i < trees.size(); ++i)
+            {
+                auto expected = interpreter::evaluate(trees[i], 100, nrows - 100, data);
+                for (int row = 0; row < nrows - 100; ++row)
+                    Assert::AreEqual(expected[row], columns[i][row], L"Population and single tree evaluation should be the same", LINE_INFO());
+            }
+
+            for (auto t : trees)
+                delete t;
+        }
+
+        TEST_METHOD(DatasetColumnResolutionTest)
+        {
+            auto data = dataset({ "x1", "x2", "x3" }, 13);
+            Assert::AreEqual(3, data.cols(), L"The dataset should have three columns", LINE_INFO());
+            for (int i = 0; i < data.cols(); ++i)
+            {
+                Assert::AreEqual(i, data.index(data.Variables()[i]), L"Variable ids should be column indices", LINE_INFO());
+                Assert::IsTrue(reinterpret_cast<uintptr_t>(data.column(i)) % simd::alignment == 0, L"Columns should be aligned", LINE_INFO());
+                fill(data.column(i), data.column(i) + data.rows(), i + 1.0);
+            }
+
+            auto tree = node::add();
+            tree->AddSubtree(node::variable("x3", 2));
+            tree->AddSubtree(node::variable("x1", 1));
+            auto instructions = interpreter::compile(tree, data);
+            Assert::AreEqual(2, instructions[0].variable, L"The variable should be resolved to its column", LINE_INFO());
+            Assert::AreEqual(7.0, interpreter::evaluate(instructions, 12), L"Evaluation should read the resolved columns", LINE_INFO());
+            delete tree;
+
+            // a misspelled variable is reported instead of silently reading an empty column
+            auto misspelled = node::add();
+            misspelled->AddSubtree(node::variable("x4"));
+            misspelled->AddSubtree(node::variable("x1"));
+            Assert::ExpectException<std::out_of_range>([&]() { interpreter::compile(misspelled, data); }, L"Unknown variables should be rejected", LINE_INFO());
+            delete misspelled;
+
+            // moving a dataset hands over its columns instead of copying them
+            auto columns = data.column(0);
+            auto moved = std::move(data);
+            Assert::IsTrue(moved.column(0) == columns, L"Moving a dataset should keep its columns in place", LINE_INFO());
+            Assert::AreEqual(3.0, moved.column(2)[12], L"Moved columns should keep their values", LINE_INFO());
+        }
+
+        TEST_METHOD(FitnessEvaluationTest)
+        {
+            auto nrows = 5000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2", "y" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(); });
+
+            auto trees = vector<node*>(5);
+            generate(begin(trees), end(trees), [&]() { return node::Random(rand.get(), data, 4); });
+
+            population_evaluator evaluator(3, 1000);
+            auto population = evaluator.evaluate_fitness(trees, data, "y", 0, nrows);
+            auto target = data["y"];
+            for (size_t t = 0; t < trees.size(); ++t)
+            {
+                auto stats = interpreter::evaluate_fitness(trees[t], data, "y", 0, nrows);
+
+                // reference values from a materialized prediction vector
+                auto x = interpreter::evaluate(trees[t], 0, nrows, data);
+                double mx = 0, my = 0;
+                for (int i = 0; i < nrows; ++i) { mx += x[i]; my += target[i]; }
+                mx /= nrows; my /= nrows;
+                double sxx = 0, syy = 0, sxy = 0, sse = 0, sae = 0;
+                for (int i = 0; i < nrows; ++i)
+                {
+                    sxx += (x[i] - mx) * (x[i] - mx);
+                    syy += (target[i] - my) * (target[i] - my);
+                    sxy += (x[i] - mx) * (target[i] - my);
+                    sse += (x[i] - target[i]) * (x[i] - target[i]);
+                    sae += std::abs(x[i] - target[i]);
+                }
+                auto mse = sse / nrows;
+                auto r = sxy / std::sqrt(sxx * syy);
+                auto slope = sxy / sxx;
+                auto intercept = my - slope * mx;
+                double scaled = 0;
+                for (int i = 0; i < nrows; ++i)
+                {
+                    auto e = intercept + slope * x[i] - target[i];
+                    scaled += e * e;
+                }
+                scaled /= nrows;
+
+                auto tol = [](double v) { return 1e-9 * std::max(1.0, std::abs(v)); };
+                Assert::AreEqual(mse, stats.mean_squared_error(), tol(mse), L"MSE should match", LINE_INFO());
+                Assert::AreEqual(sae / nrows, stats.mean_absolute_error(), tol(sae / nrows), L"MAE should match", LINE_INFO());
+                Assert::AreEqual(1 - sse / syy, stats.r_squared(), tol(1 - sse / syy), L"R2 should match", LINE_INFO());
+                Assert::AreEqual(r, stats.pearson(), 1e-9, L"Pearson correlation should match", LINE_INFO());
+                Assert::AreEqual(slope, stats.slope(), tol(slope), L"Scaling slope should match", LINE_INFO());
+                Assert::AreEqual(intercept, stats.intercept(), tol(intercept), L"Scaling intercept should match", LINE_INFO());
+                Assert::AreEqual(scaled, stats.scaled_mean_squared_error(), tol(scaled), L"Scaled MSE should match", LINE_INFO());
+                Assert::AreEqual(mse, population[t].mean_squared_error(), tol(mse), L"Population fitness should match", LINE_INFO());
+                Assert::AreEqual(r, population[t].pearson(), 1e-9, L"Population fitness should match", LINE_INFO());
+            }
+
+            for (auto t : trees)
+                delete t;
+        }
+
+        TEST_METHOD(SubtreeCacheTest)
+        {
+            auto nrows = 2000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(); });
+
+            // offspring of a few parents share most of their subtrees, like a population after crossover
+            auto parents = vector<linear_tree>();
+            for (int i = 0; i < 4; ++i)
+            {
+                auto tree = node::Random(rand.get(), data, 6);
+                parents.push_back(linear_tree::FromNode(tree));
+                delete tree;
+            }
+            auto programs = vector<vector<instruction>>();
+            for (int i = 0; i < 40; ++i)
+            {
+                auto child = parents[rand->next(3)];
+                auto& donor = parents[rand->next(3)];
+                child.ReplaceSubtree(rand->next(child.GetLength() - 1), donor, rand->next(donor.GetLength() - 1));
+                programs.push_back(interpreter::compile(child, data));
+            }
+
+            size_t capacity = 1 << 20;
+            subtree_cache cache(capacity);
+            population_evaluator evaluator(2, 1000);
+            evaluator.set_cache(&cache);
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                for (auto& code : programs)
+                {
+                    auto expected = vector<double>(nrows), actual = vector<double>(nrows);
+                    interpreter::evaluate(code, 0, nrows, expected.data());
+                    evaluator.evaluate_population({ code }, 0, nrows, { actual.data() });
+                    for (int row = 0; row < nrows; ++row)
+                    {
+                        if (!std::isnan(expected[row]))
+                            Assert::AreEqual(expected[row], actual[row], L"Cached and uncached values should be the same", LINE_INFO());
+                    }
+                }
+            }
+            Assert::IsTrue(cache.hits() > 0, L"Repeated subtrees should hit the cache", LINE_INFO());
+            Assert::IsTrue(cache.misses() > 0, L"New subtrees should miss the cache", LINE_INFO());
+            Assert::IsTrue(cache.bytes() <= capacity, L"The cache should stay within its capacity", LINE_INFO());
+
+            // a cache too small for a single block never stores anything
+            subtree_cache tiny(16);
+            auto values = vector<double>(nrows);
+            simd::aligned_vector<double> buffer(programs[0].size() * interpreter::block_size);
+            interpreter::evaluate(programs[0], 0, nrows, values.data(), buffer.data(), &tiny);
+            Assert::AreEqual(size_t(0), tiny.size(), L"Entries larger than the capacity should be dropped", LINE_INFO());
+        }
+
+        TEST_METHOD(IncrementalEvaluationTest)
+        {
+            auto nrows = 1000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(); });
+
+            auto tree = node::Random(rand.get(), data, 8);
+            incremental_evaluator evaluator(tree, data, 0, nrows);
+            for (int step = 0; step < 50; ++step)
+            {
+                auto nodes = tree->IteratePrefix();
+                auto target = nodes[rand->next(static_cast<int>(nodes.size()) - 1)];
+                auto changed = target;
+                if (target->GetOpCode() == VARIABLE && step % 2 == 0)
+                {
+                    target->SetWeight(rand->next_double(-5, 5));
+                }
+                else if (target->GetParent() != nullptr)
+                {
+                    changed = node::Random(rand.get(), data, 3);
+                    target->GetParent()->ReplaceSubtree(target, changed);
+                    delete target;
+                }
+                else
+                {
+                    continue;
+                }
+
+                auto before = evaluator.evaluated();
+                evaluator.update(changed);
+                // only the new subtree and the path above it are evaluated
+                auto depth = 0;
+                for (auto n = changed->GetParent(); n != nullptr; n = n->GetParent())
+                    ++depth;
+                Assert::AreEqual(static_cast<size_t>(changed->GetLength() + depth), evaluator.evaluated() - before, L"Only the changed path should be evaluated", LINE_INFO());
+
+                // cached lengths and depths are invalidated along the path
+                auto copy = tree->Clone();
+                Assert::AreEqual(copy->GetLength(), tree->GetLength(), L"Lengths should be up to date", LINE_INFO());
+                Assert::AreEqual(copy->GetDepth(), tree->GetDepth(), L"Depths should be up to date", LINE_INFO());
+                delete copy;
+
+                auto expected = interpreter::evaluate(tree, 0, nrows, data);
+                for (int row = 0; row < nrows; ++row)
+                {
+                    if (!std::isnan(expected[row]))
+                        Assert::AreEqual(expected[row], evaluator.values()[row], L"Incremental and full evaluation should be the same", LINE_INFO());
+                }
+            }
+            delete tree;
+        }
+
+        TEST_METHOD(JitEvaluationTest)
+        {
+            if (!jit_compiler::supported())
+            {
+                Logger::WriteMessage("AVX2 is not available, skipping the jit test");
+                return;
+            }
+            auto nrows = 1003;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2", "x3" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(); });
+
+            jit_cache cache;
+            auto compiled = 0;
+            for (int i = 0; i < 30; ++i)
+            {
+                auto tree = node::Random(rand.get(), data, 2 + i % 6);
+                auto code = interpreter::compile(tree, data);
+                auto program = cache.get(code);
+                if (program == nullptr)
+                {
+                    Assert::IsTrue(jit_compiler::registers(code) > 16, L"Only programs with too many registers should fall back", LINE_INFO());
+                    delete tree;
+                    continue;
+                }
+                ++compiled;
+                // an odd start and a count that is not a multiple of the vector width exercise the scalar tail
+                for (auto start : { 0, 7 })
+                {
+                    auto count = nrows - start;
+                    auto expected = vector<double>(count), actual = vector<double>(count);
+                    interpreter::evaluate(code, start, count, expected.data());
+                    program->evaluate(data, start, count, actual.data());
+                    for (int row = 0; row < count; ++row)
+                    {
+                        if (!std::isnan(expected[row]))
+                            Assert::AreEqual(expected[row], actual[row], L"Jit and interpreter values should be the same", LINE_INFO());
+                    }
+                }
+                Assert::IsTrue(cache.get(code) == program, L"The same program should be compiled only once", LINE_INFO());
+                delete tree;
+            }
+            Assert::IsTrue(compiled > 0, L"Some programs should be compiled", LINE_INFO());
+            Assert::AreEqual(static_cast<size_t>(compiled), cache.hits(), L"Every second lookup should hit the cache", LINE_INFO());
+
+            // a full cache evicts the least recently used program
+            jit_cache small(2);
+            vector<vector<instruction>> programs;
+            vector<node*> trees;
+            while (programs.size() < 3)
+            {
+                trees.push_back(node::Random(rand.get(), data, 3));
+                auto code = interpreter::compile(trees.back(), data);
+                if (small.get(code) != nullptr)
+                    programs.push_back(code);
+            }
+            Assert::AreEqual(size_t(2), small.size(), L"The cache should stay within its capacity", LINE_INFO());
+            auto misses = small.misses();
+            small.get(programs[2]);
+            Assert::AreEqual(misses, small.misses(), L"Recent programs should be kept", LINE_INFO());
+            small.get(programs[0]);
+            Assert::AreEqual(misses + 1, small.misses(), L"The oldest program should have been evicted", LINE_INFO());
+            for (auto t : trees)
+                delete t;
+        }
+
+        TEST_METHOD(JacobianTest)
+        {
+            auto nrows = 300;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(1, 2); });
+
+            // (2 x1 * 3) / (0.5 x2 - 4): every partial derivative is known in closed form
+            auto root = node::div();
+            auto numerator = node::mul(), denominator = node::sub();
+            numerator->AddSubtree(node::variable("x1", 2));
+            numerator->AddSubtree(node::constant(3));
+            denominator->AddSubtree(node::variable("x2", 0.5));
+            denominator->AddSubtree(node::constant(4));
+            root->AddSubtree(numerator);
+            root->AddSubtree(denominator);
+
+            auto code = interpreter::compile(root, data);
+            Assert::AreEqual(size_t(4), autodiff::parameters(code).size(), L"Weights and constants should be parameters", LINE_INFO());
+            auto values = vector<double>(nrows);
+            auto jacobian = vector<double>(4 * nrows);
+            autodiff::jacobian(code, 0, nrows, values.data(), jacobian.data());
+            for (int row = 0; row < nrows; ++row)
+            {
+                auto x1 = data["x1"][row], x2 = data["x2"][row];
+                auto d = 0.5 * x2 - 4;
+                // parameters in postfix order: weight of x1, 3, weight of x2, 4
+                double expected[] = { 3 * x1 / d, 2 * x1 / d, -(6 * x1) * x2 / (d * d), 6 * x1 / (d * d) };
+                Assert::AreEqual(6 * x1 / d, values[row], 1e-12, L"The values should be returned with the jacobian", LINE_INFO());
+                for (int p = 0; p < 4; ++p)
+                    Assert::AreEqual(expected[p], jacobian[p * nrows + row], 1e-12, L"Derivatives should match the closed form", LINE_INFO());
+            }
+            delete root;
+
+            // random trees against central differences, over several row blocks and with an offset
+            auto evaluate = [](const vector<instruction>& program, int start, int count) {
+                auto v = vector<double>(count);
+                interpreter::evaluate(program, start, count, v.data());
+                return v;
+            };
+            for (int t = 0; t < 20; ++t)
+            {
+                auto tree = node::Random(rand.get(), data, 5);
+                auto program = interpreter::compile(tree, data);
+                auto parameters = autodiff::get_parameters(program);
+                auto start = 10, count = nrows - start;
+                jacobian.assign(parameters.size() * count, 0);
+                autodiff::jacobian(program, start, count, nullptr, jacobian.data());
+                auto reference = evaluate(program, start, count);
+                for (size_t p = 0; p < parameters.size(); ++p)
+                {
+                    auto h = 1e-6 * max(1.0, std::abs(parameters[p]));
+                    auto shifted = parameters;
+                    shifted[p] = parameters[p] + h;
+                    autodiff::set_parameters(program, shifted);
+                    auto up = evaluate(program, start, count);
+                    shifted[p] = parameters[p] - h;
+                    autodiff::set_parameters(program, shifted);
+                    auto down = evaluate(program, start, count);
+                    autodiff::set_parameters(program, parameters);
+                    for (int row = 0; row < count; ++row)
+                    {
+                        if (!std::isfinite(reference[row]) || std::abs(reference[row]) > 1e6)
+                            continue;
+                        auto numeric = (up[row] - down[row]) / (2 * h);
+                        auto analytic = jacobian[p * count + row];
+                        Assert::AreEqual(numeric, analytic, 1e-4 * max(1.0, std::abs(numeric)), L"Derivatives should match finite differences", LINE_INFO());
+                    }
+                }
+                delete tree;
+            }
+        }
+
+        TEST_METHOD(CoefficientOptimizationTest)
+        {
+            auto nrows = 5000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2", "y" }, nrows);
+            for (int i = 0; i < 2; ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(1, 2); });
+            for (int row = 0; row < nrows; ++row)
+                data["y"][row] = 2.5 * data["x1"][row] / (0.5 * data["x2"][row] + 3) - 1.25;
+
+            // the same shape with every coefficient off
+            auto make = []() {
+                auto root = node::sub(), ratio = node::div(), denominator = node::add();
+                ratio->AddSubtree(node::variable("x1"));
+                denominator->AddSubtree(node::variable("x2"));
+                denominator->AddSubtree(node::constant(1));
+                ratio->AddSubtree(denominator);
+                root->AddSubtree(ratio);
+                root->AddSubtree(node::constant(0));
+                return root;
+            };
+
+            auto tree = make();
+            coefficient_optimizer optimizer(3);
+            optimizer.options().iterations = 100;
+            auto result = optimizer.optimize(tree, data, "y", 0, nrows);
+            Assert::IsTrue(result.sse < 1e-12 * result.initial_sse, L"The coefficients should fit the target", LINE_INFO());
+            Assert::IsTrue(result.iterations > 0 && result.iterations <= 100, L"The iteration limit should be respected", LINE_INFO());
+            auto fitness = interpreter::evaluate_fitness(tree, data, "y", 0, nrows);
+            Assert::AreEqual(result.sse, fitness.sse, 1e-9, L"The tuned coefficients should be written back to the tree", LINE_INFO());
+
+            // the result does not depend on the number of threads, nor on tuning trees one by one or as a population
+            auto trees = vector<node*>{ make(), make() };
+            coefficient_optimizer serial(1);
+            serial.options().iterations = 100;
+            auto one = serial.optimize(trees[0], data, "y", 0, nrows);
+            auto results = optimizer.optimize_population({ trees[1] }, data, "y", 0, nrows);
+            Assert::AreEqual(result.sse, one.sse, L"Tuning should not depend on the number of threads", LINE_INFO());
+            Assert::AreEqual(result.sse, results[0].sse, L"Population tuning should match single tree tuning", LINE_INFO());
+            auto a = tree->IteratePrefix(), b = trees[1]->IteratePrefix();
+            for (size_t i = 0; i < a.size(); ++i)
+            {
+                Assert::AreEqual(a[i]->GetWeight(), b[i]->GetWeight(), L"Weights should be the same", LINE_INFO());
+                Assert::AreEqual(a[i]->GetValue(), b[i]->GetValue(), L"Values should be the same", LINE_INFO());
+            }
+
+            // a single step stops at the iteration limit
+            auto limited = make();
+            optimizer.options().iterations = 1;
+            auto partial = optimizer.optimize(limited, data, "y", 0, nrows);
+            Assert::AreEqual(1, partial.iterations, L"Only one step should be taken", LINE_INFO());
+            Assert::IsFalse(partial.converged, L"The limit is not convergence", LINE_INFO());
+            delete limited;
+            for (auto t : trees)
+                delete t;
+            delete tree;
+        }
+
+        TEST_METHOD(SinglePrecisionEvaluationTest)
+        {
+            Assert::AreEqual(uint64_t(1), ulp_distance(1.0f, std::nextafter(1.0f, 2.0f)), L"Neighbours are one ulp apart", LINE_INFO());
+            Assert::AreEqual(uint64_t(0), ulp_distance(0.0, -0.0), L"Both zeros are the same", LINE_INFO());
+            auto tiny = std::numeric_limits<float>::denorm_min();
+            Assert::AreEqual(uint64_t(2), ulp_distance(-tiny, tiny), L"Distances cross zero", LINE_INFO());
+            Assert::AreEqual(uint64_t(0), ulp_distance(NAN, NAN), L"Nans are equal", LINE_INFO());
+
+            auto nrows = 1000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2", "x3", "y" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(1, 2); });
+            float_dataset single(data);
+            Assert::AreEqual(static_cast<float>(data["x2"][17]), single["x2"][17], L"Values should be rounded to float", LINE_INFO());
+
+            // ((x1 * x2) + (0.5 x3 * x1)) * 1.5 x2: no cancellation, so only a few roundings separate the two paths
+            auto root = node::mul(), sum = node::add(), left = node::mul(), right = node::mul();
+            left->AddSubtree(node::variable("x1"));
+            left->AddSubtree(node::variable("x2"));
+            right->AddSubtree(node::variable("x3", 0.5));
+            right->AddSubtree(node::variable("x1"));
+            sum->AddSubtree(left);
+            sum->AddSubtree(right);
+            root->AddSubtree(sum);
+            root->AddSubtree(node::variable("x2", 1.5));
+
+            auto reference = interpreter::evaluate(root, 0, nrows, data);
+            auto values = float_interpreter::evaluate(root, 0, nrows, single);
+            auto divergence = compare_precision(reference.data(), values.data(), nrows);
+            Assert::IsTrue(divergence.max_ulp <= 8, L"Single precision should stay within a few ulps", LINE_INFO());
+            Assert::AreEqual(0, divergence.nonfinite, L"No values should overflow", LINE_INFO());
+
+            // the population evaluators agree with the interpreters of the same precision
+            float_population_evaluator evaluator(2);
+            auto population = evaluator.evaluate_population({ root }, single, 0, nrows);
+            for (int row = 0; row < nrows; ++row)
+                Assert::AreEqual(values[row], population[0][row], L"Block and population evaluation should be the same", LINE_INFO());
+
+            // fitness reduced in single and in double precision
+            auto expected = interpreter::evaluate_fitness(root, data, "y", 0, nrows);
+            auto f32 = float_interpreter::evaluate_fitness(root, single, "y", 0, nrows);
+            auto mixed = mixed_interpreter::evaluate_fitness(root, single, "y", 0, nrows);
+            Assert::AreEqual(expected.sse, f32.sse, 1e-4 * expected.sse, L"Single precision fitness should be close", LINE_INFO());
+            Assert::AreEqual(expected.sse, mixed.sse, 1e-5 * expected.sse, L"Mixed precision fitness should be close", LINE_INFO());
+            auto programs = mixed_population_evaluator(2).compile_population({ root }, single);
+            auto threaded = mixed_population_evaluator(2).evaluate_fitness(programs, data["y"], 0, nrows);
+            Assert::AreEqual(mixed.sse, threaded[0].sse, 1e-9 * mixed.sse, L"The mixed precision population evaluator should reduce in double", LINE_INFO());
+
+            // only the evaluated rows of the target are widened, wherever they start
+            auto tail = mixed_interpreter::evaluate_fitness(root, single, "y", 333, nrows - 333);
+            auto widened = vector<double>(single["y"], single["y"] + nrows);
+            auto reference_tail = mixed_interpreter::evaluate_fitness(mixed_interpreter::compile(root, single), widened.data(), 333, nrows - 333);
+            auto population_tail = mixed_population_evaluator(2).evaluate_fitness({ root }, single, "y", 333, nrows - 333);
+            Assert::AreEqual(reference_tail.sse, tail.sse, 1e-12 * tail.sse, L"Fitness on a range should read the widened target of that range", LINE_INFO());
+            Assert::AreEqual(reference_tail.sse, population_tail[0].sse, 1e-9 * tail.sse, L"The population evaluator should read the same rows", LINE_INFO());
+            delete root;
+        }
+
+        TEST_METHOD(FunctionAccuracyTest)
+        {
+            // the documented error bounds of simd_math.h against a long double reference; the sizes are not multiples
+            // of the pack width, so the padded tails are checked too
+            auto check = [](auto kernel, auto reference, auto lo, auto hi, uint64_t bound, const wchar_t* message) {
+                typedef decltype(lo) T;
+                auto n = 10007;
+                vector<T> x(n), r(n);
+                for (int i = 0; i < n; ++i)
+                    x[i] = static_cast<T>(lo + (hi - lo) * (static_cast<double>(i) / (n - 1)));
+                kernel(r.data(), x.data(), n);
+                uint64_t max_ulp = 0;
+                for (int i = 0; i < n; ++i)
+                    max_ulp = max(max_ulp, ulp_distance(static_cast<T>(reference(static_cast<long double>(x[i]))), r[i]));
+                Assert::IsTrue(max_ulp <= bound, message, LINE_INFO());
+            };
+            auto accuracy = [&](auto zero) {
+                typedef decltype(zero) T;
+                auto large = sizeof(T) == 8 ? T(700) : T(85);
+                check(simd::exp<T>, [](long double x) { return expl(x); }, -large, large, 2, L"exp should be within 2 ulp");
+                check(simd::exp<T>, [](long double x) { return expl(x); }, T(-2), T(2), 2, L"exp should be within 2 ulp");
+                check(simd::log<T>, [](long double x) { return logl(x); }, T(1e-3), T(1e3), 2, L"log should be within 2 ulp");
+                check(simd::log<T>, [](long double x) { return logl(x); }, T(0.5), T(2), 2, L"log should be within 2 ulp near 1");
+                check(simd::sin<T>, [](long double x) { return sinl(x); }, T(-10), T(10), 2, L"sin should be within 2 ulp");
+                check(simd::cos<T>, [](long double x) { return cosl(x); }, T(-10), T(10), 2, L"cos should be within 2 ulp");
+                check(simd::sin<T>, [](long double x) { return sinl(x); }, T(-5000), T(5000), 8, L"sin should be accurate for large arguments");
+                check(simd::tanh<T>, [](long double x) { return tanhl(x); }, T(-20), T(20), 2, L"tanh should be within 2 ulp");
+                check(simd::sqrt<T>, [](long double x) { return sqrtl(x); }, T(0), T(100), 1, L"sqrt should be correctly rounded");
+                check([](T* r, const T* x, int n) { vector<T> b(x, x + n); simd::aq(r, x, b.data(), n); },
+                    [](long double x) { return x / sqrtl(1 + x * x); }, T(-100), T(100), 3, L"aq should be within 3 ulp");
+                check([](T* r, const T* x, int n) { vector<T> b(n, T(2.5)); simd::pow(r, x, b.data(), n); },
+                    [](long double x) { return powl(x, 2.5L); }, T(0.01), T(100), 2 + 2 * 12, L"pow should be within its bound");
+            };
+            accuracy(0.0);
+            accuracy(0.0f);
+
+            // special values
+            double x[] = { NAN, INFINITY, -INFINITY, 0.0, -1.0, 1e-310, 800.0, -800.0 }, r[8];
+            simd::exp(r, x, 8);
+            Assert::IsTrue(std::isnan(r[0]) && std::isinf(r[1]) && r[2] == 0 && r[3] == 1 && std::isinf(r[6]) && r[7] == 0, L"exp special values", LINE_INFO());
+            simd::log(r, x, 8);
+            Assert::IsTrue(std::isnan(r[0]) && std::isinf(r[1]) && std::isnan(r[2]) && r[3] == -INFINITY && std::isnan(r[4]), L"log special values", LINE_INFO());
+            Assert::AreEqual(std::log(1e-310), r[5], 1e-12, L"log should support subnormal arguments", LINE_INFO());
+            double a[] = { -2, -2, 0, 5 }, b[] = { 3, 0.5, -1, 0 };
+            simd::pow(r, a, b, 4);
+            Assert::AreEqual(-8.0, r[0], 1e-14, L"Odd integral powers of negative bases should be negative", LINE_INFO());
+            Assert::IsTrue(std::isnan(r[1]) && std::isinf(r[2]) && r[3] == 1, L"pow special values", LINE_INFO());
+            double c[] = { 1, 1, NAN, -1, -1, 1, 2, -2 }, d[] = { NAN, INFINITY, 0, INFINITY, -INFINITY, -3, NAN, 0.5 };
+            simd::pow(r, c, d, 8);
+            for (int i = 0; i < 8; ++i)
+            {
+                auto expected = std::pow(c[i], d[i]);
+                Assert::IsTrue(std::isnan(expected) ? std::isnan(r[i]) : r[i] == expected, L"pow special values should be those of std::pow", LINE_INFO());
+            }
+        }
+
+        TEST_METHOD(ExtendedOperatorEvaluationTest)
+        {
+            auto nrows = 700;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2", "x3" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(1, 2); });
+
+            // one addition of seven terms covering every function and the n-ary and unary forms of the arithmetic
+            auto unary = [](node* op, node* child) { op->AddSubtree(child); return op; };
+            auto binary = [](node* op, node* a, node* b) { op->AddSubtree(a); op->AddSubtree(b); return op; };
+            auto root = node::add();
+            root->AddSubtree(unary(node::sin(), node::variable("x1")));
+            root->AddSubtree(binary(node::pow(), node::variable("x2"), node::constant(1.5)));
+            auto quotient = binary(node::div(), unary(node::tanh(), node::variable("x3")), unary(node::sqrt(), node::variable("x1")));
+            quotient->AddSubtree(unary(node::square(), node::variable("x2")));
+            root->AddSubtree(quotient);
+            root->AddSubtree(unary(node::sub(), unary(node::log(), node::variable("x2"))));
+            auto product = binary(node::mul(), unary(node::cos(), node::variable("x3")), unary(node::exp(), node::variable("x1", 0.5)));
+            product->AddSubtree(binary(node::aq(), node::variable("x1"), node::variable("x2")));
+            root->AddSubtree(product);
+            root->AddSubtree(unary(node::neg(), node::variable("x3")));
+            root->AddSubtree(unary(node::div(), node::variable("x1")));
+
+            auto code = interpreter::compile(root, data);
+            auto block = interpreter::evaluate(root, 0, nrows, data);
+            incremental_evaluator incremental(root, data, 0, nrows);
+            for (int row = 0; row < nrows; ++row)
+            {
+                auto x1 = data["x1"][row], x2 = data["x2"][row], x3 = data["x3"][row];
+                auto expected = std::sin(x1) + std::pow(x2, 1.5) + std::tanh(x3) / (std::sqrt(x1) * (x2 * x2)) - std::log(x2)
+                    + std::cos(x3) * std::exp(0.5 * x1) * (x1 / std::sqrt(1 + x2 * x2)) - x3 + 1 / x1;
+                Assert::AreEqual(expected, block[row], 1e-13, L"Block evaluation should match the library functions", LINE_INFO());
+                Assert::AreEqual(expected, interpreter::evaluate(code, row), 1e-13, L"Row evaluation should match the library functions", LINE_INFO());
+                Assert::AreEqual(block[row], incremental.values()[row], L"Incremental and block values should be the same", LINE_INFO());
+            }
+
+            // derivatives of every operator against central differences
+            auto parameters = autodiff::get_parameters(code);
+            auto jacobian = vector<double>(parameters.size() * nrows);
+            autodiff::jacobian(code, 0, nrows, nullptr, jacobian.data());
+            for (size_t p = 0; p < parameters.size(); ++p)
+            {
+                auto h = 1e-6 * max(1.0, std::abs(parameters[p]));
+                auto shifted = parameters;
+                shifted[p] = parameters[p] + h;
+                autodiff::set_parameters(code, shifted);
+                auto up = vector<double>(nrows), down = vector<double>(nrows);
+                interpreter::evaluate(code, 0, nrows, up.data());
+                shifted[p] = parameters[p] - h;
+                autodiff::set_parameters(code, shifted);
+                interpreter::evaluate(code, 0, nrows, down.data());
+                for (int row = 0; row < nrows; ++row)
+                {
+                    auto numeric = (up[row] - down[row]) / (2 * h);
+                    Assert::AreEqual(numeric, jacobian[p * nrows + row], 1e-6 * max(1.0, std::abs(numeric)), L"Derivatives should match finite differences", LINE_INFO());
+                }
+            }
+            autodiff::set_parameters(code, parameters);
+
+            // a wrong number of children is rejected when compiling
+            auto bad = binary(node::exp(), node::variable("x1"), node::variable("x2"));
+            Assert::ExpectException<std::invalid_argument>([&] { interpreter::compile(bad, data); }, L"exp takes one argument", LINE_INFO());
+            delete bad;
+            delete root;
+        }
+
+        TEST_METHOD(RowSelectionTest)
+        {
+            auto nrows = 2000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2", "y" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(1, 2); });
+
+            // a sorted random mini-batch, a strided set and a range
+            vector<int> batch;
+            for (int row = 0; row < nrows; ++row)
+            {
+                if (rand->next_double() < 0.3)
+                    batch.push_back(row);
+            }
+            vector<row_selection> selections = { row_selection::indices(batch), row_selection::strided(5, 7, 280), row_selection::range(100, 900) };
+            Assert::IsTrue(selections[2].contiguous() && !selections[1].contiguous(), L"Only ranges are contiguous", LINE_INFO());
+            Assert::AreEqual(5 + 3 * 7, selections[1][3], L"Strided rows", LINE_INFO());
+
+            population_evaluator evaluator(2);
+            vector<node*> trees;
+            for (int t = 0; t < 10; ++t)
+                trees.push_back(node::Random(rand.get(), data, 6));
+            for (auto& rows : selections)
+            {
+                auto population = evaluator.evaluate_population(trees, data, rows);
+                auto fitness = evaluator.evaluate_fitness(trees, data, "y", rows);
+                for (size_t t = 0; t < trees.size(); ++t)
+                {
+                    auto all = interpreter::evaluate(trees[t], 0, nrows, data);
+                    auto values = interpreter::evaluate(trees[t], rows, data);
+                    Assert::AreEqual(size_t(rows.size()), values.size(), L"One value per selected row", LINE_INFO());
+                    for (int i = 0; i < rows.size(); ++i)
+                    {
+                        Assert::AreEqual(all[rows[i]], values[i], L"Selected rows should have the values of the full evaluation", LINE_INFO());
+                        Assert::AreEqual(all[rows[i]], population[t][i], L"The population evaluator should agree", LINE_INFO());
+                    }
+                    auto single = interpreter::evaluate_fitness(trees[t], data, "y", rows);
+                    if (std::isfinite(single.sse))
+                        Assert::AreEqual(single.sse, fitness[t].sse, 1e-9 * single.sse, L"Fitness on the selection should agree", LINE_INFO());
+                }
+            }
+
+            // the index list overload goes through the same gather
+            auto values = interpreter::evaluate(trees[0], batch, data);
+            auto all = interpreter::evaluate(trees[0], 0, nrows, data);
+            for (size_t i = 0; i < batch.size(); ++i)
+                Assert::AreEqual(all[batch[i]], values[i], L"Index lists should be evaluated in blocks", LINE_INFO());
+            Assert::ExpectException<std::out_of_range>([&] { data.gather(row_selection::strided(0, 3, 1000)); }, L"Rows past the end should be rejected", LINE_INFO());
+
+            // two different mini-batches with a subtree cache attached: the second must not see the values of the first
+            subtree_cache cache(1 << 24, 1);
+            evaluator.set_cache(&cache);
+            for (auto& rows : { row_selection::strided(0, 2, 1000), row_selection::strided(1, 2, 1000) })
+            {
+                auto population = evaluator.evaluate_population(trees, data, rows);
+                auto fitness = evaluator.evaluate_fitness(trees, data, "y", rows);
+                for (size_t t = 0; t < trees.size(); ++t)
+                {
+                    auto expected = interpreter::evaluate(trees[t], rows, data);
+                    for (int i = 0; i < rows.size(); ++i)
+                        Assert::AreEqual(expected[i], population[t][i], L"Cached batches should not share values", LINE_INFO());
+                    auto single = interpreter::evaluate_fitness(trees[t], data, "y", rows);
+                    if (std::isfinite(single.sse))
+                        Assert::AreEqual(single.sse, fitness[t].sse, 1e-9 * single.sse, L"Cached batches should not share fitness", LINE_INFO());
+                }
+            }
+            evaluator.set_cache(nullptr);
+            for (auto t : trees)
+                delete t;
+        }
+
+        TEST_METHOD(BackendDispatchTest)
+        {
+            auto nrows = 3000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2", "y" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(1, 2); });
+            vector<node*> trees;
+            for (int t = 0; t < 6; ++t)
+                trees.push_back(node::Random(rand.get(), data, 6));
+
+            scalar_backend scalar;
+            block_backend block;
+            parallel_backend parallel(2);
+            vector<backend*> backends = { &scalar, &block, &parallel };
+            vector<double> values(nrows - 10);
+            for (auto t : trees)
+            {
+                auto expected = interpreter::evaluate(t, 10, nrows - 10, data);
+                auto fitness = interpreter::evaluate_fitness(t, data, "y", 10, nrows - 10);
+                for (auto b : backends)
+                {
+                    b->evaluate(t, data, 10, nrows - 10, values.data());
+                    for (int i = 0; i < nrows - 10; ++i)
+                        Assert::AreEqual(expected[i], values[i], 1e-12 * std::abs(expected[i]), L"Every backend should compute the same values", LINE_INFO());
+                    auto f = b->evaluate_fitness(t, data, "y", 10, nrows - 10);
+                    Assert::AreEqual(fitness.count, f.count, L"Every backend should see the same rows", LINE_INFO());
+                    Assert::AreEqual(fitness.sse, f.sse, 1e-9 * fitness.sse, L"Every backend should compute the same fitness", LINE_INFO());
+                }
+            }
+
+            // fixed thresholds: few rows run row by row, large workloads on the threads
+            dispatch_thresholds thresholds;
+            thresholds.block_rows = 16;
+            thresholds.parallel_work = 100000;
+            dispatcher fixed(thresholds, 2);
+            Assert::AreEqual(string("scalar"), string(fixed.select(20, 8).name()), L"Small row counts go to the scalar backend", LINE_INFO());
+            Assert::AreEqual(string("block"), string(fixed.select(20, 1000).name()), L"Medium workloads go to the block backend", LINE_INFO());
+            Assert::AreEqual(string("parallel"), string(fixed.select(20, 5000).name()), L"Large workloads go to the threads", LINE_INFO());
+            auto population = fixed.evaluate_fitness(trees, data, "y", 0, nrows);
+            for (size_t t = 0; t < trees.size(); ++t)
+            {
+                auto f = interpreter::evaluate_fitness(trees[t], data, "y", 0, nrows);
+                Assert::AreEqual(f.sse, population[t].sse, 1e-9 * f.sse, L"The dispatcher should agree with the interpreter", LINE_INFO());
+            }
+
+            // a single thread is never worth splitting the work for
+            dispatcher calibrated(1);
+            Assert::IsTrue(calibrated.thresholds().block_rows >= 1, L"The calibrated block threshold should be positive", LINE_INFO());
+            Assert::AreEqual(string("block"), string(calibrated.select(1000, 1 << 20).name()), L"One thread should never dispatch to the parallel backend", LINE_INFO());
+            for (auto t : trees)
+                delete t;
+        }
+
+        TEST_METHOD(RegisterAllocationTest)
+        {
+            auto nrows = 1000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(1, 2); });
+
+            // a balanced tree of 2^10 leaves needs a slot per level, not one per node
+            function<node*(int)> balanced = [&](int depth) {
+                if (depth == 0)
+                    return node::variable("x1", rand->next_double());
+                auto n = node::Create(depth % 2 ? ADD : MUL);
+                n->AddSubtree(balanced(depth - 1));
+                n->AddSubtree(balanced(depth - 1));
+                return n;
+            };
+            auto tree = balanced(10);
+            auto code = interpreter::compile(tree, data);
+            Assert::AreEqual(2047, static_cast<int>(code.size()), L"Length of the balanced tree", LINE_INFO());
+            Assert::IsTrue(interpreter::buffer_size(code) <= 12 * interpreter::block_size, L"Slots should grow with the depth", LINE_INFO());
+            delete tree;
+
+            // the schedule is a permutation that runs every child before its parent, and no operand shares the slot of the result
+            for (int t = 0; t < 20; ++t)
+            {
+                tree = node::Random(rand.get(), data, 8);
+                code = interpreter::compile(tree, data);
+                vector<int> step(code.size(), -1);
+                for (size_t j = 0; j < code.size(); ++j)
+                    step[code[j].order] = static_cast<int>(j);
+                for (int i = 0; i < static_cast<int>(code.size()); ++i)
+                {
+                    Assert::IsTrue(step[i] >= 0, L"Every instruction should be scheduled", LINE_INFO());
+                    operators::for_each_child(code, i, [&](int, int c) {
+                        Assert::IsTrue(step[c] < step[i], L"Children should run before their parent", LINE_INFO());
+                        Assert::AreNotEqual(code[c].slot, code[i].slot, L"Results should not overwrite their operands", LINE_INFO());
+                    });
+                }
+                Assert::IsTrue(interpreter::buffer_size(code) <= code.size() * interpreter::block_size, L"Never more slots than instructions", LINE_INFO());
+
+                auto values = interpreter::evaluate(tree, 0, nrows, data);
+                for (int row = 0; row < nrows; row += 37)
+                    if (std::isfinite(values[row]))
+                        Assert::AreEqual(interpreter::evaluate(tree, row, data), values[row], 1e-12 * std::abs(values[row]), L"Scheduled evaluation should match the row evaluation", LINE_INFO());
+                delete tree;
+            }
+        }
+
+        TEST_METHOD(ProgramCacheTest)
+        {
+            auto nrows = 1000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2", "y" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(1, 2); });
+
+            program_cache cache;
+            auto tree = node::Random(rand.get(), data, 6);
+            auto first = cache.get(tree, data);
+            Assert::IsTrue(first == cache.get(tree, data), L"An unchanged tree should get the same program", LINE_INFO());
+            auto copy = tree->Clone();
+            Assert::IsTrue(first == cache.get(copy, data), L"A copy should be found by its structure", LINE_INFO());
+            Assert::AreEqual(size_t(1), cache.misses(), L"The tree should be compiled once", LINE_INFO());
+            Assert::AreEqual(size_t(2), cache.hits(), L"Both lookups should hit", LINE_INFO());
+
+            // an edit anywhere in the tree invalidates its program, but not the one of the copy
+            auto leaf = tree;
+            while (leaf->SubtreeCount() > 0)
+                leaf = leaf->Subtrees()[0];
+            if (leaf->GetOpCode() == VARIABLE)
+                leaf->SetWeight(leaf->GetWeight() + 1);
+            else
+                leaf->SetValue(leaf->GetValue() + 1);
+            auto edited = cache.get(tree, data);
+            Assert::IsTrue(first != edited, L"An edited tree should be compiled again", LINE_INFO());
+            Assert::AreEqual(size_t(2), cache.misses(), L"The edit should miss", LINE_INFO());
+            Assert::IsTrue(first == cache.get(copy, data), L"The copy should keep its program", LINE_INFO());
+            auto expected = interpreter::evaluate(tree, 0, nrows, data);
+            auto values = cache.evaluate(tree, 0, nrows, data);
+            for (int row = 0; row < nrows; ++row)
+            {
+                if (std::isfinite(expected[row]))
+                {
+                    Assert::AreEqual(expected[row], values[row], L"Cached programs should compute the same values", LINE_INFO());
+                    if (row % 97 == 0)
+                        Assert::AreEqual(interpreter::evaluate(tree, row, data), cache.evaluate(tree, row, data), 1e-12 * std::abs(expected[row]), L"Row evaluation should use the cached program", LINE_INFO());
+                }
+            }
+
+            // another dataset with the variables in a different order rebinds the program without compiling it
+            auto other = dataset({ "y", "x2", "x1" }, nrows / 2);
+            for (int i = 0; i < other.cols(); ++i)
+                generate(other.column(i), other.column(i) + nrows / 2, [&] { return rand->next_double(1, 2); });
+            auto misses = cache.misses();
+            auto rebound = cache.evaluate(tree, 0, nrows / 2, other);
+            auto reference = interpreter::evaluate(tree, 0, nrows / 2, other);
+            Assert::AreEqual(misses, cache.misses(), L"A new dataset should not compile again", LINE_INFO());
+            Assert::IsTrue(cache.rebinds() > 0, L"The program should be rebound", LINE_INFO());
+            for (int row = 0; row < nrows / 2; ++row)
+                if (std::isfinite(reference[row]))
+                    Assert::AreEqual(reference[row], rebound[row], L"Rebound programs should read the new columns", LINE_INFO());
+
+            // the columns can move while the dataset and its first column keep their addresses
+            auto moved = dataset({ "z", "x1", "x2", "y" }, nrows / 2);
+            for (int i = 0; i < moved.cols(); ++i)
+                generate(moved.column(i), moved.column(i) + nrows / 2, [&] { return rand->next_double(1, 2); });
+            cache.evaluate(tree, 0, nrows / 2, moved);
+            moved.remove("z");
+            auto shifted = cache.evaluate(tree, 0, nrows / 2, moved);
+            auto unshifted = interpreter::evaluate(tree, 0, nrows / 2, moved);
+            for (int row = 0; row < nrows / 2; ++row)
+                if (std::isfinite(unshifted[row]))
+                    Assert::AreEqual(unshifted[row], shifted[row], L"Moved columns should be rebound", LINE_INFO());
+
+            // temporaries such as gathered batches often reuse the address and the buffers of the previous one
+            for (auto& rows : { row_selection::strided(0, 2, 500), row_selection::strided(1, 2, 500) })
+            {
+                auto values = cache.evaluate(tree, 0, rows.size(), data.gather(rows));
+                auto expected = interpreter::evaluate(tree, rows, data);
+                for (int i = 0; i < rows.size(); ++i)
+                    if (std::isfinite(expected[i]))
+                        Assert::AreEqual(expected[i], values[i], L"Every new dataset should be rebound", LINE_INFO());
+            }
+
+            // the population evaluator shares the cache across calls
+            vector<node*> trees = { tree, copy };
+            for (int t = 0; t < 6; ++t)
+                trees.push_back(node::Random(rand.get(), data, 6));
+            population_evaluator evaluator(2);
+            evaluator.set_program_cache(&cache);
+            auto uncached = population_evaluator(2).evaluate_fitness(trees, data, "y", 0, nrows);
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                auto fitness = evaluator.evaluate_fitness(trees, data, "y", 0, nrows);
+                for (size_t t = 0; t < trees.size(); ++t)
+                    if (std::isfinite(uncached[t].sse))
+                        Assert::AreEqual(uncached[t].sse, fitness[t].sse, L"Cached fitness should be the same", LINE_INFO());
+            }
+            Assert::AreEqual(size_t(8), cache.misses(), L"Only new trees should be compiled, once", LINE_INFO());
+
+            program_cache small(2);
+            for (size_t t = 2; t < 5; ++t)
+                small.get(trees[t], data);
+            Assert::AreEqual(size_t(2), small.size(), L"The least recently used program should be evicted", LINE_INFO());
+            for (auto t : trees)
+                delete t;
+
+            // a nan coefficient equals its copies, as it hashes the same
+            auto nan = node::add();
+            nan->AddSubtree(node::constant(std::numeric_limits<double>::quiet_NaN()));
+            nan->AddSubtree(node::variable("x1"));
+            auto nan_copy = nan->Clone();
+            misses = cache.misses();
+            Assert::IsTrue(cache.get(nan, data) == cache.get(nan_copy, data), L"A copy with a nan constant should be found", LINE_INFO());
+            Assert::AreEqual(misses + 1, cache.misses(), L"A tree with a nan constant should be compiled once", LINE_INFO());
+            delete nan;
+            delete nan_copy;
+        }
+
+        TEST_METHOD(EvolutionEngineTest)
+        {
+            auto nrows = 200;
+            auto rand = make_unique<rng>(1234);
+            auto data = dataset({ "x1", "x2", "x3", "y" }, nrows);
+            for (int i = 0; i < 3; ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(-2, 2); });
+            for (int row = 0; row < nrows; ++row)
+                data["y"][row] = data["x1"][row] * data["x2"][row] + data["x3"][row];
+
+            evolution_options options;
+            options.population_size = 200;
+            options.generations = 10;
+            options.queue_capacity = 16;
+            options.initialization.max_depth = 5;
+
+            // the same run with any split of the threads between the stages
+            evolution_engine serial(options, 2), parallel(options, 5);
+            serial.run(data, "y", 0, nrows);
+            int reports = 0;
+            parallel.run(data, "y", 0, nrows, [&](const generation_summary& s) {
+                Assert::AreEqual(reports++, s.generation, L"Generations should be reported in order", LINE_INFO());
+            });
+            Assert::AreEqual(options.generations + 1, reports, L"Every generation should be reported", LINE_INFO());
+            Assert::AreEqual(serial.history().size(), parallel.history().size(), L"Runs should have the same length", LINE_INFO());
+            for (size_t g = 0; g < serial.history().size(); ++g)
+            {
+                Assert::AreEqual(serial.history()[g].best, parallel.history()[g].best, L"Runs should not depend on the number of threads", LINE_INFO());
+                Assert::AreEqual(serial.history()[g].average, parallel.history()[g].average, L"Runs should not depend on the number of threads", LINE_INFO());
+                // the elite keeps the best fitness from getting worse
+                if (g > 0)
+                    Assert::IsTrue(parallel.history()[g].best <= parallel.history()[g - 1].best, L"The best fitness should not get worse", LINE_INFO());
+            }
+            Assert::IsTrue(parallel.history().back().best < parallel.history().front().best, L"Evolution should improve the best tree", LINE_INFO());
+
+            // the fitness of the final population matches a separate evaluation
+            Assert::AreEqual(options.population_size, static_cast<int>(parallel.population().size()), L"The population should keep its size", LINE_INFO());
+            auto y = parallel.best();
+            auto statistics = interpreter::evaluate_fitness(y, data, "y", 0, nrows);
+            Assert::AreEqual(statistics.scaled_mean_squared_error(), parallel.history().back().best, 1e-12, L"The reported fitness should be the fitness of the best tree", LINE_INFO());
+            auto branches = 0;
+            for (auto t : parallel.population())
+            {
+                Assert::IsTrue(t->GetLength() <= options.max_length && t->GetDepth() <= options.max_depth, L"Offspring should be within the limits", LINE_INFO());
+                for (auto n : t->IteratePrefix())
+                {
+                    Assert::IsTrue(n->GetOpCode() != VARIABLE || n->GetName() != "y", L"Trees should not use the target", LINE_INFO());
+                    if (n->SubtreeCount() >= 2)
+                        ++branches;
+                }
+            }
+            // x1 * x2 + x3 needs operators with two operands, which the initializer and the mutations have to provide
+            Assert::IsTrue(branches > options.population_size, L"The population should not be made of unary chains", LINE_INFO());
+
+            // errors stop the pipeline and reach the caller
+            auto failed = false;
+            try
+            {
+                parallel.run(data, "y", 0, nrows, [](const generation_summary& s) {
+                    if (s.generation == 2)
+                        throw std::runtime_error("stop");
+                });
+            }
+            catch (const std::runtime_error&)
+            {
+                failed = true;
+            }
+            Assert::IsTrue(failed, L"Errors should be rethrown", LINE_INFO());
+            Assert::IsTrue(parallel.population().empty(), L"A failed run should leave no population", LINE_INFO());
+        }
+
+        TEST_METHOD(ProfilingTest)
+        {
+            auto nrows = 1000;
+            auto rand = make_unique<rng>(1234);
+            auto data = dataset({ "x1", "x2", "y" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(); });
+
+            // x1 * x2 + sin(x1)
+            auto m = node::mul();
+            m->AddSubtree(node::variable("x1"));
+            m->AddSubtree(node::variable("x2"));
+            auto s = node::sin();
+            s->AddSubtree(node::variable("x1"));
+            auto tree = node::add();
+            tree->AddSubtree(m);
+            tree->AddSubtree(s);
+
+            profiling::reset();
+            auto values = interpreter::evaluate(tree, 0, nrows, data);
+            population_evaluator evaluator(2);
+            evaluator.evaluate_fitness({ tree, tree }, data, "y", 0, nrows);
+            auto profile = profiling::collect();
+
+            // without SYMBOLIC_AMP_PROFILE the instrumentation is compiled out and nothing is counted
+            uint64_t rows = profiling::enabled ? 3 * nrows : 0;
+            Assert::AreEqual(rows, profile.nodes[ADD], L"Every evaluated row of every node should be counted", LINE_INFO());
+            Assert::AreEqual(rows, profile.nodes[MUL], L"Every evaluated row of every node should be counted", LINE_INFO());
+            Assert::AreEqual(rows, profile.nodes[SIN], L"Every evaluated row of every node should be counted", LINE_INFO());
+            Assert::AreEqual(3 * rows, profile.nodes[VARIABLE], L"Every evaluated row of every node should be counted", LINE_INFO());
+            Assert::AreEqual(profiling::enabled ? uint64_t(3) : uint64_t(0), profile[profiling::compilations], L"Every compilation should be counted", LINE_INFO());
+            if (profiling::enabled)
+            {
+                Assert::IsTrue(profile[profiling::evaluations] >= 3 && profile[profiling::evaluate_nanoseconds] > 0, L"Evaluation time should be measured", LINE_INFO());
+                Assert::IsFalse(profile.threads.empty(), L"The pool threads should report their busy time", LINE_INFO());
+            }
+            else
+            {
+                Assert::IsTrue(profile.threads.empty() && profile[profiling::evaluate_nanoseconds] == 0, L"Nothing should be measured", LINE_INFO());
+            }
+
+            // both exports carry the counts
+            auto json = profiling::to_json(profile);
+            Assert::IsTrue(json.find("\"mul\":" + to_string(rows)) != string::npos, L"The json should list the nodes by opcode", LINE_INFO());
+            Assert::IsTrue(json.front() == '{' && json.back() == '}', L"The json should be an object", LINE_INFO());
+            auto text = profiling::to_prometheus(profile);
+            Assert::IsTrue(text.find("symbolic_amp_nodes_evaluated_total{opcode=\"sin\"} " + to_string(rows) + "\n") != string::npos, L"The prometheus text should list the nodes by opcode", LINE_INFO());
+            Assert::IsTrue(text.find("# TYPE symbolic_amp_cache_hits_total counter") != string::npos, L"The prometheus text should declare its metrics", LINE_INFO());
+
+            // hardware counters work where the kernel allows them
+            profiling::hardware_counters hw;
+            if (hw.available())
+            {
+                uint64_t counts[3];
+                hw.start();
+                values = interpreter::evaluate(tree, 0, nrows, data);
+                hw.stop(counts);
+                Assert::IsTrue(counts[0] > 0 && counts[1] > 0, L"Cycles and instructions should be counted", LINE_INFO());
+            }
+            delete tree;
+        }
+    };
+}
@@ -0,0 +1,263 @@
+#include "CppUnitTest.h"
+
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "../symbolic-amp/interpreter.h"
+#include "../symbolic-amp/streaming_evaluator.h"
+#include "../symbolic-amp/csv_importer.h"
+#include "../symbolic-amp/population_file.h"
+#include "../symbolic-amp/population_initializer.h"
+#include "../symbolic-amp/hierarchicalformatter.h"
+#include "../symbolic-amp/random.h"
+#include "../symbolic-amp/node.h"
+#include "../symbolic-amp/dataset.h"
+#include "../symbolic-amp/util.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace std;
+
+namespace symbolicamptests
+{
+    TEST_CLASS(DatasetStorageTests)
+    {
+    public:
+        TEST_METHOD(BinaryRoundTripTest)
+        {
+            auto nrows = 1001;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = util::random_dataset(rand.get(), 3, nrows);
+            auto path = (filesystem::temp_directory_path() / "symbolic-amp-roundtrip.bin").string();
+            data.save(path);
+
+            {
+                auto mapped = dataset::open(path);
+                Assert::IsTrue(mapped.mapped(), L"An opened dataset should be backed by the file", LINE_INFO());
+                Assert::AreEqual(data.rows(), mapped.rows(), L"Row counts should be the same", LINE_INFO());
+                Assert::AreEqual(data.cols(), mapped.cols(), L"Column counts should be the same", LINE_INFO());
+                Assert::IsTrue(reinterpret_cast<uintptr_t>(mapped.column(0)) % simd::alignment == 0, L"Mapped columns should be aligned", LINE_INFO());
+                for (int i = 0; i < data.cols(); ++i)
+                {
+                    Assert::AreEqual(data.Variables()[i], mapped.Variables()[i], L"Variable names should be the same", LINE_INFO());
+                    for (int row = 0; row < nrows; ++row)
+                        Assert::AreEqual(data.column(i)[row], mapped.column(i)[row], L"Values should be the same", LINE_INFO());
+                }
+
+                for (int t = 0; t < 10; ++t)
+                {
+                    auto tree = node::Random(rand.get(), data, 6);
+                    auto a = interpreter::evaluate(tree, 0, nrows, data);
+                    auto b = interpreter::evaluate(tree, 0, nrows, mapped);
+                    for (int row = 0; row < nrows; ++row)
+                        if (!std::isnan(a[row]))
+                            Assert::AreEqual(a[row], b[row], L"Evaluated values should be the same", LINE_INFO());
+                    delete tree;
+                }
+
+                // a copy owns its values, so writing through it leaves the mapped original alone
+                auto copy = mapped;
+                Assert::IsFalse(copy.mapped(), L"A copy of a mapped dataset should own its values", LINE_INFO());
+                copy.column(1)[7] += 1;
+                Assert::AreEqual(data.column(1)[7], mapped.column(1)[7], L"Writing to a copy should not change the original", LINE_INFO());
+                Assert::AreEqual(data.column(1)[7] + 1, copy.column(1)[7], L"The copy should hold the written value", LINE_INFO());
+
+                // changing the shape copies the values out of the mapping
+                mapped.add("y", vector<double>(nrows, 1.0));
+                Assert::IsFalse(mapped.mapped(), L"A modified dataset should own its values", LINE_INFO());
+                Assert::AreEqual(data.column(2)[nrows - 1], mapped.column(2)[nrows - 1], L"Values should survive the copy", LINE_INFO());
+            }
+
+            // the file records the precision of its values
+            auto threw = false;
+            try { float_dataset::open(path); } catch (const std::runtime_error&) { threw = true; }
+            Assert::IsTrue(threw, L"A double dataset should not open as float", LINE_INFO());
+            float_dataset(data).save(path);
+            {
+                auto single = float_dataset::open(path);
+                Assert::AreEqual(static_cast<float>(data.column(1)[5]), single.column(1)[5], L"Float values should round trip", LINE_INFO());
+            }
+            std::remove(path.c_str());
+
+            // shapes whose size overflows 64 bits are rejected from the header alone, rather than wrapped around
+            auto bytes = dataset::binary_header({ "x1", "x2" }, 4);
+            bytes.resize(bytes.size() + 2 * 4 * sizeof(double));
+            for (auto shape : { make_pair(uint64_t(1) << 62, uint64_t(4)), make_pair(uint64_t(1) << 32, uint64_t(1) << 32) })
+            {
+                dataset_header header;
+                memcpy(&header, bytes.data(), sizeof(header));
+                header.cols = shape.first;
+                header.stride = shape.second;
+                auto corrupt = bytes;
+                memcpy(corrupt.data(), &header, sizeof(header));
+                vector<string> names;
+                Assert::ExpectException<std::runtime_error>([&] { dataset::parse_header(corrupt.data(), corrupt.size(), "corrupt", names, sizeof(header)); }, L"Overflowing shapes should be rejected", LINE_INFO());
+            }
+        }
+
+        TEST_METHOD(CsvImportTest)
+        {
+            auto csv = (filesystem::temp_directory_path() / "symbolic-amp-import.csv").string();
+            auto bin = (filesystem::temp_directory_path() / "symbolic-amp-import.bin").string();
+            {
+                ofstream out(csv);
+                out << "x1, x2 ,y\n";
+                out << "1,2,3\n";
+                out << "-0.5,,1e3\r\n";
+                out << "\n";
+                out << "4.25,5,6";
+            }
+
+            auto rows = csv_importer::convert(csv, bin);
+            Assert::AreEqual(3, rows, L"Blank lines should be skipped", LINE_INFO());
+            {
+                auto data = dataset::open(bin);
+                Assert::AreEqual(3, data.rows(), L"Row count should match", LINE_INFO());
+                Assert::AreEqual(3, data.cols(), L"Column count should match", LINE_INFO());
+                Assert::AreEqual(string("x2"), data.Variables()[1], L"Names should be trimmed", LINE_INFO());
+                Assert::AreEqual(-0.5, data["x1"][1], L"Values should be parsed", LINE_INFO());
+                Assert::AreEqual(1000.0, data["y"][1], L"Values should be parsed", LINE_INFO());
+                Assert::AreEqual(4.25, data["x1"][2], L"The last line needs no newline", LINE_INFO());
+                Assert::IsTrue(std::isnan(data["x2"][1]), L"Empty fields should be nan", LINE_INFO());
+            }
+
+            // a parse error leaves no output behind that could be opened as a dataset
+            {
+                ofstream out(csv);
+                out << "x1,y\n1,2\n3,oops\n";
+            }
+            Assert::ExpectException<std::runtime_error>([&] { csv_importer::convert(csv, bin); }, L"Bad fields should be reported", LINE_INFO());
+            Assert::IsFalse(filesystem::exists(bin), L"A failed conversion should remove its output", LINE_INFO());
+            std::remove(csv.c_str());
+            std::remove(bin.c_str());
+        }
+
+        TEST_METHOD(StreamingEvaluationTest)
+        {
+            auto nrows = 5000;
+            auto rand = make_unique<rng>();
+            rand->seed(1234);
+            auto data = dataset({ "x1", "x2", "x3", "y" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(); });
+            auto path = (filesystem::temp_directory_path() / "symbolic-amp-streaming.bin").string();
+            data.save(path);
+
+            auto trees = vector<node*>(8);
+            generate(begin(trees), end(trees), [&]() { return node::Random(rand.get(), data, 5); });
+            population_evaluator evaluator(2);
+            auto expected = evaluator.evaluate_fitness(trees, data, "y", 0, nrows);
+
+            auto close = [](double a, double b) { return (std::isnan(a) && std::isnan(b)) || std::abs(a - b) <= 1e-9 * std::max(1.0, std::abs(a)); };
+            {
+                // 1000 rows per chunk is rounded up to 4 blocks, so the last of the 5 chunks is partial
+                streaming_evaluator stream(path, 1000, 2);
+                Assert::AreEqual(nrows, stream.rows(), L"Row count should come from the header", LINE_INFO());
+                Assert::AreEqual(1024, stream.chunk_rows(), L"Chunks should be whole blocks", LINE_INFO());
+                Assert::IsTrue(stream.footprint() < data.stride() * data.cols() * sizeof(double), L"Staging memory should be smaller than the dataset", LINE_INFO());
+                for (int pass = 0; pass < 2; ++pass)
+                {
+                    auto streamed = stream.evaluate_fitness(trees, "y");
+                    for (size_t t = 0; t < trees.size(); ++t)
+                    {
+                        Assert::AreEqual(expected[t].count, streamed[t].count, L"Every row should be streamed once", LINE_INFO());
+                        Assert::IsTrue(close(expected[t].mean_squared_error(), streamed[t].mean_squared_error()), L"MSE should match the in-memory evaluation", LINE_INFO());
+                        Assert::IsTrue(close(expected[t].pearson(), streamed[t].pearson()), L"Correlation should match the in-memory evaluation", LINE_INFO());
+                    }
+                }
+                Assert::ExpectException<std::out_of_range>([&]() { stream.evaluate_fitness(trees, "z"); }, L"Unknown targets should be rejected", LINE_INFO());
+            }
+            float_dataset(data).save(path);
+            {
+                mixed_streaming_evaluator stream(path, 1 << 20, 1);
+                Assert::AreEqual(nrows + 120, stream.chunk_rows(), L"A small file should be a single chunk", LINE_INFO());
+                auto streamed = stream.evaluate_fitness(trees, "y");
+                Assert::AreEqual(expected[0].count, streamed[0].count, L"Every row should be streamed once", LINE_INFO());
+            }
+            for (auto t : trees)
+                delete t;
+            std::remove(path.c_str());
+        }
+
+        TEST_METHOD(PopulationFileTest)
+        {
+            auto nrows = 500;
+            auto rand = make_unique<rng>(1234);
+            auto data = util::random_dataset(rand.get(), 4, nrows);
+            initializer_options options;
+            options.functions = { ADD, SUB, MUL, DIV, SIN, EXP, AQ };
+            options.constant_probability = 0.3;
+            auto trees = population_initializer(options, 1).generate(100, data);
+            auto path = (filesystem::temp_directory_path() / "symbolic-amp-population.bin").string();
+            population_file::save(path, trees);
+
+            {
+                population_file file(path);
+                Assert::AreEqual(static_cast<int>(trees.size()), file.size(), L"Every tree should be saved", LINE_INFO());
+                for (int i = 0; i < file.size(); ++i)
+                {
+                    Assert::AreEqual(trees[i]->GetLength(), file.length(i), L"Lengths should be the same", LINE_INFO());
+                    // the coefficients are stored raw, so the trees are the same bit for bit
+                    auto copy = file.load(i);
+                    Assert::AreEqual(linear_tree::FromNode(trees[i]).Hashes().back(), linear_tree::FromNode(copy).Hashes().back(), L"Loaded trees should be the same", LINE_INFO());
+                    Assert::AreEqual(hierarchical_formatter::format(trees[i]), hierarchical_formatter::format(copy), L"Loaded trees should be the same", LINE_INFO());
+                    delete copy;
+
+                    // programs come straight from the mapping
+                    auto a = interpreter::evaluate(trees[i], 0, nrows, data);
+                    vector<double> b(nrows);
+                    interpreter::evaluate(file.compile<interpreter>(i, data), 0, nrows, b.data());
+                    for (int row = 0; row < nrows; ++row)
+                    {
+                        if (!std::isnan(a[row]))
+                            Assert::AreEqual(a[row], b[row], L"Evaluated values should be the same", LINE_INFO());
+                    }
+                }
+            }
+
+            // a single tree in memory
+            population_file single(population_file::serialize(trees[7]));
+            Assert::AreEqual(1, single.size(), L"A single tree should be serialized", LINE_INFO());
+            auto copy = single.load(0);
+            Assert::AreEqual(hierarchical_formatter::format(trees[7]), hierarchical_formatter::format(copy), L"A single tree should round trip", LINE_INFO());
+            delete copy;
+
+            // the formatter tells constants from variables
+            auto c = node::constant(2.5);
+            Assert::AreEqual(string(" 2.5\n"), hierarchical_formatter::format(c), L"Constants should be formatted as their value", LINE_INFO());
+            delete c;
+            auto sum = node::add();
+            sum->AddSubtree(node::variable("x1", 2));
+            sum->AddSubtree(node::constant(3));
+            Assert::AreEqual(string("add\xe2\x94\xac\xe2\x94\x80 2 x1\n   \xe2\x94\x94\xe2\x94\x80 3\n"), hierarchical_formatter::format(sum), L"Children should be drawn with whole glyphs below the label", LINE_INFO());
+            delete sum;
+
+            // damaged files are rejected rather than decoded
+            auto bytes = population_file::serialize(trees);
+            auto threw = false;
+            try { population_file(vector<char>(bytes.begin(), bytes.begin() + bytes.size() / 2)); } catch (const std::runtime_error&) { threw = true; }
+            Assert::IsTrue(threw, L"A truncated population should be rejected", LINE_INFO());
+            auto damaged = bytes;
+            population_header header;
+            memcpy(&header, bytes.data(), sizeof(header));
+            auto last = header.nodes_offset + (header.nodes - 1) * sizeof(serialized_node);
+            Assert::IsTrue(header.nodes > 0 && last + sizeof(serialized_node) <= bytes.size(), L"The population should have nodes", LINE_INFO());
+            damaged[static_cast<size_t>(last)] = static_cast<char>(VARIABLE + 1);  // the opcode of the last node
+            population_file corrupt(damaged);
+            threw = false;
+            try { corrupt.tree(corrupt.size() - 1); } catch (const std::runtime_error&) { threw = true; }
+            Assert::IsTrue(threw, L"A corrupt tree should be rejected", LINE_INFO());
+
+            for (auto t : trees)
+                delete t;
+            std::remove(path.c_str());
+        }
+    };
+}
@@ -3,15 +3,16 @@
 #include <memory>
 #include <algorithm>
 #include <vector>
-#include <unordered_map>
 #include <string>
 #include <chrono>
 #include <numeric>
+#include <cmath>
 
 #include "../symbolic-amp/interpreter.h"
 #include "../symbolic-amp/amp_interpreter.h"
 #include "../symbolic-amp/random.h"
 #include "../symbolic-amp/node.h"
+#include "../symbolic-amp/dataset.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace std;
@@ -24,10 +25,11 @@ namespace symbolicamptests
         TEST_METHOD(GpuEvaluationCorrectnessTest)
         {
             auto nrows = 1000;
-            auto rand = make_unique<random>();
+            auto rand = make_unique<rng>();
             auto values = vector<double>(nrows);
             generate(begin(values), end(values), [&] { return rand->next_double(); });
-            auto data = unordered_map<string, vector<double>>{ { "x1", values } };
+            auto data = dataset();
+            data.add("x1", values);
 
             auto gpu_interp = make_unique<amp_interpreter>(data);
             auto tree = node::Random(rand.get(), data, 5);
@@ -40,6 +42,34 @@ namespace symbolicamptests
             }
         }
 
+        TEST_METHOD(GpuSubtreeCacheTest)
+        {
+            auto nrows = 1000;
+            auto rand = make_unique<rng>();
+            auto data = dataset({ "x1", "x2" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(); });
+
+            subtree_cache cache(1 << 20);
+            auto gpu_interp = make_unique<amp_interpreter>(data);
+            gpu_interp->set_cache(&cache);
+            auto tree = node::Random(rand.get(), data, 5);
+            auto expected = interpreter::evaluate(tree, 0, nrows, data);
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                auto evaluation = *gpu_interp->evaluate(tree);
+                for (auto row = 0; row < nrows; ++row)
+                {
+                    if (!std::isnan(expected[row]))
+                        Assert::AreEqual(expected[row], evaluation[row], L"Cached values should be the same", LINE_INFO());
+                }
+            }
+            // the second pass finds the whole tree in the cache
+            if (cache.cacheable(tree->GetLength()))
+                Assert::AreEqual(size_t(1), cache.hits(), L"The root should hit the cache", LINE_INFO());
+            delete tree;
+        }
+
         TEST_METHOD(GpuEvaluationSpeedTest)
         {
             auto repetitions = 10;
@@ -49,13 +79,13 @@ namespace symbolicamptests
             auto nvars = 2;
 
             // generate test data
-            auto rand = make_unique<random>();
-            auto data = unordered_map<string, vector<double>>();
+            auto rand = make_unique<rng>();
+            auto data = dataset();
             for (int i = 0; i < nvars; ++i)
             {
                 auto values = vector<double>(nrows);
                 generate(begin(values), end(values), [&] { return rand->next_double(); });
-                data["x" + std::to_string(i + 1)] = values;
+                data.add("x" + std::to_string(i + 1), values);
             }
 
             auto trees = vector<node*>(ntrees);
@@ -95,26 +125,23 @@ namespace symbolicamptests
             auto nvars = 2;
 
             // generate test data
-            auto rand = make_unique<random>();
-            auto data = unordered_map<string, vector<double>>();
+            auto rand = make_unique<rng>();
+            auto data = dataset();
             for (int i = 0; i < nvars; ++i)
             {
                 auto values = vector<double>(nrows);
                 generate(begin(values), end(values), [&] { return rand->next_double(); });
-                data["x" + std::to_string(i + 1)] = values;
+                data.add("x" + std::to_string(i + 1), values);
             }
 
             auto trees = vector<node*>(ntrees);
-            auto rows = vector<int>(nrows);
-            int row = 0;
             generate(begin(trees), end(trees), [&]() { return node::Random(rand.get(), data, depth); });
-            generate(begin(rows), end(rows), [&]() { return row++; });
 
             interpreter interp;
             // warm-up
             for (auto tree : trees)
             {
-                interp.evaluate(tree, rows, data);
+                interp.evaluate(tree, 0, nrows, data);
             }
 
             auto hrc = make_unique<chrono::high_resolution_clock>();
@@ -123,7 +150,7 @@ namespace symbolicamptests
             {
                 for (auto tree : trees)
                 {
-                    interp.evaluate(tree, rows, data);
+                    interp.evaluate(tree, 0, nrows, data);
                 }
             }
             unsigned long nodes = accumulate(begin(trees), end(trees), 0, [=](unsigned long len, node* p) { return len + p->GetLength(); });
@@ -0,0 +1,154 @@
+#pragma once
+
+// minimal stand-in for the Visual Studio CppUnitTest framework, so that the same test sources build with cmake on
+// any platform. it covers the subset of the api used by the tests; portable/main.cpp runs the registered methods
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Microsoft { namespace VisualStudio { namespace CppUnitTestFramework {
+
+    struct __LineInfo
+    {
+        const char* file = nullptr;
+        int line = 0;
+    };
+
+    struct failure
+    {
+        std::string message;
+    };
+
+    struct test_registration
+    {
+        std::string name;
+        std::function<void()> run;
+    };
+
+    inline std::vector<test_registration>& registry()
+    {
+        static std::vector<test_registration> tests;
+        return tests;
+    }
+
+    class Assert
+    {
+    public:
+        template<typename T, typename U>
+        static void AreEqual(const T& expected, const U& actual, const wchar_t* message = nullptr, __LineInfo info = {})
+        {
+            if (!(expected == actual))
+                fail(describe("AreEqual", expected, actual), message, info);
+        }
+
+        static void AreEqual(double expected, double actual, double tolerance, const wchar_t* message = nullptr, __LineInfo info = {})
+        {
+            if (!(std::abs(expected - actual) <= tolerance))
+                fail(describe("AreEqual", expected, actual), message, info);
+        }
+
+        static void AreEqual(float expected, float actual, float tolerance, const wchar_t* message = nullptr, __LineInfo info = {})
+        {
+            if (!(std::abs(expected - actual) <= tolerance))
+                fail(describe("AreEqual", expected, actual), message, info);
+        }
+
+        template<typename T, typename U>
+        static void AreNotEqual(const T& notExpected, const U& actual, const wchar_t* message = nullptr, __LineInfo info = {})
+        {
+            if (notExpected == actual)
+                fail(describe("AreNotEqual", notExpected, actual), message, info);
+        }
+
+        static void IsTrue(bool condition, const wchar_t* message = nullptr, __LineInfo info = {})
+        {
+            if (!condition)
+                fail("IsTrue failed", message, info);
+        }
+
+        static void IsFalse(bool condition, const wchar_t* message = nullptr, __LineInfo info = {})
+        {
+            if (condition)
+                fail("IsFalse failed", message, info);
+        }
+
+        template<typename E, typename F>
+        static void ExpectException(F functor, const wchar_t* message = nullptr, __LineInfo info = {})
+        {
+            try
+            {
+                functor();
+            }
+            catch (const E&)
+            {
+                return;
+            }
+            fail("ExpectException failed", message, info);
+        }
+
+        static void Fail(const wchar_t* message = nullptr, __LineInfo info = {})
+        {
+            fail("Fail", message, info);
+        }
+
+    private:
+        template<typename T, typename U>
+        static std::string describe(const char* what, const T& expected, const U& actual)
+        {
+            std::ostringstream ss;
+            ss.precision(17);
+            ss << what << " failed: expected <" << expected << "> actual <" << actual << ">";
+            return ss.str();
+        }
+
+        static void fail(const std::string& what, const wchar_t* message, const __LineInfo& info)
+        {
+            std::ostringstream ss;
+            ss << what;
+            if (message != nullptr)
+            {
+                ss << " - ";
+                for (auto p = message; *p; ++p)
+                    ss << static_cast<char>(*p < 128 ? *p : '?');
+            }
+            if (info.file != nullptr)
+                ss << " (" << info.file << ":" << info.line << ")";
+            throw failure{ ss.str() };
+        }
+    };
+
+    class Logger
+    {
+    public:
+        static void WriteMessage(const char* message) { std::cout << "    " << message << std::endl; }
+        static void WriteMessage(const std::string& message) { WriteMessage(message.c_str()); }
+    };
+
+    template<typename T>
+    struct TestClass
+    {
+        using test_class_type = T;
+    };
+
+}}}
+
+#define LINE_INFO() ::Microsoft::VisualStudio::CppUnitTestFramework::__LineInfo{ __FILE__, __LINE__ }
+
+#define TEST_CLASS(className) \
+    class className : public ::Microsoft::VisualStudio::CppUnitTestFramework::TestClass<className>
+
+// the registrar constructor is only compiled once the test class is complete, so it can instantiate it
+#define TEST_METHOD(methodName) \
+    struct methodName##_registrar \
+    { \
+        methodName##_registrar() \
+        { \
+            ::Microsoft::VisualStudio::CppUnitTestFramework::registry().push_back({ #methodName, [] { test_class_type t; t.methodName(); } }); \
+        } \
+    }; \
+    inline static methodName##_registrar methodName##_registration; \
+    void methodName()
@@ -0,0 +1,40 @@
+#include "CppUnitTest.h"
+
+#include <exception>
+#include <iostream>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+// runs every registered test method, or only those whose name contains one of the arguments
+int main(int argc, char* argv[])
+{
+    int passed = 0, failed = 0;
+    for (auto& test : registry())
+    {
+        auto selected = argc < 2;
+        for (int i = 1; i < argc; ++i)
+            selected = selected || test.name.find(argv[i]) != std::string::npos;
+        if (!selected)
+            continue;
+
+        try
+        {
+            test.run();
+            std::cout << "[ PASS ] " << test.name << std::endl;
+            ++passed;
+        }
+        catch (const failure& f)
+        {
+            std::cout << "[ FAIL ] " << test.name << ": " << f.message << std::endl;
+            ++failed;
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "[ FAIL ] " << test.name << ": unexpected exception: " << e.what() << std::endl;
+            ++failed;
+        }
+    }
+    std::cout << passed << " passed, " << failed << " failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
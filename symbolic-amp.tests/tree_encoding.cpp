@@ -0,0 +1,356 @@
+#include "CppUnitTest.h"
+
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cmath>
+
+#include "../symbolic-amp/interpreter.h"
+#include "../symbolic-amp/linear_tree.h"
+#include "../symbolic-amp/simplifier.h"
+#include "../symbolic-amp/random.h"
+#include "../symbolic-amp/node.h"
+#include "../symbolic-amp/node_arena.h"
+#include "../symbolic-amp/dataset.h"
+#include "../symbolic-amp/population_initializer.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace std;
+
+namespace symbolicamptests
+{
+    TEST_CLASS(TreeEncodingTests)
+    {
+    public:
+        TEST_METHOD(LinearTreeRoundTripTest)
+        {
+            auto nrows = 100;
+            auto rand = make_unique<rng>();
+            auto values = vector<double>(nrows);
+            generate(begin(values), end(values), [&] { return rand->next_double(); });
+            auto data = dataset();
+            data.add("x1", values);
+            data.add("x2", values);
+
+            for (int t = 0; t < 20; ++t)
+            {
+                auto tree = node::Random(rand.get(), data, 7);
+                auto linear = linear_tree::FromNode(tree);
+                Assert::AreEqual(tree->GetLength(), linear.GetLength(), L"Lengths should be the same", LINE_INFO());
+                Assert::AreEqual(tree->GetDepth(), linear.GetDepth(), L"Depths should be the same", LINE_INFO());
+                Assert::AreEqual(linear.GetLength(), linear[linear.Root()].length, L"The root should span the whole tree", LINE_INFO());
+
+                auto copy = linear.ToNode();
+                auto a = interpreter::evaluate(tree, 0, nrows, data);
+                auto b = interpreter::evaluate(copy, 0, nrows, data);
+                for (int row = 0; row < nrows; ++row)
+                    Assert::AreEqual(a[row], b[row], L"Evaluated values should be the same", LINE_INFO());
+
+                delete copy;
+                delete tree;
+            }
+        }
+
+        TEST_METHOD(LinearTreeReplaceSubtreeTest)
+        {
+            auto rand = make_unique<rng>();
+            auto data = dataset({ "x1" }, 10);
+
+            for (int t = 0; t < 50; ++t)
+            {
+                auto a = node::Random(rand.get(), data, 6);
+                auto b = node::Random(rand.get(), data, 6);
+                auto recipient = linear_tree::FromNode(a);
+                auto donor = linear_tree::FromNode(b);
+
+                auto i = rand->next(recipient.GetLength() - 1);
+                auto j = rand->next(donor.GetLength() - 1);
+                auto expected = recipient.GetLength() - recipient[i].length + donor[j].length;
+                auto k = recipient.ReplaceSubtree(i, donor, j);
+
+                Assert::AreEqual(expected, recipient.GetLength(), L"Length should account for the spliced subtree", LINE_INFO());
+                Assert::AreEqual(donor[j].length, recipient[k].length, L"The spliced subtree should keep its length", LINE_INFO());
+                // cached lengths must agree with a fresh encoding of the same tree
+                auto n = recipient.ToNode();
+                auto fresh = linear_tree::FromNode(n);
+                for (int c = 0; c < recipient.GetLength(); ++c)
+                    Assert::AreEqual(fresh[c].length, recipient[c].length, L"Cached subtree lengths should be consistent", LINE_INFO());
+                Assert::AreEqual(n->GetDepth(), recipient.GetDepth(), L"Depths should be the same", LINE_INFO());
+
+                delete n;
+                delete a;
+                delete b;
+            }
+        }
+
+        TEST_METHOD(StructuralHashTest)
+        {
+            auto rand = make_unique<rng>();
+            auto data = dataset({ "x1", "x2" }, 10);
+
+            for (int t = 0; t < 20; ++t)
+            {
+                auto tree = node::Random(rand.get(), data, 6);
+                auto linear = linear_tree::FromNode(tree);
+                auto hashes = linear.Hashes();
+                for (int i = 0; i < linear.GetLength(); ++i)
+                {
+                    // a subtree hashes the same on its own as inside the tree
+                    auto sub = linear.Subtree(i);
+                    Assert::AreEqual(hashes[i], sub.Hashes().back(), L"Equal subtrees should have equal hashes", LINE_INFO());
+                }
+                delete tree;
+            }
+
+            // x1 - x2 and x2 - x1 differ only in the order of the children
+            auto a = node::sub();
+            a->AddSubtree(node::variable("x1"));
+            a->AddSubtree(node::variable("x2"));
+            auto b = node::sub();
+            b->AddSubtree(node::variable("x2"));
+            b->AddSubtree(node::variable("x1"));
+            auto c = node::sub();
+            c->AddSubtree(node::variable("x1", 2));
+            c->AddSubtree(node::variable("x2"));
+            auto ha = linear_tree::FromNode(a).Hashes().back();
+            Assert::AreNotEqual(ha, linear_tree::FromNode(b).Hashes().back(), L"Child order should change the hash", LINE_INFO());
+            Assert::AreNotEqual(ha, linear_tree::FromNode(c).Hashes().back(), L"Weights should change the hash", LINE_INFO());
+            delete a;
+            delete b;
+            delete c;
+        }
+
+        TEST_METHOD(NodeArenaTest)
+        {
+            auto nrows = 100;
+            auto rand = make_unique<rng>();
+            auto data = dataset({ "x1", "x2" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(); });
+
+            node_arena arena(4096); // small, so the arena has to grow
+            for (int t = 0; t < 20; ++t)
+            {
+                auto tree = node::Random(rand.get(), data, 6, &arena);
+                Assert::IsTrue(tree->IsPooled(), L"Trees should be allocated in the arena", LINE_INFO());
+                auto copy = tree->Clone();
+                Assert::IsFalse(copy->IsPooled(), L"Clones without an arena should be on the heap", LINE_INFO());
+                auto linear = linear_tree::FromNode(tree).ToNode(&arena);
+
+                auto a = interpreter::evaluate(tree, 0, nrows, data);
+                auto b = interpreter::evaluate(copy, 0, nrows, data);
+                auto c = interpreter::evaluate(linear, 0, nrows, data);
+                for (int row = 0; row < nrows; ++row)
+                {
+                    Assert::AreEqual(a[row], b[row], L"Evaluated values should be the same", LINE_INFO());
+                    Assert::AreEqual(a[row], c[row], L"Evaluated values should be the same", LINE_INFO());
+                }
+                delete copy;
+            }
+            // frees every tree at once
+            arena.release();
+
+            // names are interned: equal names share a symbol
+            auto x = node::variable("x1");
+            auto y = node::variable(data.symbol(0));
+            Assert::AreEqual(x->GetSymbol(), y->GetSymbol(), L"Equal names should share a symbol", LINE_INFO());
+            Assert::AreEqual(string("x1"), y->GetName(), L"The name should be resolved from the symbol", LINE_INFO());
+            auto m = node::mul();
+            Assert::AreEqual(string("*"), m->GetName(), L"Operators should have their default names", LINE_INFO());
+            delete x;
+            delete y;
+            delete m;
+        }
+
+        TEST_METHOD(SimplificationTest)
+        {
+            auto nrows = 100;
+            auto rand = make_unique<rng>();
+            auto data = dataset({ "x1", "x2" }, nrows);
+            for (int i = 0; i < data.cols(); ++i)
+                generate(data.column(i), data.column(i) + nrows, [&] { return rand->next_double(1, 2); });
+
+            // (2 * 3) x1 + (x2 - 0) + -(1.5 x1) + x2 / 4 = 6 x1 + x2 + -1.5 x1 + 0.25 x2
+            auto product = node::mul(), factor = node::mul(), difference = node::sub(), negation = node::neg(), quotient = node::div();
+            factor->AddSubtree(node::constant(2));
+            factor->AddSubtree(node::constant(3));
+            product->AddSubtree(factor);
+            product->AddSubtree(node::variable("x1"));
+            difference->AddSubtree(node::variable("x2"));
+            difference->AddSubtree(node::constant(0));
+            negation->AddSubtree(node::variable("x1", 1.5));
+            quotient->AddSubtree(node::variable("x2"));
+            quotient->AddSubtree(node::constant(4));
+            auto root = node::add();
+            for (auto s : { product, difference, negation, quotient })
+                root->AddSubtree(s);
+
+            simplifier_result result;
+            auto simplified = simplifier().simplify(root, nullptr, &result);
+            Assert::AreEqual(14, result.initial_length, L"The initial length should be reported", LINE_INFO());
+            Assert::AreEqual(5, simplified->GetLength(), L"Only the sum of the four variables should be left", LINE_INFO());
+            Assert::AreEqual(9, result.removed(), L"The removed nodes should be reported", LINE_INFO());
+            Assert::AreEqual(1, result.folded, L"The constant product should be folded", LINE_INFO());
+            Assert::AreEqual(3, result.merged_weights, L"Factors and negations should go into the weights", LINE_INFO());
+            auto a = interpreter::evaluate(root, 0, nrows, data);
+            auto b = interpreter::evaluate(simplified, 0, nrows, data);
+            for (int row = 0; row < nrows; ++row)
+                Assert::AreEqual(a[row], b[row], 1e-12, L"Simplification should not change the values", LINE_INFO());
+            delete simplified;
+            delete root;
+
+            // x1 - x1 is only zero for finite x1
+            auto cancel = node::sub();
+            cancel->AddSubtree(node::variable("x1"));
+            cancel->AddSubtree(node::variable("x1"));
+            simplified = simplifier().simplify(cancel, nullptr, &result);
+            Assert::AreEqual(0, result.removed(), L"x - x should be kept by default", LINE_INFO());
+            delete simplified;
+            simplifier_options finite;
+            finite.assume_finite = true;
+            simplified = simplifier(finite).simplify(cancel, nullptr, &result);
+            Assert::AreEqual(1, simplified->GetLength(), L"x - x should be zero for finite values", LINE_INFO());
+            Assert::AreEqual(0.0, simplified->GetValue(), L"x - x should be zero for finite values", LINE_INFO());
+            delete simplified;
+            delete cancel;
+
+            // x1 / x1 is not one where x1 is zero either
+            auto ratio = node::div();
+            ratio->AddSubtree(node::variable("x1"));
+            ratio->AddSubtree(node::variable("x1"));
+            simplified = simplifier(finite).simplify(ratio, nullptr, &result);
+            Assert::AreEqual(0, result.removed(), L"x / x should be kept for finite values", LINE_INFO());
+            delete simplified;
+            finite.assume_nonzero = true;
+            simplified = simplifier(finite).simplify(ratio, nullptr, &result);
+            Assert::AreEqual(1.0, simplified->GetValue(), L"x / x should be one for nonzero values", LINE_INFO());
+            delete simplified;
+            delete ratio;
+
+            // random trees keep their values once a third of their variables are turned into constants
+            for (int t = 0; t < 50; ++t)
+            {
+                auto random = node::Random(rand.get(), data, 7);
+                auto linear = linear_tree::FromNode(random);
+                delete random;
+                for (int i = 0; i < linear.GetLength(); i += 3)
+                {
+                    if (linear[i].opcode == VARIABLE)
+                    {
+                        linear[i].opcode = CONSTANT;
+                        linear[i].value = linear[i].weight;
+                    }
+                }
+                auto tree = linear.ToNode();
+                auto simple = simplifier().simplify(tree, nullptr, &result);
+                Assert::AreEqual(simple->GetLength(), result.length, L"The reported length should be the new length", LINE_INFO());
+                auto x = interpreter::evaluate(tree, 0, nrows, data);
+                auto y = interpreter::evaluate(simple, 0, nrows, data);
+                for (int row = 0; row < nrows; ++row)
+                {
+                    if (std::isfinite(x[row]) && std::abs(x[row]) < 1e6)
+                        Assert::AreEqual(x[row], y[row], 1e-9 * max(1.0, std::abs(x[row])), L"Simplification should not change the values", LINE_INFO());
+                }
+                delete simple;
+                delete tree;
+            }
+        }
+
+        TEST_METHOD(PopulationInitializationTest)
+        {
+            auto data = dataset({ "x1", "x2", "x3" }, 10);
+
+            // the same streams with any number of threads
+            for (auto method : { initialization::ramped_half_and_half, initialization::exact_size })
+            {
+                initializer_options options;
+                options.method = method;
+                options.functions = { ADD, SUB, MUL, DIV, SIN, EXP };
+                options.constant_probability = 0.2;
+                population_initializer serial(options, 1), parallel(options, 3);
+                node_arena a, b, c;
+                auto x = serial.generate(200, data, { &a });
+                auto y = parallel.generate(200, data, { &a, &b, &c });
+                for (int i = 0; i < 200; ++i)
+                {
+                    auto p = linear_tree::FromNode(x[i]).Nodes();
+                    auto q = linear_tree::FromNode(y[i]).Nodes();
+                    Assert::AreEqual(p.size(), q.size(), L"The trees should not depend on the number of threads", LINE_INFO());
+                    for (size_t k = 0; k < p.size(); ++k)
+                    {
+                        Assert::IsTrue(p[k].opcode == q[k].opcode && p[k].variable == q[k].variable, L"The trees should not depend on the number of threads", LINE_INFO());
+                        Assert::AreEqual(p[k].value, q[k].value, L"The trees should not depend on the number of threads", LINE_INFO());
+                        Assert::AreEqual(p[k].weight, q[k].weight, L"The trees should not depend on the number of threads", LINE_INFO());
+                    }
+                    Assert::IsTrue(y[i]->IsPooled(), L"Trees should be allocated in the arenas", LINE_INFO());
+                }
+            }
+
+            // ramped half-and-half: full trees have the exact depth, grown trees stay within it
+            initializer_options ramped;
+            ramped.min_depth = 2;
+            ramped.max_depth = 5;
+            population_initializer init(ramped, 2);
+            auto trees = init.generate(80, data);
+            for (int i = 0; i < 80; ++i)
+            {
+                auto depth = ramped.min_depth + i % 4;
+                if ((i / 4) % 2 == 0)
+                {
+                    Assert::AreEqual(depth, trees[i]->GetDepth(), L"Full trees should have the ramped depth", LINE_INFO());
+                    // binary functions only, so a full tree is a complete binary tree
+                    Assert::AreEqual((1 << depth) - 1, trees[i]->GetLength(), L"Full trees should have two children per function", LINE_INFO());
+                }
+                else
+                {
+                    Assert::IsTrue(trees[i]->GetDepth() >= 2 && trees[i]->GetDepth() <= depth, L"Grown trees should be within the ramped depth", LINE_INFO());
+                }
+                for (auto n : trees[i]->IteratePrefix())
+                {
+                    if (n->GetOpCode() != VARIABLE && n->GetOpCode() != CONSTANT)
+                        Assert::AreEqual(2, n->SubtreeCount(), L"Binary functions should get two children", LINE_INFO());
+                }
+                delete trees[i];
+            }
+
+            // exact sizes: every length of the range is reached when unary functions are available
+            initializer_options sized;
+            sized.method = initialization::exact_size;
+            sized.functions = { ADD, MUL, SIN };
+            sized.min_length = 1;
+            sized.max_length = 30;
+            population_initializer exact(sized, 2);
+            for (int length = 1; length <= 30; ++length)
+            {
+                exact.options().min_length = exact.options().max_length = length;
+                trees = exact.generate(10, data);
+                for (auto t : trees)
+                {
+                    Assert::AreEqual(length, t->GetLength(), L"Trees should have the requested length", LINE_INFO());
+                    delete t;
+                }
+            }
+
+            // the streams are reproducible and in bounds
+            counter_rng r(42, 7), s(42, 7), u(42, 8);
+            int differ = 0;
+            for (int i = 0; i < 1000; ++i)
+            {
+                auto v = r.next(-3, 3);
+                Assert::AreEqual(v, s.next(-3, 3), L"Streams should be reproducible", LINE_INFO());
+                Assert::IsTrue(v >= -3 && v <= 3, L"Numbers should be in range", LINE_INFO());
+                auto d = r.next_double();
+                Assert::AreEqual(d, s.next_double(), L"Streams should be reproducible", LINE_INFO());
+                Assert::IsTrue(d >= 0 && d < 1, L"Numbers should be in range", LINE_INFO());
+                differ += u.next_u64() != r.next_u64();
+                s.next_u64();
+            }
+            Assert::IsTrue(differ > 990, L"Streams should be independent", LINE_INFO());
+            auto position = r.position();
+            auto next = r.next_u64();
+            r.seek(position);
+            Assert::AreEqual(next, r.next_u64(), L"Seeking should replay the stream", LINE_INFO());
+        }
+    };
+}
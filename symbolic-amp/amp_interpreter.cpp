@@ -1,109 +1,197 @@
 #include "amp_interpreter.h"
+#include "symbol_table.h"
+#include "operators.h"
 #include <iostream>
 
 using namespace std;
 using namespace concurrency;
 
-vector<amp_instruction> amp_interpreter::compile(node *root) const
+namespace
 {
-    vector<amp_instruction> instructions(root->GetLength());
-    instructions[0].opcode = root->GetOpCode();
-    auto nodes = root->IterateBreadth();
-    int c = 1;
+    // a[i] = f(a[i]) on the accelerator
+    template<typename T, typename F>
+    void update(const array_view<T, 1>& a, F f)
+    {
+        parallel_for_each(a.extent, [=](index<1> idx) restrict(amp)
+        {
+            a[idx] = f(a[idx]);
+        });
+    }
+
+    // a[i] = f(a[i], b[i]); b is not needed afterwards
+    template<typename T, typename F>
+    void combine(const array_view<T, 1>& a, const array_view<T, 1>& b, F f)
+    {
+        parallel_for_each(a.extent, [=](index<1> idx) restrict(amp)
+        {
+            a[idx] = f(a[idx], b[idx]);
+        });
+        b.discard_data();
+    }
+}
+
+template<typename T>
+vector<basic_amp_instruction<T>> basic_amp_interpreter<T>::compile(node *root) const
+{
+    return compile(linear_tree::FromNode(root));
+}
+
+template<typename T>
+vector<basic_amp_instruction<T>> basic_amp_interpreter<T>::compile(const linear_tree& tree) const
+{
+    auto const & nodes = tree.Nodes();
+    auto hashes = tree.Hashes();
+    vector<amp_instruction> instructions(nodes.size());
     for (size_t i = 0; i < nodes.size(); ++i)
     {
-        auto node = nodes[i];
-        if (node->SubtreeCount() == 0)
-            continue;
-        auto subtrees = node->Subtrees();
-        for (size_t j = 0; j != subtrees.size(); ++j)
+        auto const & n = nodes[i];
+        auto & instr = instructions[i];
+        instr.opcode = n.opcode;
+        instr.arity = n.arity;
+        instr.length = n.length;
+        instr.hash = hashes[i];
+        operators::check_arity(n.opcode, n.arity);
+        if (n.opcode == VARIABLE)
         {
-            auto subtree = subtrees[j];
-            auto & instr = instructions[c + j];
-            instr.opcode = subtree->GetOpCode();
-            instr.label = subtree->GetName();
-            if (subtree->GetOpCode() == VARIABLE)
-            {
-                instr.weight = subtree->GetWeight();
-                instr.data = std::make_unique<concurrency::array_view<double, 1>>(rows);
-            }
-            if (subtree->GetOpCode() == CONSTANT)
-            {
-                instr.value = subtree->GetValue();
-                instr.data = std::make_unique<concurrency::array_view<double, 1>>(rows);
-            }
+            instr.variable = ds.variable_index(n.variable);
+            if (instr.variable < 0)
+                throw std::out_of_range("the variable " + symbol_table::name(n.variable) + " is not present in the dataset.");
+            instr.weight = static_cast<T>(n.weight);
         }
-        instructions[i].index = c;
-        c += node->SubtreeCount();
+        if (n.opcode == CONSTANT)
+            instr.value = static_cast<T>(n.value);
     }
+    // the buffers are drawn from the pool when the program runs
+    register_allocation::allocate(instructions, true);
     return instructions;
 }
 
-unique_ptr<array_view<double, 1>> amp_interpreter::evaluate(node *root)
+template<typename T>
+unique_ptr<array_view<T, 1>> basic_amp_interpreter<T>::evaluate(node *root)
 {
     auto instructions = compile(root);
     return std::move(evaluate(instructions));
 }
 
-unique_ptr<array_view<double, 1> >amp_interpreter::evaluate(vector<amp_instruction>& code)
+template<typename T>
+unique_ptr<array_view<T, 1>> basic_amp_interpreter<T>::evaluate(vector<amp_instruction>& code)
 {
-    for (auto it = rbegin(code); it != rend(code); ++it)
+    // the instructions run in the order of the schedule, and every result lives in the pooled buffer of its slot.
+    // with a cache, every subtree is looked up at the first step of its range, and a hit skips the whole range
+    register_allocation::subtree_index subtrees;
+    vector<T> values;
+    if (cache != nullptr)
     {
-        switch (it->opcode)
-        {
-        case ADD:
+        subtrees = register_allocation::subtree_index(code);
+        values.resize(rows);
+    }
+    auto root = static_cast<int>(code.size()) - 1;
+    for (int j = 0; j <= root;)
+    {
+        auto hit = 0;
+        if (cache != nullptr)
         {
-            it->data = std::move(code[it->index].data);
-            auto a = *it->data;
-            auto b = *code[it->index + 1].data;
-            parallel_for_each(a.extent, [=](index<1> idx) restrict(amp)
+            for (auto k = subtrees.offsets[j]; k < subtrees.offsets[j + 1] && hit == 0; ++k)
             {
-                a[idx] += b[idx];
-            });
-            b.discard_data();
-            break;
+                auto& instr = code[subtrees.roots[k]];
+                if (cache->cacheable(instr.length) && cache->lookup(instr.hash, 0, rows, values.data()))
+                {
+                    instr.data = std::make_unique<array_view<T, 1>>(buffer(instr.slot));
+                    array_view<T, 1> host(rows, values);
+                    host.copy_to(*instr.data);
+                    hit = instr.length;
+                }
+            }
         }
-        case SUB:
+        if (hit > 0)
         {
-            it->data = std::move(code[it->index].data);
-            auto a = *it->data;
-            auto b = *code[it->index + 1].data;
-            parallel_for_each(a.extent, [=](index<1> idx) restrict(amp)
-            {
-                a[idx] -= b[idx];
-            });
-            b.discard_data();
-            break;
+            j += hit;
+            continue;
         }
-        case MUL:
+        auto it = begin(code) + code[j++].order;
+
+        // the first child's values are updated in place and become the values of the operation (the allocation
+        // gives the operation the slot of its first child)
+        vector<int> children(it->arity);
+        operators::for_each_child(code, static_cast<int>(it - begin(code)), [&](int k, int c) { children[k] = c; });
+        if (it->arity > 0)
+            it->data = std::move(code[children[0]].data);
+        else
+            it->data = std::make_unique<array_view<T, 1>>(buffer(it->slot));
+        auto arity = it->arity;
+        auto b = [&](int k) { return *code[children[k]].data; };
+        switch (it->opcode)
         {
-            it->data = std::move(code[it->index].data);
-            auto a = *it->data;
-            auto b = *code[it->index + 1].data;
-            parallel_for_each(a.extent, [=](index<1> idx) restrict(amp)
-            {
-                a[idx] *= b[idx];
-            });
-            b.discard_data();
+        case ADD:
+            for (int k = 1; k < arity; ++k)
+                combine(*it->data, b(k), [](T x, T y) restrict(amp) { return x + y; });
             break;
-        }
+        case MUL:
+            for (int k = 1; k < arity; ++k)
+                combine(*it->data, b(k), [](T x, T y) restrict(amp) { return x * y; });
+            break;
+        case SUB:
         case DIV:
         {
-            it->data = std::move(code[it->index].data);
-            auto a = *it->data;
-            auto b = *code[it->index + 1].data;
-            parallel_for_each(a.extent, [=](index<1> idx) restrict(amp)
+            auto sub = it->opcode == SUB;
+            if (arity == 1)
             {
-                a[idx] /= b[idx];
-            });
-            b.discard_data();
+                if (sub)
+                    update(*it->data, [](T x) restrict(amp) { return -x; });
+                else
+                    update(*it->data, [](T x) restrict(amp) { return T(1) / x; });
+                break;
+            }
+            // the children after the first are summed (multiplied) into the last one
+            auto rest = b(arity - 1);
+            for (int k = arity - 2; k >= 1; --k)
+            {
+                if (sub)
+                    combine(rest, b(k), [](T x, T y) restrict(amp) { return y + x; });
+                else
+                    combine(rest, b(k), [](T x, T y) restrict(amp) { return y * x; });
+            }
+            if (sub)
+                combine(*it->data, rest, [](T x, T y) restrict(amp) { return x - y; });
+            else
+                combine(*it->data, rest, [](T x, T y) restrict(amp) { return x / y; });
             break;
         }
+        case NEG:
+            update(*it->data, [](T x) restrict(amp) { return -x; });
+            break;
+        case EXP:
+            update(*it->data, [](T x) restrict(amp) { return precise_math::exp(x); });
+            break;
+        case LOG:
+            update(*it->data, [](T x) restrict(amp) { return precise_math::log(x); });
+            break;
+        case SIN:
+            update(*it->data, [](T x) restrict(amp) { return precise_math::sin(x); });
+            break;
+        case COS:
+            update(*it->data, [](T x) restrict(amp) { return precise_math::cos(x); });
+            break;
+        case SQRT:
+            update(*it->data, [](T x) restrict(amp) { return precise_math::sqrt(x); });
+            break;
+        case SQUARE:
+            update(*it->data, [](T x) restrict(amp) { return x * x; });
+            break;
+        case TANH:
+            update(*it->data, [](T x) restrict(amp) { return precise_math::tanh(x); });
+            break;
+        case POW:
+            combine(*it->data, b(1), [](T x, T y) restrict(amp) { return precise_math::pow(x, y); });
+            break;
+        case AQ:
+            combine(*it->data, b(1), [](T x, T y) restrict(amp) { return x / precise_math::sqrt(1 + y * y); });
+            break;
         case VARIABLE:
         {
             auto a = *it->data;
-            auto v = *gpu_data[it->label];
-            double weight = it->weight;
+            auto v = *gpu_data[it->variable];
+            T weight = it->weight;
             parallel_for_each(a.extent, [=](index<1> idx) restrict(amp)
             {
                 a[idx] = v[idx] * weight;
@@ -112,7 +200,7 @@ unique_ptr<array_view<double, 1> >amp_interpreter::evaluate(vector<amp_instructi
         }
         case CONSTANT: {
             auto a = *it->data;
-            double v = it->value;
+            T v = it->value;
             parallel_for_each(a.extent, [=](index<1> i) restrict(amp)
             {
                 a[i] = v;
@@ -121,6 +209,29 @@ unique_ptr<array_view<double, 1> >amp_interpreter::evaluate(vector<amp_instructi
         }
         default: break;
         }
+        if (cache != nullptr && cache->cacheable(it->length))
+        {
+            vector<T> values(rows);
+            array_view<T, 1> host(rows, values);
+            it->data->copy_to(host);
+            host.synchronize();
+            cache->insert(it->hash, 0, rows, values.data());
+        }
     }
-    return std::move(code[0].data);
+    // the caller keeps the values of the root, so its buffer leaves the pool
+    pool[code.back().slot] = nullptr;
+    return std::move(code.back().data);
 }
+
+template<typename T>
+array_view<T, 1>& basic_amp_interpreter<T>::buffer(int slot)
+{
+    if (pool.size() <= static_cast<size_t>(slot))
+        pool.resize(slot + 1);
+    if (!pool[slot])
+        pool[slot] = std::make_unique<array_view<T, 1>>(rows);
+    return *pool[slot];
+}
+
+template class basic_amp_interpreter<double>;
+template class basic_amp_interpreter<float>;
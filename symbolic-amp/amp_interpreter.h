@@ -2,41 +2,70 @@
 
 #include "amp.h"
 #include "node.h"
+#include "linear_tree.h"
+#include "dataset.h"
+#include "subtree_cache.h"
+#include "register_allocation.h"
 #include <memory>
 #include <iostream>
 #include <stdexcept>
 
-class amp_instruction
+template<typename T>
+class basic_amp_instruction
 {
 public:
-    amp_instruction() {}
+    basic_amp_instruction() {}
     op_code                                            opcode;
-    int                                                 index;
-    double                                              value;
-    double                                             weight;
-    std::string                                         label;
-    std::unique_ptr<concurrency::array_view<double, 1>>  data;
+    int                                                 arity;
+    int                                                length;
+    T                                                   value;
+    T                                                  weight;
+    int                                              variable;   // dataset column index
+    uint64_t                                             hash;   // structural hash of the subtree rooted here
+    int                                                  slot;   // pooled buffer of the result
+    int                                                 order;   // the instruction executed at this step of the schedule
+    std::unique_ptr<concurrency::array_view<T, 1>>       data;
 };
 
-class amp_interpreter
+// T is double or float; single precision is native on every accelerator, while double precision may be
+// emulated or limited, so float doubles the throughput on most devices (instantiated in amp_interpreter.cpp)
+template<typename T>
+class basic_amp_interpreter
 {
 public:
-    explicit amp_interpreter(std::unordered_map<std::string, std::vector<double>>& data)
+    typedef basic_amp_instruction<T> amp_instruction;
+
+    explicit basic_amp_interpreter(const basic_dataset<T>& data) : ds(data), cache(nullptr)
     {
-        rows = static_cast<int>(data.begin()->second.size());
-        for (const auto & t : data)
+        rows = data.rows();
+        for (int i = 0; i < data.cols(); ++i)
         {
-            gpu_data[t.first] = std::make_unique<concurrency::array_view<const double, 1>>(t.second.size(), t.second);
+            gpu_data.push_back(std::make_unique<concurrency::array_view<const T, 1>>(rows, data.column(i)));
         }
     }
-    ~amp_interpreter() {}
+    ~basic_amp_interpreter() {}
 
     std::vector<amp_instruction> compile(node *root) const;
+    std::vector<amp_instruction> compile(const linear_tree& tree) const;
+
+    std::unique_ptr<concurrency::array_view<T, 1>> evaluate(node *root);
+    std::unique_ptr<concurrency::array_view<T, 1>> evaluate(std::vector<amp_instruction>& instructions);
 
-    std::unique_ptr<concurrency::array_view<double, 1>> evaluate(node *root);
-    std::unique_ptr<concurrency::array_view<double, 1>> evaluate(std::vector<amp_instruction>& instructions);
+    // whole-column results of subtrees are looked up in, and added to, the cache. null disables caching
+    void set_cache(subtree_cache* c) { cache = c; }
 
 private:
     int rows;
-    std::unordered_map<std::string, std::unique_ptr<concurrency::array_view<const double, 1>>> gpu_data;
+    const basic_dataset<T>& ds;
+    subtree_cache* cache;
+    // indexed by dataset column
+    std::vector<std::unique_ptr<concurrency::array_view<const T, 1>>> gpu_data;
+    // buffers of rows values indexed by slot, allocated on first use and reused by every evaluation
+    std::vector<std::unique_ptr<concurrency::array_view<T, 1>>> pool;
+
+    concurrency::array_view<T, 1>& buffer(int slot);
 };
+
+typedef basic_amp_instruction<double> amp_instruction;
+typedef basic_amp_interpreter<double> amp_interpreter;
+typedef basic_amp_interpreter<float> float_amp_interpreter;
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "interpreter.h"
+#include "simd.h"
+#include "simd_math.h"
+
+// reverse-mode differentiation of a compiled program with respect to its parameters: the weight of every VARIABLE
+// and the value of every CONSTANT, in instruction order. one forward and one reverse sweep per row block give the
+// whole jacobian, instead of two evaluations per parameter with finite differences
+class autodiff
+{
+public:
+    // indices of the instructions that carry a parameter
+    static std::vector<int> parameters(const std::vector<instruction>& code)
+    {
+        std::vector<int> indices;
+        for (int i = 0; i < static_cast<int>(code.size()); ++i)
+        {
+            if (code[i].opcode == VARIABLE || code[i].opcode == CONSTANT)
+                indices.push_back(i);
+        }
+        return indices;
+    }
+
+    static std::vector<double> get_parameters(const std::vector<instruction>& code)
+    {
+        std::vector<double> values;
+        for (auto& instr : code)
+        {
+            if (instr.opcode == VARIABLE)
+                values.push_back(instr.weight);
+            else if (instr.opcode == CONSTANT)
+                values.push_back(instr.value);
+        }
+        return values;
+    }
+
+    static void set_parameters(std::vector<instruction>& code, const std::vector<double>& values)
+    {
+        size_t p = 0;
+        for (auto& instr : code)
+        {
+            if (instr.opcode == VARIABLE)
+                instr.weight = values.at(p++);
+            else if (instr.opcode == CONSTANT)
+                instr.value = values.at(p++);
+        }
+    }
+
+    static std::vector<double> jacobian(node* root, const dataset& data, int start, int count)
+    {
+        auto code = interpreter::compile(root, data);
+        std::vector<double> values(static_cast<size_t>(count) * parameters(code).size());
+        jacobian(code, start, count, nullptr, values.data());
+        return values;
+    }
+
+    static void jacobian(const std::vector<instruction>& code, int start, int count, double* result, double* jacobian)
+    {
+        simd::aligned_vector<double> buffer(2 * code.size() * interpreter::block_size);
+        autodiff::jacobian(code, start, count, result, jacobian, buffer.data());
+    }
+
+    // jacobian of the rows [start, start + count) in column-major order: the derivatives with respect to parameter p
+    // are at jacobian + p * count. result receives the values of the program unless it is null. buffer is scratch
+    // space for at least 2 * code.size() * block_size values
+    static void jacobian(const std::vector<instruction>& code, int start, int count, double* result, double* jacobian, double* buffer)
+    {
+        constexpr int block_size = interpreter::block_size;
+        typedef simd::pack<double> P;
+        auto size = static_cast<int>(code.size());
+        auto root = size - 1;
+        auto values = buffer;
+        auto adjoints = buffer + size * block_size;
+
+        std::vector<int> column(size, -1);
+        auto p = 0;
+        for (auto i : parameters(code))
+            column[i] = p++;
+
+        // every node has a single parent, so the adjoint of a node is written once and an operand of an addition
+        // can share the adjoint of its parent instead of a copy
+        std::vector<const double*> g(size);
+        std::vector<int> children;
+        for (int row = start; row < start + count; row += block_size)
+        {
+            auto n = std::min(block_size, start + count - row);
+            interpreter::evaluate_nodes(code, row, n, values);
+            if (result)
+                std::memcpy(result + (row - start), values + root * block_size, n * sizeof(double));
+
+            simd::fill(adjoints + root * block_size, 1.0, n);
+            g[root] = adjoints + root * block_size;
+            for (int i = root; i >= 0; --i)
+            {
+                auto& instr = code[i];
+                auto gi = g[i];
+                switch (instr.opcode)
+                {
+                case VARIABLE:
+                    simd::mul(jacobian + static_cast<size_t>(column[i]) * count + (row - start), gi, instr.data + row, n);
+                    continue;
+                case CONSTANT:
+                    std::memcpy(jacobian + static_cast<size_t>(column[i]) * count + (row - start), gi, n * sizeof(double));
+                    continue;
+                default:
+                    break;
+                }
+
+                // children in order, and the slices for their adjoints
+                auto arity = instr.arity;
+                if (static_cast<int>(children.size()) < arity)
+                    children.resize(arity);
+                operators::for_each_child(code, i, [&](int k, int c) { children[k] = c; });
+                auto vi = values + i * block_size;
+                auto a = children[0];
+                auto ga = adjoints + a * block_size, va = values + a * block_size;
+                switch (instr.opcode)
+                {
+                case ADD:
+                    for (int k = 0; k < arity; ++k)
+                        g[children[k]] = gi;
+                    break;
+                case SUB:
+                    // the negated adjoint is shared by every child after the first
+                    if (arity == 1)
+                    {
+                        simd::neg(ga, gi, n);
+                        g[a] = ga;
+                        break;
+                    }
+                    g[a] = gi;
+                    simd::neg(adjoints + children[1] * block_size, gi, n);
+                    for (int k = 1; k < arity; ++k)
+                        g[children[k]] = adjoints + children[1] * block_size;
+                    break;
+                case MUL:
+                    // the adjoint times the product of the other children
+                    for (int k = 0; k < arity; ++k)
+                    {
+                        auto gk = adjoints + children[k] * block_size;
+                        std::memcpy(gk, gi, n * sizeof(double));
+                        for (int j = 0; j < arity; ++j)
+                        {
+                            if (j != k)
+                                simd::mul(gk, gk, values + children[j] * block_size, n);
+                        }
+                        g[children[k]] = gk;
+                    }
+                    break;
+                case DIV:
+                    // d(a / b)/da = 1 / b, d(a / b)/db = -(a / b) / b, with b the product of the children after the first
+                    if (arity == 1)
+                    {
+                        simd::div(ga, gi, va, n);
+                        simd::mul(ga, ga, vi, n);
+                        simd::neg(ga, ga, n);
+                        g[a] = ga;
+                        break;
+                    }
+                    for (int k = 1; k < arity; ++k)
+                    {
+                        auto gk = adjoints + children[k] * block_size;
+                        simd::div(gk, gi, values + children[k] * block_size, n);
+                        simd::mul(gk, gk, vi, n);
+                        simd::neg(gk, gk, n);
+                        g[children[k]] = gk;
+                    }
+                    std::memcpy(ga, gi, n * sizeof(double));
+                    for (int k = 1; k < arity; ++k)
+                        simd::div(ga, ga, values + children[k] * block_size, n);
+                    g[a] = ga;
+                    break;
+                case NEG:
+                    simd::neg(ga, gi, n);
+                    g[a] = ga;
+                    break;
+                case EXP:
+                    simd::mul(ga, gi, vi, n);
+                    g[a] = ga;
+                    break;
+                case LOG:
+                    simd::div(ga, gi, va, n);
+                    g[a] = ga;
+                    break;
+                case SIN:
+                    simd::cos(ga, va, n);
+                    simd::mul(ga, ga, gi, n);
+                    g[a] = ga;
+                    break;
+                case COS:
+                    simd::sin(ga, va, n);
+                    simd::mul(ga, ga, gi, n);
+                    simd::neg(ga, ga, n);
+                    g[a] = ga;
+                    break;
+                case SQRT:
+                    // 1 / (2 sqrt(a))
+                    simd::add(ga, vi, vi, n);
+                    simd::div(ga, gi, ga, n);
+                    g[a] = ga;
+                    break;
+                case SQUARE:
+                    simd::add(ga, va, va, n);
+                    simd::mul(ga, ga, gi, n);
+                    g[a] = ga;
+                    break;
+                case TANH:
+                    // 1 - tanh^2
+                    simd::map(ga, vi, n, [](P::type y) { return P::sub(P::broadcast(1.0), P::mul(y, y)); });
+                    simd::mul(ga, ga, gi, n);
+                    g[a] = ga;
+                    break;
+                case POW:
+                {
+                    // d(a^b)/da = b a^(b - 1), d(a^b)/db = a^b log(a)
+                    auto b = children[1];
+                    auto gb = adjoints + b * block_size, vb = values + b * block_size;
+                    simd::map(gb, vb, n, [](P::type x) { return P::sub(x, P::broadcast(1.0)); });
+                    simd::pow(ga, va, gb, n);
+                    simd::mul(ga, ga, vb, n);
+                    simd::mul(ga, ga, gi, n);
+                    simd::log(gb, va, n);
+                    simd::mul(gb, gb, vi, n);
+                    simd::mul(gb, gb, gi, n);
+                    g[a] = ga;
+                    g[b] = gb;
+                    break;
+                }
+                case AQ:
+                {
+                    // d/da = 1 / sqrt(1 + b^2), d/db = -aq(a, b) b / (1 + b^2)
+                    auto b = children[1];
+                    auto gb = adjoints + b * block_size, vb = values + b * block_size;
+                    simd::map(ga, vb, n, [](P::type x) { return P::div(P::broadcast(1.0), P::sqrt(P::fma(x, x, P::broadcast(1.0)))); });
+                    simd::mul(ga, ga, gi, n);
+                    simd::map(gb, vi, vb, n, [](P::type y, P::type x) { return P::div(P::mul(y, x), P::fma(x, x, P::broadcast(1.0))); });
+                    simd::mul(gb, gb, gi, n);
+                    simd::neg(gb, gb, n);
+                    g[a] = ga;
+                    g[b] = gb;
+                    break;
+                }
+                default:
+                    throw std::invalid_argument("autodiff: unsupported opcode");
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,379 @@
+#pragma once
+#include "config.h"
+#include "interpreter.h"
+#include "population_evaluator.h"
+#include "random.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#if SYMBOLIC_AMP_HAS_AMP
+#include "amp_interpreter.h"
+#endif
+
+// common interface of the evaluation backends, so callers can switch between them (or let the dispatcher choose)
+// without knowing how each one runs. every backend computes the same values, up to the accuracy of the math kernels
+template<typename T, typename Accumulator = T>
+class basic_backend
+{
+public:
+    typedef basic_interpreter<T, Accumulator> interpreter;
+    typedef basic_dataset<T> dataset;
+
+    virtual ~basic_backend() {}
+
+    virtual const char* name() const = 0;
+
+    // values of the tree on the rows [start, start + count)
+    virtual void evaluate(node* root, const dataset& data, int start, int count, T* result) = 0;
+
+    virtual fitness_statistics evaluate_fitness(node* root, const dataset& data, const std::string& target, int start, int count) = 0;
+
+    // fitness of every tree of a population; backends that can do better than one tree after the other override it
+    virtual std::vector<fitness_statistics> evaluate_fitness(const std::vector<node*>& trees, const dataset& data, const std::string& target, int start, int count)
+    {
+        std::vector<fitness_statistics> statistics(trees.size());
+        for (size_t i = 0; i < trees.size(); ++i)
+            statistics[i] = evaluate_fitness(trees[i], data, target, start, count);
+        return statistics;
+    }
+
+protected:
+    // fitness from materialized values, one block at a time so the widening of the mixed precision mode stays in L1
+    static fitness_statistics statistics_of(const T* values, const dataset& data, const std::string& target, int start, int count)
+    {
+        fitness_statistics statistics;
+        auto y = data[target] + start;
+        for (int i = 0; i < count; i += interpreter::block_size)
+        {
+            auto n = std::min(interpreter::block_size, count - i);
+            if constexpr (std::is_same<T, Accumulator>::value)
+            {
+                statistics.add(values + i, y + i, n);
+            }
+            else
+            {
+                alignas(simd::alignment) Accumulator x[interpreter::block_size], t[interpreter::block_size];
+                simd::convert(x, values + i, n);
+                simd::convert(t, y + i, n);
+                statistics.add(x, t, n);
+            }
+        }
+        return statistics;
+    }
+};
+
+// one row at a time through the whole program: no scratch buffer and no block setup, which wins for a handful of rows
+template<typename T, typename Accumulator = T>
+class basic_scalar_backend : public basic_backend<T, Accumulator>
+{
+public:
+    typedef basic_backend<T, Accumulator> base;
+    typedef typename base::interpreter interpreter;
+    typedef typename base::dataset dataset;
+    using base::evaluate_fitness;
+
+    const char* name() const override { return "scalar"; }
+
+    void evaluate(node* root, const dataset& data, int start, int count, T* result) override
+    {
+        auto code = interpreter::compile(root, data);
+        for (int i = 0; i < count; ++i)
+            result[i] = interpreter::evaluate(code, start + i);
+    }
+
+    fitness_statistics evaluate_fitness(node* root, const dataset& data, const std::string& target, int start, int count) override
+    {
+        std::vector<T> values(count);
+        evaluate(root, data, start, count, values.data());
+        return base::statistics_of(values.data(), data, target, start, count);
+    }
+};
+
+// columnar evaluation with the simd kernels on the calling thread
+template<typename T, typename Accumulator = T>
+class basic_block_backend : public basic_backend<T, Accumulator>
+{
+public:
+    typedef basic_backend<T, Accumulator> base;
+    typedef typename base::interpreter interpreter;
+    typedef typename base::dataset dataset;
+    using base::evaluate_fitness;
+
+    const char* name() const override { return "block"; }
+
+    void evaluate(node* root, const dataset& data, int start, int count, T* result) override
+    {
+        interpreter::evaluate(interpreter::compile(root, data), start, count, result);
+    }
+
+    fitness_statistics evaluate_fitness(node* root, const dataset& data, const std::string& target, int start, int count) override
+    {
+        return interpreter::evaluate_fitness(root, data, target, start, count);
+    }
+};
+
+// columnar evaluation on a thread pool: a single tree is split into row chunks, a population into (tree, chunk) tasks
+template<typename T, typename Accumulator = T>
+class basic_parallel_backend : public basic_backend<T, Accumulator>
+{
+public:
+    typedef basic_backend<T, Accumulator> base;
+    typedef typename base::interpreter interpreter;
+    typedef typename base::dataset dataset;
+
+    explicit basic_parallel_backend(int nthreads = 0) : evaluator(nthreads) {}
+
+    const char* name() const override { return "parallel"; }
+    int threads() const { return evaluator.threads(); }
+
+    void evaluate(node* root, const dataset& data, int start, int count, T* result) override
+    {
+        evaluator.evaluate_population(evaluator.compile_population({ root }, data), start, count, { result });
+    }
+
+    fitness_statistics evaluate_fitness(node* root, const dataset& data, const std::string& target, int start, int count) override
+    {
+        return evaluator.evaluate_fitness(std::vector<node*>{ root }, data, target, start, count)[0];
+    }
+
+    std::vector<fitness_statistics> evaluate_fitness(const std::vector<node*>& trees, const dataset& data, const std::string& target, int start, int count) override
+    {
+        return evaluator.evaluate_fitness(trees, data, target, start, count);
+    }
+
+private:
+    basic_population_evaluator<T, Accumulator> evaluator;
+};
+
+#if SYMBOLIC_AMP_HAS_AMP
+// the C++ AMP interpreter. the columns are bound to the accelerator the first time a dataset is seen, and every
+// tree is evaluated on all of its rows, of which the requested ones are copied back
+template<typename T, typename Accumulator = T>
+class basic_amp_backend : public basic_backend<T, Accumulator>
+{
+public:
+    typedef basic_backend<T, Accumulator> base;
+    typedef typename base::dataset dataset;
+    using base::evaluate_fitness;
+
+    const char* name() const override { return "amp"; }
+
+    // true if there is an accelerator that is not emulated on the cpu
+    static bool available()
+    {
+        for (auto& a : concurrency::accelerator::get_all())
+            if (!a.is_emulated)
+                return true;
+        return false;
+    }
+
+    void evaluate(node* root, const dataset& data, int start, int count, T* result) override
+    {
+        auto view = bind(data).evaluate(root);
+        concurrency::copy(view->section(start, count), result);
+    }
+
+    fitness_statistics evaluate_fitness(node* root, const dataset& data, const std::string& target, int start, int count) override
+    {
+        std::vector<T> values(count);
+        evaluate(root, data, start, count, values.data());
+        return base::statistics_of(values.data(), data, target, start, count);
+    }
+
+private:
+    basic_amp_interpreter<T>& bind(const dataset& data)
+    {
+        if (!interp || bound != data.generation())
+        {
+            interp = std::make_unique<basic_amp_interpreter<T>>(data);
+            bound = data.generation();
+        }
+        return *interp;
+    }
+
+    std::unique_ptr<basic_amp_interpreter<T>> interp;
+    uint64_t bound = 0;  // generation of the dataset on the accelerator
+};
+#endif
+
+// work sizes from which each backend takes over, in nodes times rows (the number of instruction evaluations)
+struct dispatch_thresholds
+{
+    int block_rows = 8;                                             // fewer rows go through the scalar backend
+    double parallel_work = 1 << 20;                                 // from here the work is split across the threads
+    double amp_work = std::numeric_limits<double>::infinity();      // from here it goes to the accelerator
+};
+
+// picks the backend of every call from the length of the tree, the number of rows and the number of threads.
+// the thresholds are measured when the dispatcher is created, so they fit the machine it runs on: timing each
+// backend on growing synthetic workloads takes a few milliseconds
+template<typename T, typename Accumulator = T>
+class basic_dispatcher : public basic_backend<T, Accumulator>
+{
+public:
+    typedef basic_backend<T, Accumulator> base;
+    typedef typename base::interpreter interpreter;
+    typedef typename base::dataset dataset;
+
+    explicit basic_dispatcher(int nthreads = 0) : parallel(nthreads)
+    {
+        init_amp();
+        limits = calibrate();
+    }
+
+    basic_dispatcher(const dispatch_thresholds& thresholds, int nthreads = 0) : parallel(nthreads), limits(thresholds)
+    {
+        init_amp();
+    }
+
+    const char* name() const override { return "dispatcher"; }
+
+    const dispatch_thresholds& thresholds() const { return limits; }
+    int threads() const { return parallel.threads(); }
+
+    // the backend for count rows of a tree with length nodes
+    base& select(int length, int count)
+    {
+        auto work = static_cast<double>(length) * count;
+#if SYMBOLIC_AMP_HAS_AMP
+        if (amp && work >= limits.amp_work)
+            return *amp;
+#endif
+        if (parallel.threads() > 1 && work >= limits.parallel_work)
+            return parallel;
+        if (count < limits.block_rows)
+            return scalar;
+        return block;
+    }
+
+    void evaluate(node* root, const dataset& data, int start, int count, T* result) override
+    {
+        select(root->GetLength(), count).evaluate(root, data, start, count, result);
+    }
+
+    fitness_statistics evaluate_fitness(node* root, const dataset& data, const std::string& target, int start, int count) override
+    {
+        return select(root->GetLength(), count).evaluate_fitness(root, data, target, start, count);
+    }
+
+    // a population with enough work in total is spread over the threads tree by tree, even if every tree on its own
+    // is too small to be split
+    std::vector<fitness_statistics> evaluate_fitness(const std::vector<node*>& trees, const dataset& data, const std::string& target, int start, int count) override
+    {
+        double length = 0;
+        for (auto t : trees)
+            length += t->GetLength();
+        if (parallel.threads() > 1 && length * count >= limits.parallel_work && length * count < limits.amp_work)
+            return parallel.evaluate_fitness(trees, data, target, start, count);
+        return base::evaluate_fitness(trees, data, target, start, count);
+    }
+
+    // measures where each backend overtakes the previous one, using random trees of a typical length
+    dispatch_thresholds calibrate()
+    {
+        constexpr int max_rows = 1 << 16;
+        rng rnd;
+        rnd.seed(1234);
+        basic_dataset<double> source({ "x1", "x2", "x3", "x4" }, max_rows);
+        for (int i = 0; i < source.cols(); ++i)
+            std::generate(source.column(i), source.column(i) + max_rows, [&]() { return rnd.next_double(-1, 1); });
+        dataset data(source);
+        node_arena arena;
+        std::vector<node*> trees;
+        while (trees.size() < 4)
+        {
+            auto t = node::Random(&rnd, source, 5, &arena);
+            if (t->GetLength() >= 15)
+                trees.push_back(t);
+        }
+        double length = 0;
+        for (auto t : trees)
+            length += t->GetLength();
+        length /= trees.size();
+        std::vector<T> result(max_rows);
+
+        // best time per call of a backend over trees and rows, repeated until the measurement is long enough
+        auto time = [&](base& b, int count) {
+            double best = std::numeric_limits<double>::infinity();
+            for (int round = 0; round < 3; ++round)
+            {
+                int calls = 0;
+                auto start = std::chrono::steady_clock::now();
+                double elapsed = 0;
+                do
+                {
+                    for (auto t : trees)
+                        b.evaluate(t, data, 0, count, result.data());
+                    ++calls;
+                    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                } while (elapsed < 1e-4);
+                best = std::min(best, elapsed / calls);
+            }
+            return best;
+        };
+        // smallest row count from first at which challenger beats incumbent, or 0 if it never does
+        auto crossover = [&](base& challenger, std::function<base&(int)> incumbent, int first) {
+            for (int count = first; count <= max_rows; count *= 2)
+            {
+                if (time(challenger, count) < time(incumbent(count), count))
+                    return count;
+            }
+            return 0;
+        };
+
+        dispatch_thresholds t;
+        auto rows = crossover(block, [&](int) -> base& { return scalar; }, 1);
+        t.block_rows = rows > 0 ? rows : max_rows;
+        t.parallel_work = std::numeric_limits<double>::infinity();
+        if (parallel.threads() > 1)
+        {
+            rows = crossover(parallel, [&](int) -> base& { return block; }, interpreter::block_size);
+            if (rows > 0)
+                t.parallel_work = length * rows;
+        }
+        t.amp_work = std::numeric_limits<double>::infinity();
+#if SYMBOLIC_AMP_HAS_AMP
+        if (amp)
+        {
+            rows = crossover(*amp, [&](int count) -> base& {
+                return parallel.threads() > 1 && length * count >= t.parallel_work ? static_cast<base&>(parallel) : block;
+            }, interpreter::block_size);
+            if (rows > 0)
+                t.amp_work = length * rows;
+        }
+#endif
+        return t;
+    }
+
+private:
+    void init_amp()
+    {
+#if SYMBOLIC_AMP_HAS_AMP
+        if (basic_amp_backend<T, Accumulator>::available())
+            amp = std::make_unique<basic_amp_backend<T, Accumulator>>();
+#endif
+    }
+
+    basic_scalar_backend<T, Accumulator> scalar;
+    basic_block_backend<T, Accumulator> block;
+    basic_parallel_backend<T, Accumulator> parallel;
+#if SYMBOLIC_AMP_HAS_AMP
+    std::unique_ptr<basic_amp_backend<T, Accumulator>> amp;
+#endif
+    dispatch_thresholds limits;
+};
+
+typedef basic_backend<double> backend;
+typedef basic_scalar_backend<double> scalar_backend;
+typedef basic_block_backend<double> block_backend;
+typedef basic_parallel_backend<double> parallel_backend;
+typedef basic_dispatcher<double> dispatcher;
+typedef basic_dispatcher<float> float_dispatcher;
+typedef basic_dispatcher<float, double> mixed_dispatcher;
+#if SYMBOLIC_AMP_HAS_AMP
+typedef basic_amp_backend<double> amp_backend;
+#endif
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+#include "autodiff.h"
+#include "interpreter.h"
+#include "thread_pool.h"
+
+struct optimizer_options
+{
+    int iterations = 50;       // maximum number of accepted steps
+    double tolerance = 1e-8;   // stop when a step improves the sum of squared errors by less than this fraction
+    double gradient_tolerance = 1e-12; // stop when every component of the gradient is below this
+    double lambda = 1e-3;      // initial damping
+};
+
+struct optimizer_result
+{
+    int iterations = 0;        // accepted steps
+    int evaluations = 0;       // passes over the rows (jacobians and trial steps)
+    double initial_sse = 0;
+    double sse = 0;
+    bool converged = false;    // stopped by a tolerance rather than by the iteration limit
+};
+
+// levenberg-marquardt least-squares tuning of the coefficients of a tree (the weights of its variables and the values
+// of its constants) against a target column. the jacobian comes from autodiff, the normal equations are accumulated
+// over row chunks on the thread pool, and the compiled program is patched in place between steps, so a tree is
+// compiled once per optimization. the scratch space of every worker is kept across steps and calls
+class coefficient_optimizer
+{
+public:
+    // rows_per_task is rounded up to a multiple of the interpreter block size
+    explicit coefficient_optimizer(int nthreads = 0, int rows_per_task = 16 * interpreter::block_size)
+        : pool(nthreads), chunk_size(std::max(1, (rows_per_task + interpreter::block_size - 1) / interpreter::block_size) * interpreter::block_size)
+    {
+        workspaces.resize(pool.size());
+    }
+
+    int threads() const { return pool.size(); }
+    optimizer_options& options() { return opts; }
+    const optimizer_options& options() const { return opts; }
+
+    // tunes the coefficients of the tree in place over the rows [start, start + count)
+    optimizer_result optimize(node* tree, const dataset& data, const std::string& target, int start, int count)
+    {
+        auto code = interpreter::compile(tree, data);
+        auto result = optimize(code, data[target], start, count);
+        write_back(tree, autodiff::get_parameters(code));
+        return result;
+    }
+
+    // tunes the parameters of the program in place; the rows are split among the threads
+    optimizer_result optimize(std::vector<instruction>& code, const double* target, int start, int count)
+    {
+        auto chunks = prepare(code, count);
+        auto run = [&](const std::function<void(int, int)>& body) { pool.parallel_for(chunks, body); };
+        return levenberg_marquardt(code, target, start, count, chunks, run);
+    }
+
+    // tunes every tree of a population in place; the trees are split among the threads, each one is tuned on a single thread
+    std::vector<optimizer_result> optimize_population(const std::vector<node*>& trees, const dataset& data, const std::string& target, int start, int count)
+    {
+        std::vector<optimizer_result> results(trees.size());
+        auto y = data[target];
+        pool.parallel_for(static_cast<int>(trees.size()), [&](int i, int worker) {
+            auto code = interpreter::compile(trees[i], data);
+            auto& w = workspaces[worker];
+            auto chunks = reserve(w, code, count);
+            auto run = [&](const std::function<void(int, int)>& body) {
+                for (int task = 0; task < chunks; ++task)
+                    body(task, worker);
+            };
+            results[i] = levenberg_marquardt(code, y, start, count, chunks, run, &w);
+            write_back(trees[i], autodiff::get_parameters(code));
+        });
+        return results;
+    }
+
+private:
+    // per-worker scratch space
+    struct workspace
+    {
+        simd::aligned_vector<double> buffer;   // autodiff and interpreter scratch
+        std::vector<double> jacobian;          // one chunk of rows per parameter
+        std::vector<double> values;
+        std::vector<double> equations;         // per-chunk partial sums, see levenberg_marquardt
+    };
+
+    // sizes the scratch space of one worker for the program and returns the number of row chunks
+    int reserve(workspace& w, const std::vector<instruction>& code, int count)
+    {
+        auto nparams = autodiff::parameters(code).size();
+        if (w.buffer.size() < 2 * code.size() * interpreter::block_size)
+            w.buffer.resize(2 * code.size() * interpreter::block_size);
+        if (w.jacobian.size() < nparams * chunk_size)
+            w.jacobian.resize(nparams * chunk_size);
+        if (w.values.size() < static_cast<size_t>(chunk_size))
+            w.values.resize(chunk_size);
+        return count <= 0 ? 0 : (count + chunk_size - 1) / chunk_size;
+    }
+
+    int prepare(const std::vector<instruction>& code, int count)
+    {
+        auto chunks = 0;
+        for (auto& w : workspaces)
+            chunks = reserve(w, code, count);
+        return chunks;
+    }
+
+    // the normal equations of one chunk: the packed lower triangle of J'J, then J'r, then the sum of squared residuals
+    static int equation_size(int nparams) { return nparams * (nparams + 1) / 2 + nparams + 1; }
+
+    void accumulate(const std::vector<instruction>& code, int nparams, const double* target, int row, int n, workspace& w, double* eq) const
+    {
+        autodiff::jacobian(code, row, n, w.values.data(), w.jacobian.data(), w.buffer.data());
+        auto r = w.values.data();
+        for (int i = 0; i < n; ++i)
+            r[i] -= target[row + i];
+
+        auto jtj = eq, jtr = eq + nparams * (nparams + 1) / 2;
+        for (int p = 0; p < nparams; ++p)
+        {
+            auto jp = w.jacobian.data() + static_cast<size_t>(p) * n;
+            for (int q = 0; q <= p; ++q)
+                jtj[p * (p + 1) / 2 + q] = dot(jp, w.jacobian.data() + static_cast<size_t>(q) * n, n);
+            jtr[p] = dot(jp, r, n);
+        }
+        jtr[nparams] = dot(r, r, n);
+    }
+
+    static double dot(const double* a, const double* b, int n)
+    {
+        auto s = simd::broadcast(0.0);
+        int i = 0;
+        for (; i + simd::width <= n; i += simd::width)
+            s = simd::add(s, simd::mul(simd::load(a + i), simd::load(b + i)));
+        auto sum = simd::hsum(s);
+        for (; i < n; ++i)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    // solves (a + lambda diag(a)) x = b in place of b with a cholesky factorization of the packed lower triangle.
+    // returns false if the damped matrix is not positive definite
+    static bool solve(const std::vector<double>& a, double lambda, std::vector<double>& b, std::vector<double>& l)
+    {
+        auto n = static_cast<int>(b.size());
+        l.assign(a.size(), 0);
+        for (int i = 0; i < n; ++i)
+        {
+            for (int j = 0; j <= i; ++j)
+            {
+                auto s = a[i * (i + 1) / 2 + j];
+                if (i == j)
+                    s += lambda * std::max(s, 1e-12);
+                for (int k = 0; k < j; ++k)
+                    s -= l[i * (i + 1) / 2 + k] * l[j * (j + 1) / 2 + k];
+                if (i == j)
+                {
+                    if (!(s > 0))
+                        return false;
+                    l[i * (i + 1) / 2 + i] = std::sqrt(s);
+                }
+                else
+                {
+                    l[i * (i + 1) / 2 + j] = s / l[j * (j + 1) / 2 + j];
+                }
+            }
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            for (int k = 0; k < i; ++k)
+                b[i] -= l[i * (i + 1) / 2 + k] * b[k];
+            b[i] /= l[i * (i + 1) / 2 + i];
+        }
+        for (int i = n - 1; i >= 0; --i)
+        {
+            for (int k = i + 1; k < n; ++k)
+                b[i] -= l[k * (k + 1) / 2 + i] * b[k];
+            b[i] /= l[i * (i + 1) / 2 + i];
+        }
+        return true;
+    }
+
+    // run(body) calls body(chunk, worker) for every chunk; local is the scratch space of the calling worker when the
+    // chunks run serially, null when they run on the pool
+    template<typename Run>
+    optimizer_result levenberg_marquardt(std::vector<instruction>& code, const double* target, int start, int count, int chunks, Run run, workspace* local = nullptr)
+    {
+        optimizer_result result;
+        auto parameters = autodiff::get_parameters(code);
+        auto nparams = static_cast<int>(parameters.size());
+        auto size = equation_size(nparams);
+
+        std::vector<double> partial_sse(chunks);
+        auto sse = [&]() {
+            run([&](int task, int worker) {
+                auto& w = local ? *local : workspaces[worker];
+                auto offset = task * chunk_size;
+                auto n = std::min(chunk_size, count - offset);
+                partial_sse[task] = interpreter::evaluate_fitness(code, target, start + offset, n, w.buffer.data()).sse;
+            });
+            ++result.evaluations;
+            // summing in chunk order keeps the result independent of the number of threads
+            double s = 0;
+            for (auto v : partial_sse)
+                s += v;
+            return s;
+        };
+
+        // the partial sums of chunk i live in the equations of the worker that owns the call, or of the first worker
+        auto& storage = (local ? *local : workspaces[0]).equations;
+        std::vector<double> jtj(size - nparams - 1), jtr(nparams), step(nparams), factor;
+        auto normal_equations = [&]() {
+            storage.resize(static_cast<size_t>(chunks) * size);
+            run([&](int task, int worker) {
+                auto& w = local ? *local : workspaces[worker];
+                auto offset = task * chunk_size;
+                auto n = std::min(chunk_size, count - offset);
+                accumulate(code, nparams, target, start + offset, n, w, storage.data() + static_cast<size_t>(task) * size);
+            });
+            ++result.evaluations;
+            std::fill(jtj.begin(), jtj.end(), 0.0);
+            std::fill(jtr.begin(), jtr.end(), 0.0);
+            double s = 0;
+            for (int task = 0; task < chunks; ++task)
+            {
+                auto eq = storage.data() + static_cast<size_t>(task) * size;
+                for (size_t i = 0; i < jtj.size(); ++i)
+                    jtj[i] += eq[i];
+                for (int p = 0; p < nparams; ++p)
+                    jtr[p] += eq[jtj.size() + p];
+                s += eq[size - 1];
+            }
+            return s;
+        };
+
+        if (nparams == 0 || chunks == 0)
+        {
+            result.initial_sse = result.sse = chunks == 0 ? 0 : sse();
+            result.converged = true;
+            return result;
+        }
+
+        auto current = normal_equations();
+        result.initial_sse = result.sse = current;
+        if (!std::isfinite(current))
+            return result;
+
+        auto lambda = opts.lambda;
+        while (result.iterations < opts.iterations)
+        {
+            auto gradient = 0.0;
+            for (auto g : jtr)
+                gradient = std::max(gradient, std::abs(g));
+            if (gradient < opts.gradient_tolerance)
+            {
+                result.converged = true;
+                break;
+            }
+
+            // increase the damping until a step decreases the error
+            auto accepted = false;
+            auto trial_sse = current;
+            while (!accepted && lambda < 1e16)
+            {
+                for (int p = 0; p < nparams; ++p)
+                    step[p] = -jtr[p];
+                if (solve(jtj, lambda, step, factor))
+                {
+                    auto trial = parameters;
+                    for (int p = 0; p < nparams; ++p)
+                        trial[p] += step[p];
+                    autodiff::set_parameters(code, trial);
+                    trial_sse = sse();
+                    if (std::isfinite(trial_sse) && trial_sse < current)
+                    {
+                        parameters = trial;
+                        accepted = true;
+                        lambda = std::max(lambda / 10, 1e-12);
+                        break;
+                    }
+                }
+                lambda *= 10;
+            }
+            if (!accepted)
+            {
+                autodiff::set_parameters(code, parameters);
+                result.converged = true;
+                break;
+            }
+
+            ++result.iterations;
+            auto improvement = (current - trial_sse) / std::max(current, std::numeric_limits<double>::min());
+            current = trial_sse;
+            result.sse = current;
+            if (improvement < opts.tolerance)
+            {
+                result.converged = true;
+                break;
+            }
+            if (result.iterations < opts.iterations)
+                normal_equations();
+        }
+        return result;
+    }
+
+    // copies the parameters back into the tree, in the postfix order of the compiled program
+    static void write_back(node* tree, const std::vector<double>& parameters)
+    {
+        size_t p = 0;
+        write_back(tree, parameters, p);
+    }
+
+    static void write_back(node* n, const std::vector<double>& parameters, size_t& p)
+    {
+        for (auto s : n->Subtrees())
+            write_back(s, parameters, p);
+        if (n->GetOpCode() == VARIABLE)
+            n->SetWeight(parameters[p++]);
+        else if (n->GetOpCode() == CONSTANT)
+            n->SetValue(parameters[p++]);
+    }
+
+    thread_pool pool;
+    int chunk_size;
+    optimizer_options opts;
+    std::vector<workspace> workspaces;
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+// SYMBOLIC_AMP_HAS_AMP selects whether the C++ AMP (gpu) interpreter is built. the cmake build defines it from the
+// SYMBOLIC_AMP_ENABLE_AMP option; otherwise it defaults to on for msvc, the only compiler that supports AMP
+#ifndef SYMBOLIC_AMP_HAS_AMP
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SYMBOLIC_AMP_HAS_AMP 1
+#else
+#define SYMBOLIC_AMP_HAS_AMP 0
+#endif
+#endif
+
+// SYMBOLIC_AMP_PROFILE turns on the counters of instrumentation.h. the cmake build defines it from the
+// SYMBOLIC_AMP_ENABLE_PROFILING option; without it the instrumentation macros expand to nothing
+#ifndef SYMBOLIC_AMP_PROFILE
+#define SYMBOLIC_AMP_PROFILE 0
+#endif
@@ -0,0 +1,127 @@
+#include "csv_importer.h"
+#include "dataset.h"
+#include "mapped_file.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    string trim(const string& s)
+    {
+        auto first = s.find_first_not_of(" \t\r\"");
+        if (first == string::npos)
+            return string();
+        auto last = s.find_last_not_of(" \t\r\"");
+        return s.substr(first, last - first + 1);
+    }
+
+    vector<string> split(const string& line, char separator)
+    {
+        vector<string> fields;
+        size_t start = 0;
+        for (;;)
+        {
+            auto end = line.find(separator, start);
+            fields.push_back(trim(line.substr(start, end == string::npos ? string::npos : end - start)));
+            if (end == string::npos)
+                return fields;
+            start = end + 1;
+        }
+    }
+
+    bool blank(const string& line)
+    {
+        return line.find_first_not_of(" \t\r") == string::npos;
+    }
+}
+
+int csv_importer::convert(const string& csv_path, const string& binary_path, char separator)
+{
+    ifstream in(csv_path);
+    if (!in)
+        throw runtime_error("cannot open " + csv_path);
+
+    // first pass: variable names and number of rows
+    string line;
+    if (!getline(in, line))
+        throw runtime_error(csv_path + " is empty.");
+    auto names = split(line, separator);
+    long long rows = 0;
+    while (getline(in, line))
+    {
+        if (!blank(line))
+            ++rows;
+    }
+    if (rows > numeric_limits<int>::max())
+        throw runtime_error(csv_path + " has too many rows.");
+
+    auto header = dataset::binary_header(names, static_cast<int>(rows));
+    dataset_header h;
+    memcpy(&h, header.data(), sizeof(h));
+    auto size = h.data_offset + h.cols * h.stride * sizeof(double);
+    try
+    {
+        mapped_file out(binary_path, mapped_file::mode::read_write, static_cast<size_t>(size));
+        parse(in, csv_path, separator, names.size(), rows, reinterpret_cast<double*>(out.data() + h.data_offset), h.stride);
+        // the header goes in last, so the output is not a valid dataset until every value is in place
+        memcpy(out.data(), header.data(), header.size());
+    }
+    catch (...)
+    {
+        remove(binary_path.c_str());
+        throw;
+    }
+    return static_cast<int>(rows);
+}
+
+// second pass: parses every row into its column-major position
+void csv_importer::parse(istream& in, const string& csv_path, char separator, size_t cols, long long rows, double* values, uint64_t stride)
+{
+    string line;
+    in.clear();
+    in.seekg(0);
+    getline(in, line);
+    long long row = 0, number = 1;
+    while (getline(in, line))
+    {
+        ++number;
+        if (blank(line))
+            continue;
+        if (row >= rows)
+            throw runtime_error(csv_path + " changed while it was being converted.");
+        size_t col = 0, start = 0;
+        for (;; ++col)
+        {
+            auto end = line.find(separator, start);
+            if (col >= cols)
+                throw runtime_error(csv_path + ":" + to_string(number) + ": too many fields.");
+            auto field = trim(line.substr(start, end == string::npos ? string::npos : end - start));
+            double value = numeric_limits<double>::quiet_NaN();
+            if (!field.empty())
+            {
+                char* last;
+                value = strtod(field.c_str(), &last);
+                if (*last != '\0')
+                    throw runtime_error(csv_path + ":" + to_string(number) + ": cannot parse '" + field + "'.");
+            }
+            values[col * stride + row] = value;
+            if (end == string::npos)
+                break;
+            start = end + 1;
+        }
+        if (col + 1 != cols)
+            throw runtime_error(csv_path + ":" + to_string(number) + ": expected " + to_string(cols) + " fields.");
+        ++row;
+    }
+    if (row != rows)
+        throw runtime_error(csv_path + " changed while it was being converted.");
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+
+// converts a delimited text file (first line holds the variable names) to the binary dataset format.
+// the input is read twice as a stream, once to count the rows and once to parse them, and the values are
+// written straight into a mapping of the output file, so neither file has to fit in memory
+class csv_importer
+{
+public:
+    // returns the number of rows written. empty fields become nan
+    static int convert(const std::string& csv_path, const std::string& binary_path, char separator = ',');
+
+private:
+    static void parse(std::istream& in, const std::string& csv_path, char separator, std::size_t cols, long long rows, double* values, uint64_t stride);
+};
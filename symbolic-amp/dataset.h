@@ -1,53 +1,365 @@
 #pragma once
 #include <string>
 #include <vector>
-#include <unordered_map>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <atomic>
+#include "simd.h"
+#include "symbol_table.h"
+#include "mapped_file.h"
+#include "row_selection.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
-class dataset {
+// header of the binary dataset format. it is followed by the variable names (each one a uint32 length
+// and the characters), zero padding up to data_offset, then cols columns of stride values each.
+// data_offset is a multiple of the page size, so the columns of a mapped file stay aligned
+struct dataset_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;  // 0x01020304 in the byte order of the machine that wrote the file
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t stride;
+  uint64_t data_offset;
+  uint32_t scalar_size; // 8 for double, 4 for float values
+  uint32_t reserved;
+};
+
+// column-major matrix of variable values held in a single aligned allocation or in a mapped binary file.
+// variables are identified by their column index; trees refer to them through interned symbols,
+// which the dataset resolves to a column index in constant time. T is double, or float for the single
+// and mixed precision evaluation modes (twice the simd lanes and half the memory traffic)
+template<typename T>
+class basic_dataset {
 public:
-  dataset() {}
-  ~dataset() {}
+  typedef T value_type;
+
+  basic_dataset() : nrows(0), nstride(0) {}
 
-  void add(const std::string& variable, std::vector<double>& values)
+  // copies own their values, also when the original is mapped, so a write through a copy never reaches the original.
+  // moves hand the storage or the mapping over
+  basic_dataset(const basic_dataset& other)
+    : nrows(other.nrows), nstride(other.nstride), variables(other.variables), symbols(other.symbols), columns(other.columns),
+      storage(other.values(), other.values() + static_cast<size_t>(other.cols()) * other.nstride)
+  {
+  }
+  basic_dataset(basic_dataset&&) = default;
+  basic_dataset& operator=(const basic_dataset& other)
+  {
+    if (this != &other)
+      *this = basic_dataset(other);
+    return *this;
+  }
+  basic_dataset& operator=(basic_dataset&&) = default;
+
+  // creates a zero-filled dataset with the given variables
+  basic_dataset(const std::vector<std::string>& names, int rows) : nrows(rows), nstride(stride_for(rows))
+  {
+    for (auto& name : names)
+      register_variable(name);
+    allocate();
+  }
+
+  // copy of another dataset with its values converted (rounded to nearest when narrowing)
+  template<typename U>
+  explicit basic_dataset(const basic_dataset<U>& other) : basic_dataset(other.Variables(), other.rows())
+  {
+    for (int i = 0; i < cols(); ++i)
+      simd::convert(column(i), other.column(i), nrows);
+  }
+
+  void add(const std::string& variable, const std::vector<T>& values)
   {
     if (contains(variable))
-      throw std::exception("variable is already present in the dataset.");
+      throw std::invalid_argument("variable is already present in the dataset.");
+    if (!variables.empty() && static_cast<int>(values.size()) != nrows)
+      throw std::invalid_argument("all the variables in a dataset must have the same number of rows.");
 
-    variable_indices[variable] = static_cast<int>(variables.size());
-    variables.push_back(variable);
-    variable_values.push_back(values);
+    if (variables.empty())
+    {
+      nrows = static_cast<int>(values.size());
+      nstride = stride_for(nrows);
+    }
+    detach();
+    id.renew();
+    register_variable(variable);
+    // grow the matrix by one column
+    simd::aligned_vector<T> old;
+    old.swap(storage);
+    allocate();
+    std::copy(old.begin(), old.end(), storage.begin());
+    std::copy(values.begin(), values.end(), column(cols() - 1));
   }
 
-  void remove(const std::string& variable, std::vector<double>& values)
+  void remove(const std::string& variable)
   {
-    if (!contains(variable))
-      throw std::exception("the variable is not present in the dataset.");
+    auto i = index(variable);
+    auto n = cols();
+    detach();
+    id.renew();
+    std::copy(storage.begin() + static_cast<size_t>(i + 1) * nstride, storage.begin() + static_cast<size_t>(n) * nstride, storage.begin() + static_cast<size_t>(i) * nstride);
+    storage.resize(static_cast<size_t>(n - 1) * nstride);
 
-    auto i = variable_indices[variable];
-    variable_indices.erase(variable);
     variables.erase(begin(variables) + i);
-    variable_values.erase(begin(variable_values) + i);
+    symbols.erase(begin(symbols) + i);
+    reindex();
   }
 
-  std::vector<double>& operator[](const std::string& variable) 
+  T* operator[](const std::string& variable) { return column(index(variable)); }
+  const T* operator[](const std::string& variable) const { return column(index(variable)); }
+
+  bool contains(const std::string& variable) const
   {
-    if (!contains(variable))
-      throw std::exception("the variable is not present in the dataset.");
+    auto symbol = symbol_table::find(variable);
+    return symbol >= 0 && variable_index(symbol) >= 0;
+  }
 
-    auto index = variable_indices[variable];
-    return variable_values[index];
+  // column index of the variable with the given name
+  int index(const std::string& variable) const
+  {
+    auto symbol = symbol_table::find(variable);
+    auto i = symbol < 0 ? -1 : variable_index(symbol);
+    if (i < 0)
+      throw std::out_of_range("the variable " + variable + " is not present in the dataset.");
+    return i;
   }
 
-  bool contains(const std::string& variable) const
+  // column index of the variable with the given symbol id, or -1 if the dataset does not contain it
+  int variable_index(int symbol) const
   {
-    return variable_indices.find(variable) != end(variable_indices);
+    return symbol >= 0 && symbol < static_cast<int>(columns.size()) ? columns[symbol] : -1;
   }
+
+  T* column(int i) { return values() + static_cast<size_t>(i) * nstride; }
+  const T* column(int i) const { return values() + static_cast<size_t>(i) * nstride; }
+
+  int rows() const { return nrows; }
+  int cols() const { return static_cast<int>(variables.size()); }
+  // distance between the starts of two consecutive columns; every column starts on an aligned address
+  int stride() const { return nstride; }
+  int symbol(int i) const { return symbols[i]; }
   std::vector<std::string> Variables() const { return variables; }
+  // true if the values live in a mapped file rather than in memory owned by the dataset
+  bool mapped() const { return mapping != nullptr; }
+  // unique among the datasets of the process, and changed whenever the columns move (add, remove, detaching a
+  // mapping). copies get their own, so anything bound to the column addresses can key on it instead of the address
+  uint64_t generation() const { return id.value; }
+
+  // compact in-memory copy of the selected rows, with the same variables
+  basic_dataset gather(const row_selection& rows) const
+  {
+    check(rows);
+    basic_dataset batch(variables, rows.size());
+    for (int i = 0; i < cols(); ++i)
+      rows.gather(column(i), batch.column(i), 0, rows.size());
+    return batch;
+  }
+
+  // throws if the selection refers to rows outside the dataset
+  void check(const row_selection& rows) const
+  {
+    if (rows.size() > 0 && (rows.min_row() < 0 || rows.max_row() >= nrows))
+      throw std::out_of_range("the row selection is outside of the dataset.");
+  }
+
+  // opens a file in the binary format without copying it: the columns point straight into a private
+  // (copy-on-write) mapping, so pages are only read from disk when first touched. copies of the dataset read the
+  // whole mapping into memory of their own
+  static basic_dataset open(const std::string& path)
+  {
+    auto file = std::make_shared<mapped_file>(path, mapped_file::mode::copy_on_write);
+    std::vector<std::string> names;
+    auto header = parse_header(file->data(), file->size(), path, names);
+
+    basic_dataset ds;
+    ds.nrows = static_cast<int>(header.rows);
+    ds.nstride = static_cast<int>(header.stride);
+    for (auto& name : names)
+      ds.register_variable(name);
+    ds.mapped_values = reinterpret_cast<T*>(file->data() + header.data_offset);
+    ds.mapping = file;
+    return ds;
+  }
+
+  // validates the header and the names at the start of a file of file_size bytes in the binary format.
+  // size is the number of bytes available at p, at least data_offset once the header is known
+  static dataset_header parse_header(const char* p, uint64_t file_size, const std::string& path, std::vector<std::string>& names, uint64_t size = std::numeric_limits<uint64_t>::max())
+  {
+    size = std::min(size, file_size);
+    if (size < sizeof(dataset_header))
+      throw std::runtime_error(path + " is not a dataset file.");
+
+    dataset_header header;
+    std::memcpy(&header, p, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(header.magic)) != 0 || header.version != version)
+      throw std::runtime_error(path + " is not a dataset file.");
+    if (header.byte_order != byte_order)
+      throw std::runtime_error(path + " was written with a different byte order.");
+    if (header.scalar_size != sizeof(T))
+      throw std::runtime_error(path + " holds values of a different precision.");
+    // sizes are compared by division, a corrupt header can make any product overflow
+    if (header.rows > static_cast<uint64_t>(std::numeric_limits<int>::max()) || header.stride < header.rows
+      || header.stride > static_cast<uint64_t>(std::numeric_limits<int>::max())
+      || header.data_offset % simd::alignment != 0 || header.data_offset > file_size
+      || (header.stride > 0 && header.cols > (file_size - header.data_offset) / sizeof(T) / header.stride))
+      throw std::runtime_error(path + " is truncated or corrupt.");
+    if (header.data_offset > size)
+      return header; // the caller reads the names once it knows where they end
+
+    auto end = p + header.data_offset;
+    p += sizeof(header);
+    names.clear();
+    for (uint64_t i = 0; i < header.cols; ++i)
+    {
+      uint32_t length;
+      if (end - p < static_cast<std::ptrdiff_t>(sizeof(length)))
+        throw std::runtime_error(path + " is truncated or corrupt.");
+      std::memcpy(&length, p, sizeof(length));
+      p += sizeof(length);
+      if (end - p < static_cast<std::ptrdiff_t>(length))
+        throw std::runtime_error(path + " is truncated or corrupt.");
+      names.push_back(std::string(p, length));
+      p += length;
+    }
+    return header;
+  }
+
+  // writes the dataset in the binary format
+  void save(const std::string& path) const
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+      throw std::runtime_error("cannot open " + path);
+    auto header = binary_header(variables, nrows);
+    out.write(header.data(), header.size());
+    out.write(reinterpret_cast<const char*>(values()), static_cast<std::streamsize>(static_cast<size_t>(cols()) * nstride * sizeof(T)));
+    if (!out)
+      throw std::runtime_error("cannot write " + path);
+  }
+
+  // everything that precedes the columns in the binary format: header, names and padding
+  static std::vector<char> binary_header(const std::vector<std::string>& names, int rows)
+  {
+    dataset_header header;
+    std::memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.byte_order = byte_order;
+    header.rows = static_cast<uint64_t>(rows);
+    header.cols = names.size();
+    header.stride = static_cast<uint64_t>(stride_for(rows));
+    header.scalar_size = sizeof(T);
+    header.reserved = 0;
+
+    std::vector<char> bytes(sizeof(header));
+    for (auto& name : names)
+    {
+      auto length = static_cast<uint32_t>(name.size());
+      auto p = reinterpret_cast<const char*>(&length);
+      bytes.insert(bytes.end(), p, p + sizeof(length));
+      bytes.insert(bytes.end(), name.begin(), name.end());
+    }
+    header.data_offset = (bytes.size() + page_size - 1) / page_size * page_size;
+    bytes.resize(header.data_offset, 0);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    return bytes;
+  }
 
 private:
-  std::vector<std::string> variables;
-  std::unordered_map<std::string, int> variable_indices;
-  std::vector<std::vector<double>> variable_values;
+  static constexpr char magic[8] = { 'S', 'Y', 'M', 'A', 'M', 'P', 'D', 'S' };
+  static constexpr uint32_t version = 2;
+  static constexpr uint32_t byte_order = 0x01020304;
+  static constexpr size_t page_size = 4096;
+
+  T* values() { return mapping ? mapped_values : storage.data(); }
+  const T* values() const { return mapping ? mapped_values : storage.data(); }
+
+  // copies mapped values into owned storage before the shape of the matrix changes
+  void detach()
+  {
+    if (!mapping)
+      return;
+    storage.assign(mapped_values, mapped_values + static_cast<size_t>(cols()) * nstride);
+    mapping.reset();
+    mapped_values = nullptr;
+    id.renew();
+  }
+
+  // a fresh value on construction, copy and assignment
+  struct generation_id
+  {
+    uint64_t value = next();
 
+    generation_id() = default;
+    generation_id(const generation_id&) {}
+    generation_id& operator=(const generation_id&) { renew(); return *this; }
+
+    void renew() { value = next(); }
+    static uint64_t next()
+    {
+      static std::atomic<uint64_t> counter(0);
+      return ++counter;
+    }
+  };
+
+  static int stride_for(int rows)
+  {
+    constexpr int step = static_cast<int>(simd::alignment / sizeof(T));
+    return (rows + step - 1) / step * step;
+  }
+
+  void register_variable(const std::string& name)
+  {
+    variables.push_back(name);
+    symbols.push_back(symbol_table::intern(name));
+    reindex();
+  }
+
+  void reindex()
+  {
+    columns.clear();
+    for (int i = 0; i < cols(); ++i)
+    {
+      if (symbols[i] >= static_cast<int>(columns.size()))
+        columns.resize(symbols[i] + 1, -1);
+      columns[symbols[i]] = i;
+    }
+  }
+
+  void allocate()
+  {
+    auto size = static_cast<size_t>(cols()) * nstride;
+    storage = simd::aligned_vector<T>();
+    storage.reserve(size);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // ask for transparent huge pages before the memory is touched
+    constexpr uintptr_t huge_page = 2u << 20;
+    auto first = (reinterpret_cast<uintptr_t>(storage.data()) + huge_page - 1) & ~(huge_page - 1);
+    auto last = (reinterpret_cast<uintptr_t>(storage.data()) + size * sizeof(T)) & ~(huge_page - 1);
+    if (last > first)
+      madvise(reinterpret_cast<void*>(first), last - first, MADV_HUGEPAGE);
+#endif
+    storage.assign(size, T(0));
+  }
+
+  int nrows;
+  int nstride;
+  std::vector<std::string> variables;
+  std::vector<int> symbols;  // symbol id of each column
+  std::vector<int> columns;  // column index of each symbol id, -1 if absent
+  simd::aligned_vector<T> storage;
+  std::shared_ptr<mapped_file> mapping;  // the file a dataset opened with open reads from
+  T* mapped_values = nullptr;
+  generation_id id;
 };
+
+typedef basic_dataset<double> dataset;
+typedef basic_dataset<float> float_dataset;
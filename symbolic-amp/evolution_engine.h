@@ -0,0 +1,509 @@
+#pragma once
+
+#include "interpreter.h"
+#include "population_initializer.h"
+#include "program_cache.h"
+#include "bounded_queue.h"
+#include "random.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct evolution_options
+{
+    int population_size = 1000;
+    // generations bred after the initial population
+    int generations = 50;
+    int tournament_size = 5;
+    double crossover_probability = 0.9;
+    double mutation_probability = 0.15;
+    // limits of the offspring; crossover and mutation that would exceed them are retried or skipped
+    int max_length = 50;
+    int max_depth = 12;
+    // maximum depth of the subtrees grown by mutation
+    int mutation_depth = 4;
+    // best trees copied unchanged into the next generation
+    int elites = 1;
+    // minimize the mean squared error after optimal linear scaling (see fitness_statistics), or the plain mean squared error
+    bool linear_scaling = true;
+    // threads of the breeding stage, a quarter of the threads (at least one) if 0; the other threads evaluate
+    int breeders = 0;
+    // offspring waiting for evaluation at most; breeders block while the queue is full
+    int queue_capacity = 256;
+    uint64_t seed = 1234;
+    // the initial population; its seed is replaced by the seed above, and if it lists no variables the leaves
+    // use every column but the target
+    initializer_options initialization;
+};
+
+// progress of one generation; generation 0 is the initial population
+struct generation_summary
+{
+    int generation = 0;
+    double best = 0;        // fitness of the best tree
+    double average = 0;     // mean fitness of the trees with a finite fitness
+    double length = 0;      // mean length
+    double seconds = 0;     // since the start of the run
+};
+
+// generational GP with tournament selection, subtree crossover and mutation, run as a two-stage pipeline:
+// breeder threads produce the offspring of a generation and push them into a bounded queue, and evaluator threads
+// compute their fitness as they arrive. evaluation starts with the first offspring instead of after the last one,
+// and the only barrier is the completion of a generation, which selection needs. offspring i of generation g draws
+// from stream (g, i) of a counter-based generator, so a seed gives the same run for any number of threads
+template<typename T, typename Accumulator = T>
+class basic_evolution_engine
+{
+public:
+    typedef basic_interpreter<T, Accumulator> interpreter;
+    typedef typename interpreter::instruction instruction;
+    typedef typename interpreter::dataset dataset;
+    // called by the thread that completes a generation; the pipeline waits for it
+    typedef std::function<void(const generation_summary&)> callback;
+
+    explicit basic_evolution_engine(evolution_options options = evolution_options(), int nthreads = 0)
+        : opts(options), nthreads(nthreads > 0 ? nthreads : std::max(1, static_cast<int>(std::thread::hardware_concurrency())))
+    {
+    }
+
+    ~basic_evolution_engine() { clear(); }
+
+    basic_evolution_engine(const basic_evolution_engine&) = delete;
+    basic_evolution_engine& operator=(const basic_evolution_engine&) = delete;
+
+    evolution_options& options() { return opts; }
+    const evolution_options& options() const { return opts; }
+    int threads() const { return nthreads; }
+    // keeps the programs of the elites (and of unchanged copies) across generations. null compiles every time
+    void set_program_cache(basic_program_cache<T, Accumulator>* c) { programs_cache = c; }
+    basic_program_cache<T, Accumulator>* get_program_cache() const { return programs_cache; }
+
+    // evolves a population that models target on the rows [start, start + count) of data. the previous population
+    // is discarded. report, if given, is called after every generation
+    void run(const dataset& data, const std::string& target, int start, int count, const callback& report = callback())
+    {
+        if (opts.population_size < 1 || opts.generations < 0 || opts.tournament_size < 1)
+            throw std::invalid_argument("the population, the number of generations and the tournament size must be positive.");
+        clear();
+
+        auto init = opts.initialization;
+        init.seed = opts.seed;
+        if (init.variables.empty())
+        {
+            auto y = data.index(target);
+            for (int c = 0; c < data.cols(); ++c)
+            {
+                if (c != y)
+                    init.variables.push_back(data.symbol(c));
+            }
+            if (init.variables.empty())
+                throw std::invalid_argument("the dataset has no variables besides the target.");
+        }
+        context ctx{ data, nullptr, {}, 0, start, count, report, population_initializer(init, 1), bounded_queue<item>(opts.queue_capacity), std::chrono::steady_clock::now() };
+        ctx.initializer.validate(data);
+        if constexpr (std::is_same<T, Accumulator>::value)
+        {
+            ctx.target = data[target];
+        }
+        else
+        {
+            ctx.widened.resize(count);
+            simd::convert(ctx.widened.data(), data[target] + start, count);
+            ctx.target = ctx.widened.data();
+            ctx.first = start;
+        }
+
+        // generation 0 is the initial population, built by the breeders like any other generation
+        auto n = opts.population_size;
+        offspring.assign(n, nullptr);
+        offspring_fitness.assign(n, std::numeric_limits<double>::infinity());
+        generation = 0;
+        next = 0;
+        evaluated = 0;
+        finished = false;
+        error = nullptr;
+        idle_breeding = idle_evaluation = 0;
+
+        auto nbreeders = opts.breeders > 0 ? opts.breeders : std::max(1, nthreads / 4);
+        auto nevaluators = std::max(1, nthreads - nbreeders);
+        std::vector<std::thread> workers;
+        for (int b = 0; b < nbreeders; ++b)
+            workers.emplace_back([&]() { guard(ctx, [&]() { breeder(ctx); }); });
+        for (int e = 0; e < nevaluators; ++e)
+            workers.emplace_back([&]() { guard(ctx, [&]() { evaluator(ctx); }); });
+        for (auto& w : workers)
+            w.join();
+
+        if (error)
+        {
+            item it;
+            while (ctx.queue.pop(it))
+                delete it.tree;
+            clear();
+            std::rethrow_exception(error);
+        }
+    }
+
+    // the last generation, and the fitness of every tree (lower is better, infinite if the tree is not finite)
+    const std::vector<node*>& population() const { return parents; }
+    const std::vector<double>& fitness() const { return parent_fitness; }
+
+    node* best() const
+    {
+        if (parents.empty())
+            return nullptr;
+        return parents[std::min_element(parent_fitness.begin(), parent_fitness.end()) - parent_fitness.begin()];
+    }
+
+    const std::vector<generation_summary>& history() const { return summaries; }
+
+    // seconds the threads of each stage spent waiting during the last run, summed over the threads: breeders wait for
+    // room in the queue or for the next generation, evaluators for offspring. a stage that waits much has too many threads
+    double breeding_idle() const { return idle_breeding; }
+    double evaluation_idle() const { return idle_evaluation; }
+
+    void clear()
+    {
+        for (auto p : parents)
+            delete p;
+        for (auto o : offspring)
+            delete o;
+        parents.clear();
+        parent_fitness.clear();
+        offspring.clear();
+        offspring_fitness.clear();
+        summaries.clear();
+    }
+
+private:
+    struct item
+    {
+        int index;
+        node* tree;
+    };
+
+    struct context
+    {
+        const dataset& data;
+        const Accumulator* target;
+        std::vector<Accumulator> widened;  // the target rows in the mixed precision mode
+        int first;                         // row of target[0]
+        int start;
+        int count;
+        const callback& report;
+        population_initializer initializer;
+        bounded_queue<item> queue;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    static double since(std::chrono::steady_clock::time_point t)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    }
+
+    // the first error stops the pipeline; it is rethrown by run
+    template<typename F>
+    void guard(context& ctx, F f)
+    {
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+            stop(ctx);
+        }
+    }
+
+    // wakes up both stages for good. called with the lock held
+    void stop(context& ctx)
+    {
+        finished = true;
+        ctx.queue.close();
+        advance.notify_all();
+    }
+
+    void breeder(context& ctx)
+    {
+        double idle = 0;
+        for (int g = -1;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                auto t = std::chrono::steady_clock::now();
+                advance.wait(lock, [&]() { return finished || generation > g; });
+                idle += since(t);
+                if (finished)
+                    break;
+                g = generation;
+            }
+            int i;
+            while (claim(g, i))
+            {
+                auto child = g == 0 ? ctx.initializer.generate_tree(i, ctx.data) : breed(ctx, g, i);
+                auto t = std::chrono::steady_clock::now();
+                auto queued = ctx.queue.push({ i, child });
+                idle += since(t);
+                if (!queued)
+                {
+                    delete child;
+                    break;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        idle_breeding += idle;
+    }
+
+    void evaluator(context& ctx)
+    {
+        simd::aligned_vector<T> buffer;
+        double idle = 0;
+        item it;
+        for (;;)
+        {
+            auto t = std::chrono::steady_clock::now();
+            if (!ctx.queue.pop(it))
+                break;
+            idle += since(t);
+            double f;
+            try
+            {
+                f = evaluate(ctx, it.tree, buffer);
+            }
+            catch (...)
+            {
+                delete it.tree;
+                throw;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (finished)
+            {
+                delete it.tree;
+                continue;
+            }
+            offspring[it.index] = it.tree;
+            offspring_fitness[it.index] = f;
+            if (++evaluated == opts.population_size)
+                complete(ctx);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        idle_evaluation += idle;
+    }
+
+    bool claim(int g, int& i)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished || generation != g || next >= opts.population_size)
+            return false;
+        i = next++;
+        return true;
+    }
+
+    double evaluate(context& ctx, node* tree, simd::aligned_vector<T>& buffer)
+    {
+        std::shared_ptr<const std::vector<instruction>> cached;
+        std::vector<instruction> compiled;
+        if (programs_cache)
+            cached = programs_cache->get(tree, ctx.data);
+        else
+            compiled = interpreter::compile(tree, ctx.data);
+        auto& code = programs_cache ? *cached : compiled;
+        buffer.resize(interpreter::buffer_size(code));
+        auto statistics = interpreter::evaluate_fitness(code, ctx.target, ctx.first, ctx.start, ctx.count, buffer.data());
+        auto f = opts.linear_scaling ? statistics.scaled_mean_squared_error() : statistics.mean_squared_error();
+        return std::isfinite(f) ? f : std::numeric_limits<double>::infinity();
+    }
+
+    // the last offspring of the generation has been evaluated: the offspring become the parents, and the elites
+    // of the next generation are copied over. called with the lock held
+    void complete(context& ctx)
+    {
+        for (auto p : parents)
+            delete p;
+        parents = std::move(offspring);
+        parent_fitness = std::move(offspring_fitness);
+        offspring.clear();
+        offspring_fitness.clear();
+
+        // the breeders read the parents concurrently, so their cached lengths and depths are filled in beforehand
+        generation_summary summary;
+        summary.generation = generation;
+        summary.best = std::numeric_limits<double>::infinity();
+        int finite = 0;
+        for (int i = 0; i < opts.population_size; ++i)
+        {
+            summary.length += parents[i]->GetLength();
+            parents[i]->GetDepth();
+            summary.best = std::min(summary.best, parent_fitness[i]);
+            if (std::isfinite(parent_fitness[i]))
+            {
+                summary.average += parent_fitness[i];
+                ++finite;
+            }
+        }
+        summary.length /= opts.population_size;
+        summary.average = finite > 0 ? summary.average / finite : std::numeric_limits<double>::infinity();
+        summary.seconds = since(ctx.started);
+        summaries.push_back(summary);
+        if (ctx.report)
+            ctx.report(summary);
+
+        if (generation == opts.generations)
+        {
+            stop(ctx);
+            return;
+        }
+
+        auto n = opts.population_size;
+        auto elites = std::max(0, std::min(opts.elites, n - 1));
+        offspring.assign(n, nullptr);
+        offspring_fitness.assign(n, std::numeric_limits<double>::infinity());
+        std::vector<int> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return parent_fitness[a] < parent_fitness[b]; });
+        for (int e = 0; e < elites; ++e)
+        {
+            offspring[e] = parents[order[e]]->Clone();
+            offspring_fitness[e] = parent_fitness[order[e]];
+        }
+        next = elites;
+        evaluated = elites;
+        ++generation;
+        advance.notify_all();
+    }
+
+    node* breed(context& ctx, int g, int i) const
+    {
+        counter_rng rnd(opts.seed, static_cast<uint64_t>(g) * opts.population_size + i);
+        auto a = tournament(rnd);
+        auto child = rnd.next_double() < opts.crossover_probability ? crossover(rnd, parents[a], parents[tournament(rnd)]) : parents[a]->Clone();
+        if (rnd.next_double() < opts.mutation_probability)
+            child = mutate(ctx, rnd, child);
+        return child;
+    }
+
+    int tournament(counter_rng& rnd) const
+    {
+        auto best = rnd.next(opts.population_size - 1);
+        for (int k = 1; k < opts.tournament_size; ++k)
+        {
+            auto c = rnd.next(opts.population_size - 1);
+            if (parent_fitness[c] < parent_fitness[best])
+                best = c;
+        }
+        return best;
+    }
+
+    static int level(const node* n)
+    {
+        int l = 1;
+        for (auto p = n->GetParent(); p != nullptr; p = p->GetParent())
+            ++l;
+        return l;
+    }
+
+    // puts replacement in the place of the subtree s of root, and returns the new root
+    static node* graft(node* root, node* s, node* replacement)
+    {
+        if (s == root)
+        {
+            delete root;
+            return replacement;
+        }
+        s->GetParent()->ReplaceSubtree(s, replacement);
+        delete s;
+        return root;
+    }
+
+    // a copy of a with a random subtree replaced by a copy of a random subtree of b. sites that would exceed
+    // the limits are drawn again a few times before giving up (the child is then a copy of a)
+    node* crossover(counter_rng& rnd, const node* a, node* b) const
+    {
+        auto child = a->Clone();
+        auto sites = child->IteratePrefix();
+        auto donors = b->IteratePrefix();
+        auto length = child->GetLength();
+        for (int attempt = 0; attempt < 8; ++attempt)
+        {
+            auto s = sites[rnd.next(static_cast<int>(sites.size()) - 1)];
+            auto d = donors[rnd.next(static_cast<int>(donors.size()) - 1)];
+            if (length - s->GetLength() + d->GetLength() <= opts.max_length && level(s) + d->GetDepth() - 1 <= opts.max_depth)
+                return graft(child, s, d->Clone());
+        }
+        return child;
+    }
+
+    // either replaces a random subtree with a new grown one, or perturbs a random leaf: the value of a constant,
+    // the weight of a variable or the variable itself
+    node* mutate(context& ctx, counter_rng& rnd, node* child) const
+    {
+        auto sites = child->IteratePrefix();
+        auto s = sites[rnd.next(static_cast<int>(sites.size()) - 1)];
+        if (rnd.next_double() < 0.5)
+        {
+            auto depth = std::max(1, std::min(opts.mutation_depth, opts.max_depth - level(s) + 1));
+            auto replacement = ctx.initializer.grow(rnd, ctx.data, depth);
+            if (child->GetLength() - s->GetLength() + replacement->GetLength() > opts.max_length)
+            {
+                delete replacement;
+                return child;
+            }
+            return graft(child, s, replacement);
+        }
+        while (s->SubtreeCount() > 0)
+            s = s->Subtrees()[rnd.next(s->SubtreeCount() - 1)];
+        if (s->GetOpCode() == CONSTANT)
+        {
+            s->SetValue(s->GetValue() + rnd.next_double(-1, 1));
+        }
+        else if (rnd.next_double() < 0.5)
+        {
+            s->SetWeight(s->GetWeight() + rnd.next_double(-1, 1));
+        }
+        else
+        {
+            auto& variables = ctx.initializer.options().variables;
+            s->SetVariable(variables[rnd.next(static_cast<int>(variables.size()) - 1)]);
+        }
+        return child;
+    }
+
+    evolution_options opts;
+    int nthreads;
+    basic_program_cache<T, Accumulator>* programs_cache = nullptr;
+
+    std::vector<node*> parents;
+    std::vector<double> parent_fitness;
+    std::vector<node*> offspring;
+    std::vector<double> offspring_fitness;
+    std::vector<generation_summary> summaries;
+
+    // pipeline state, guarded by the mutex
+    std::mutex mutex;
+    std::condition_variable advance;
+    int generation = 0;
+    int next = 0;
+    int evaluated = 0;
+    bool finished = false;
+    std::exception_ptr error;
+    double idle_breeding = 0;
+    double idle_evaluation = 0;
+};
+
+typedef basic_evolution_engine<double> evolution_engine;
+typedef basic_evolution_engine<float> float_evolution_engine;
+typedef basic_evolution_engine<float, double> mixed_evolution_engine;
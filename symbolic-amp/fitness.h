@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cmath>
+#include "simd.h"
+
+// streaming statistics of (estimated, target) pairs. values are accumulated one row block at a time
+// while the block is still in L1, and partial results from different blocks or threads can be merged
+// (Chan et al. pairwise update), so no column of predictions is ever materialized.
+// non-finite estimates propagate into the statistics and make the metrics nan
+struct fitness_statistics
+{
+    double count = 0;
+    double mean_x = 0;  // estimated values
+    double mean_y = 0;  // target values
+    double m2x = 0;     // sum of squared deviations of x
+    double m2y = 0;     // sum of squared deviations of y
+    double cxy = 0;     // sum of co-deviations of x and y
+    double sse = 0;     // sum of squared errors
+    double sae = 0;     // sum of absolute errors
+
+    // accumulates n estimates x against their targets y. the sums of a block are computed in the precision of the
+    // values (single precision blocks use twice the lanes) and merged into the statistics in double precision
+    template<typename T>
+    void add(const T* x, const T* y, int n)
+    {
+        if (n <= 0)
+            return;
+
+        typedef simd::pack<T> P;
+        auto sx = P::broadcast(0), sy = P::broadcast(0);
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+        {
+            sx = P::add(sx, P::load(x + i));
+            sy = P::add(sy, P::load(y + i));
+        }
+        T bx = P::hsum(sx), by = P::hsum(sy);
+        for (; i < n; ++i)
+        {
+            bx += x[i];
+            by += y[i];
+        }
+
+        fitness_statistics block;
+        block.count = n;
+        T mean_x = bx / n, mean_y = by / n;
+        block.mean_x = mean_x;
+        block.mean_y = mean_y;
+
+        // second pass over the block for the centered moments and the errors
+        auto mx = P::broadcast(mean_x), my = P::broadcast(mean_y);
+        auto vxx = P::broadcast(0), vyy = P::broadcast(0), vxy = P::broadcast(0), vse = P::broadcast(0), vae = P::broadcast(0);
+        i = 0;
+        for (; i + P::width <= n; i += P::width)
+        {
+            auto xi = P::load(x + i), yi = P::load(y + i);
+            auto dx = P::sub(xi, mx), dy = P::sub(yi, my), e = P::sub(xi, yi);
+            vxx = P::add(vxx, P::mul(dx, dx));
+            vyy = P::add(vyy, P::mul(dy, dy));
+            vxy = P::add(vxy, P::mul(dx, dy));
+            vse = P::add(vse, P::mul(e, e));
+            vae = P::add(vae, P::abs(e));
+        }
+        T m2x = P::hsum(vxx), m2y = P::hsum(vyy), cxy = P::hsum(vxy), sse = P::hsum(vse), sae = P::hsum(vae);
+        for (; i < n; ++i)
+        {
+            T dx = x[i] - mean_x, dy = y[i] - mean_y, e = x[i] - y[i];
+            m2x += dx * dx;
+            m2y += dy * dy;
+            cxy += dx * dy;
+            sse += e * e;
+            sae += std::abs(e);
+        }
+        block.m2x = m2x;
+        block.m2y = m2y;
+        block.cxy = cxy;
+        block.sse = sse;
+        block.sae = sae;
+        merge(block);
+    }
+
+    void merge(const fitness_statistics& other)
+    {
+        if (other.count == 0)
+            return;
+        if (count == 0)
+        {
+            *this = other;
+            return;
+        }
+        auto n = count + other.count;
+        auto dx = other.mean_x - mean_x;
+        auto dy = other.mean_y - mean_y;
+        auto f = count * other.count / n;
+        m2x += other.m2x + dx * dx * f;
+        m2y += other.m2y + dy * dy * f;
+        cxy += other.cxy + dx * dy * f;
+        mean_x += dx * other.count / n;
+        mean_y += dy * other.count / n;
+        sse += other.sse;
+        sae += other.sae;
+        count = n;
+    }
+
+    double mean_squared_error() const { return sse / count; }
+    double mean_absolute_error() const { return sae / count; }
+
+    // coefficient of determination, 1 - SSE / SST
+    double r_squared() const { return 1 - sse / m2y; }
+
+    // pearson correlation coefficient, 0 if either variable is constant
+    double pearson() const
+    {
+        auto d = m2x * m2y;
+        return d == 0 ? 0 : cxy / std::sqrt(d);
+    }
+
+    // optimal linear scaling: target ~ intercept + slope * estimated in the least squares sense
+    double slope() const { return m2x == 0 ? 0 : cxy / m2x; }
+    double intercept() const { return mean_y - slope() * mean_x; }
+
+    // mean squared error of the linearly scaled estimates, without a second pass over the data
+    double scaled_mean_squared_error() const
+    {
+        auto residual = m2x == 0 ? m2y : m2y - cxy * cxy / m2x;
+        return (residual < 0 ? 0 : residual) / count;
+    }
+};
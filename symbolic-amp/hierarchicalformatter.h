@@ -9,11 +9,12 @@ namespace
 {
     namespace render_chars
     {
-        static const char JunctionDown = '┬';
-        static const char HorizontalLine = '─';
-        static const char VerticalLine = '│';
-        static const char JunctionRight = '├';
-        static const char CornerRight = '└';
+        // box drawing glyphs in utf-8, which take several bytes each
+        static const char* const JunctionDown = "\xe2\x94\xac";    // ┬
+        static const char* const HorizontalLine = "\xe2\x94\x80";  // ─
+        static const char* const VerticalLine = "\xe2\x94\x82";    // │
+        static const char* const JunctionRight = "\xe2\x94\x9c";   // ├
+        static const char* const CornerRight = "\xe2\x94\x94";     // └
     }
 
     std::map<op_code, std::string> names = {
@@ -24,6 +25,13 @@ namespace
         { NEG, "neg" },
         { EXP, "exp" },
         { LOG, "log" },
+        { SIN, "sin" },
+        { COS, "cos" },
+        { SQRT, "sqrt" },
+        { SQUARE, "square" },
+        { POW, "pow" },
+        { TANH, "tanh" },
+        { AQ, "aq" },
         { CONSTANT, "C" },
         { VARIABLE, "V" }
     };
@@ -50,10 +58,10 @@ private:
             auto & subtrees = node->Subtrees();
             for (size_t i = 0; i < subtrees.size(); ++i)
             {
-                char connector, extender = ' ';
+                const char* connector;
+                const char* extender = " ";
                 if (i == 0)
                 {
-                    ss << padding;
                     if (subtrees.size() > 1)
                     {
                         connector = render_chars::JunctionDown;
@@ -62,16 +70,17 @@ private:
                     else
                     {
                         connector = render_chars::HorizontalLine;
-                        extender = ' ';
+                        extender = " ";
                     }
                 }
                 else
                 {
-                    //         ss << padding;
-                    if (i == node->SubtreeCount() - 1)
+                    // the first child continues the line of the label, the others start below it
+                    ss << padding;
+                    if (i == subtrees.size() - 1)
                     {
                         connector = render_chars::CornerRight;
-                        extender = ' ';
+                        extender = " ";
                     }
                     else
                     {
@@ -79,8 +88,8 @@ private:
                         extender = render_chars::VerticalLine;
                     }
                 }
-                ss << connector + render_chars::HorizontalLine;
-                std::string new_prefix = padding + extender + ' ';
+                ss << connector << render_chars::HorizontalLine;
+                std::string new_prefix = padding + extender + " ";
                 format(subtrees[i], new_prefix, ss);
             }
         }
@@ -90,8 +99,10 @@ private:
             {
             case CONSTANT:
                 ss << " " << node->GetValue();
+                break;
             case VARIABLE:
                 ss << " " << node->GetWeight() << " " << node->GetName();
+                break;
             default: break;
             }
             ss << std::endl;
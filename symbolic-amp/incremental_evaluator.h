@@ -0,0 +1,114 @@
+#pragma once
+
+#include "node.h"
+#include "dataset.h"
+#include "simd.h"
+#include "operators.h"
+#include <unordered_map>
+#include <stdexcept>
+
+// keeps the column of values of every node of one tree, so that after an edit only the changed subtree
+// and the nodes on its path to the root are evaluated again: O(depth x rows) instead of O(length x rows).
+// meant for local search and mutation loops that edit a tree in place and re-evaluate it after every step
+class incremental_evaluator
+{
+public:
+    incremental_evaluator(node* root, const dataset& data, int start, int count)
+        : root_(root), data_(data), start_(start), count_(count), evaluated_(0)
+    {
+        rebuild();
+    }
+
+    // values of the whole tree for the rows [start, start + count)
+    const double* values() const { return columns_.at(root_).data(); }
+    node* root() const { return root_; }
+
+    // call after changing the subtree rooted at changed (its values, or its shape through node::ReplaceSubtree and friends).
+    // the subtree is evaluated again from scratch, then each of its ancestors from the columns of its children
+    void update(node* changed)
+    {
+        evaluate_subtree(changed);
+        for (auto n = changed->GetParent(); n != nullptr; n = n->GetParent())
+            evaluate_node(n);
+
+        // columns of detached nodes are dropped once they make up half of the storage
+        if (columns_.size() > 2 * static_cast<size_t>(root_->GetLength()))
+            collect();
+    }
+
+    // the root itself was replaced by another tree
+    void update_root(node* root)
+    {
+        root_ = root;
+        rebuild();
+    }
+
+    void rebuild()
+    {
+        columns_.clear();
+        evaluate_subtree(root_);
+    }
+
+    // number of node evaluations (each over count rows) performed so far
+    size_t evaluated() const { return evaluated_; }
+
+private:
+    void evaluate_subtree(node* n)
+    {
+        for (auto s : n->Subtrees())
+            evaluate_subtree(s);
+        evaluate_node(n);
+    }
+
+    void evaluate_node(node* n)
+    {
+        auto& column = columns_[n];
+        column.resize(count_);
+        auto r = column.data();
+        switch (n->GetOpCode())
+        {
+        case VARIABLE:
+        {
+            auto i = data_.variable_index(n->GetVariable());
+            if (i < 0)
+                throw std::out_of_range("the variable " + n->GetName() + " is not present in the dataset.");
+            simd::scale(r, data_.column(i) + start_, n->GetWeight(), count_);
+            break;
+        }
+        case CONSTANT:
+            simd::fill(r, n->GetValue(), count_);
+            break;
+        default:
+        {
+            auto& subtrees = n->Subtrees();
+            operators::check_arity(n->GetOpCode(), static_cast<int>(subtrees.size()));
+            std::vector<const double*> args(subtrees.size());
+            for (size_t k = 0; k < subtrees.size(); ++k)
+                args[k] = columns_.at(subtrees[k]).data();
+            operators::apply(n->GetOpCode(), r, args.data(), static_cast<int>(args.size()), count_);
+            break;
+        }
+        }
+        ++evaluated_;
+    }
+
+    void collect()
+    {
+        std::unordered_map<const node*, simd::aligned_vector<double>> live;
+        for (auto n : root_->IteratePrefix())
+        {
+            auto it = columns_.find(n);
+            if (it == columns_.end())
+                throw std::logic_error("a node of the tree has not been evaluated.");
+            live.emplace(n, std::move(it->second));
+        }
+        columns_.swap(live);
+    }
+
+    node* root_;
+    const dataset& data_;
+    int start_;
+    int count_;
+    size_t evaluated_;
+    std::unordered_map<const node*, simd::aligned_vector<double>> columns_;
+};
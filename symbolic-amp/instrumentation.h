@@ -0,0 +1,361 @@
+#pragma once
+
+#include "config.h"
+#include "node.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// counters of where evaluation time goes: nodes evaluated per opcode, time in compilation and evaluation, cache hits
+// and misses, busy and idle time of the pool threads, and optionally hardware events. the hot paths update them
+// through the SYMBOLIC_AMP_* macros at the end of this file, which expand to nothing unless SYMBOLIC_AMP_PROFILE is
+// set (see config.h). every thread counts into a block of its own, so updates never contend; collect() sums the blocks
+namespace profiling
+{
+    enum counter
+    {
+        compilations,
+        compile_nanoseconds,
+        evaluations,            // programs evaluated over a range of rows
+        evaluate_nanoseconds,
+        program_cache_hits,
+        program_cache_misses,
+        subtree_cache_hits,     // row blocks
+        subtree_cache_misses,
+        jit_cache_hits,
+        jit_cache_misses,
+        busy_nanoseconds,       // pool threads running tasks
+        idle_nanoseconds,       // pool threads waiting for work
+        cycles,                 // hardware events, see hardware_scope
+        instructions,
+        llc_misses,
+        counter_count
+    };
+
+    constexpr bool enabled = SYMBOLIC_AMP_PROFILE != 0;
+    constexpr int opcode_count = VARIABLE + 1;
+
+    inline const char* opcode_name(int opcode)
+    {
+        static const char* names[opcode_count] = { "add", "sub", "mul", "div", "neg", "exp", "log", "sin", "cos", "sqrt", "square", "pow", "tanh", "aq", "constant", "variable" };
+        return names[opcode];
+    }
+
+    // the counters of one thread. only the owner writes them, so an update is a plain load and store rather than a
+    // locked instruction; the atomics only make the reads of collect() well defined
+    struct thread_counters
+    {
+        std::atomic<uint64_t> values[counter_count] = {};
+        std::atomic<uint64_t> nodes[opcode_count] = {};  // rows evaluated by the instructions of each opcode
+        int id = 0;
+    };
+
+    struct registry
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<thread_counters>> threads;
+    };
+
+    // never destroyed, so threads that outlive main can still count
+    inline registry& threads()
+    {
+        static auto r = new registry();
+        return *r;
+    }
+
+    // counters of the calling thread, registered on first use. they outlive the thread, so its counts are kept
+    inline thread_counters& local()
+    {
+        thread_local thread_counters* counters = nullptr;
+        if (counters == nullptr)
+        {
+            auto& r = threads();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.threads.push_back(std::make_unique<thread_counters>());
+            counters = r.threads.back().get();
+            counters->id = static_cast<int>(r.threads.size()) - 1;
+        }
+        return *counters;
+    }
+
+    inline void bump(std::atomic<uint64_t>& v, uint64_t n)
+    {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    inline void add(counter c, uint64_t n) { bump(local().values[c], n); }
+    inline void add_nodes(int opcode, uint64_t n) { bump(local().nodes[opcode], n); }
+
+    // adds the nanoseconds spent in its scope to a counter
+    class scoped_timer
+    {
+    public:
+        explicit scoped_timer(counter c) : target(c), start(std::chrono::steady_clock::now()) {}
+        ~scoped_timer() { add(target, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count())); }
+
+        scoped_timer(const scoped_timer&) = delete;
+        scoped_timer& operator=(const scoped_timer&) = delete;
+
+    private:
+        counter target;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // cycles, instructions and last level cache misses of the calling thread, through perf_event_open (linux only).
+    // opening the events fails without the permission (see /proc/sys/kernel/perf_event_paranoid) and in some
+    // containers and virtual machines: available() is then false and every count is 0
+    class hardware_counters
+    {
+    public:
+        hardware_counters()
+        {
+#if defined(__linux__)
+            const uint64_t events[] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+            for (int e = 0; e < 3; ++e)
+            {
+                perf_event_attr attr = {};
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.size = sizeof(attr);
+                attr.config = events[e];
+                attr.disabled = e == 0;  // the group runs when its leader is enabled
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+                fds[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, e == 0 ? -1 : fds[0], 0));
+                if (fds[e] < 0)
+                {
+                    close();
+                    return;
+                }
+            }
+#endif
+        }
+
+        ~hardware_counters() { close(); }
+
+        hardware_counters(const hardware_counters&) = delete;
+        hardware_counters& operator=(const hardware_counters&) = delete;
+
+        bool available() const { return fds[0] >= 0; }
+
+        // resets the counts and starts counting
+        void start()
+        {
+#if defined(__linux__)
+            if (!available())
+                return;
+            ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+        }
+
+        // stops counting; counts holds the cycles, instructions and cache misses since start
+        void stop(uint64_t (&counts)[3])
+        {
+            counts[0] = counts[1] = counts[2] = 0;
+#if defined(__linux__)
+            if (!available())
+                return;
+            ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            uint64_t group[4] = {};  // the number of events, then their counts
+            if (read(fds[0], group, sizeof(group)) == static_cast<ssize_t>(sizeof(group)) && group[0] == 3)
+            {
+                for (int e = 0; e < 3; ++e)
+                    counts[e] = group[e + 1];
+            }
+#endif
+        }
+
+    private:
+        void close()
+        {
+#if defined(__linux__)
+            for (auto& fd : fds)
+            {
+                if (fd >= 0)
+                    ::close(fd);
+                fd = -1;
+            }
+#endif
+        }
+
+        int fds[3] = { -1, -1, -1 };
+    };
+
+    // counts the hardware events of its scope on the calling thread into the profile. opening the events costs a few
+    // system calls, so this is meant for coarse scopes, e.g. a whole population evaluation
+    class hardware_scope
+    {
+    public:
+        hardware_scope() { hw.start(); }
+        ~hardware_scope()
+        {
+            uint64_t counts[3];
+            hw.stop(counts);
+            add(cycles, counts[0]);
+            add(instructions, counts[1]);
+            add(llc_misses, counts[2]);
+        }
+
+        hardware_scope(const hardware_scope&) = delete;
+        hardware_scope& operator=(const hardware_scope&) = delete;
+
+    private:
+        hardware_counters hw;
+    };
+
+    struct thread_profile
+    {
+        int id;
+        uint64_t busy_nanoseconds;
+        uint64_t idle_nanoseconds;
+    };
+
+    // the sums of the counters of every thread, and the busy and idle time of the threads that have any
+    struct snapshot
+    {
+        uint64_t values[counter_count] = {};
+        uint64_t nodes[opcode_count] = {};
+        std::vector<thread_profile> threads;
+
+        uint64_t operator[](counter c) const { return values[c]; }
+        uint64_t nodes_evaluated() const
+        {
+            uint64_t n = 0;
+            for (auto v : nodes)
+                n += v;
+            return n;
+        }
+    };
+
+    inline snapshot collect()
+    {
+        snapshot s;
+        auto& r = threads();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (auto& t : r.threads)
+        {
+            for (int c = 0; c < counter_count; ++c)
+                s.values[c] += t->values[c].load(std::memory_order_relaxed);
+            for (int op = 0; op < opcode_count; ++op)
+                s.nodes[op] += t->nodes[op].load(std::memory_order_relaxed);
+            auto busy = t->values[busy_nanoseconds].load(std::memory_order_relaxed);
+            auto idle = t->values[idle_nanoseconds].load(std::memory_order_relaxed);
+            if (busy > 0 || idle > 0)
+                s.threads.push_back({ t->id, busy, idle });
+        }
+        return s;
+    }
+
+    // zeroes every counter. updates that race with it may survive
+    inline void reset()
+    {
+        auto& r = threads();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (auto& t : r.threads)
+        {
+            for (auto& v : t->values)
+                v.store(0, std::memory_order_relaxed);
+            for (auto& v : t->nodes)
+                v.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    inline double seconds(uint64_t nanoseconds) { return nanoseconds * 1e-9; }
+
+    inline double hit_rate(uint64_t hits, uint64_t misses)
+    {
+        return hits + misses == 0 ? 0 : static_cast<double>(hits) / (hits + misses);
+    }
+
+    inline std::string to_json(const snapshot& s = collect())
+    {
+        std::ostringstream out;
+        out << "{\"enabled\":" << (enabled ? "true" : "false") << ",\"nodes\":{";
+        for (int op = 0; op < opcode_count; ++op)
+            out << (op > 0 ? "," : "") << "\"" << opcode_name(op) << "\":" << s.nodes[op];
+        out << "},\"compile\":{\"count\":" << s[compilations] << ",\"seconds\":" << seconds(s[compile_nanoseconds]) << "}";
+        out << ",\"evaluate\":{\"count\":" << s[evaluations] << ",\"seconds\":" << seconds(s[evaluate_nanoseconds]) << "}";
+        out << ",\"caches\":{";
+        const char* caches[] = { "program", "subtree", "jit" };
+        for (int c = 0; c < 3; ++c)
+        {
+            auto hits = s.values[program_cache_hits + 2 * c], misses = s.values[program_cache_misses + 2 * c];
+            out << (c > 0 ? "," : "") << "\"" << caches[c] << "\":{\"hits\":" << hits << ",\"misses\":" << misses << ",\"hit_rate\":" << hit_rate(hits, misses) << "}";
+        }
+        out << "},\"hardware\":{\"cycles\":" << s[cycles] << ",\"instructions\":" << s[instructions] << ",\"llc_misses\":" << s[llc_misses] << "}";
+        out << ",\"threads\":[";
+        for (size_t t = 0; t < s.threads.size(); ++t)
+            out << (t > 0 ? "," : "") << "{\"id\":" << s.threads[t].id << ",\"busy_seconds\":" << seconds(s.threads[t].busy_nanoseconds) << ",\"idle_seconds\":" << seconds(s.threads[t].idle_nanoseconds) << "}";
+        out << "]}";
+        return out.str();
+    }
+
+    // the text exposition format of Prometheus, every metric prefixed with symbolic_amp_
+    inline std::string to_prometheus(const snapshot& s = collect())
+    {
+        std::ostringstream out;
+        auto metric = [&](const char* name, const char* help) {
+            out << "# HELP symbolic_amp_" << name << " " << help << "\n# TYPE symbolic_amp_" << name << " counter\n";
+        };
+        metric("nodes_evaluated_total", "Rows evaluated by the instructions of each opcode.");
+        for (int op = 0; op < opcode_count; ++op)
+            out << "symbolic_amp_nodes_evaluated_total{opcode=\"" << opcode_name(op) << "\"} " << s.nodes[op] << "\n";
+        metric("compilations_total", "Programs compiled.");
+        out << "symbolic_amp_compilations_total " << s[compilations] << "\n";
+        metric("compile_seconds_total", "Time spent compiling programs.");
+        out << "symbolic_amp_compile_seconds_total " << seconds(s[compile_nanoseconds]) << "\n";
+        metric("evaluations_total", "Programs evaluated over a range of rows.");
+        out << "symbolic_amp_evaluations_total " << s[evaluations] << "\n";
+        metric("evaluate_seconds_total", "Time spent evaluating programs.");
+        out << "symbolic_amp_evaluate_seconds_total " << seconds(s[evaluate_nanoseconds]) << "\n";
+        const char* caches[] = { "program", "subtree", "jit" };
+        metric("cache_hits_total", "Cache lookups that hit.");
+        for (int c = 0; c < 3; ++c)
+            out << "symbolic_amp_cache_hits_total{cache=\"" << caches[c] << "\"} " << s.values[program_cache_hits + 2 * c] << "\n";
+        metric("cache_misses_total", "Cache lookups that missed.");
+        for (int c = 0; c < 3; ++c)
+            out << "symbolic_amp_cache_misses_total{cache=\"" << caches[c] << "\"} " << s.values[program_cache_misses + 2 * c] << "\n";
+        metric("hardware_events_total", "Hardware events counted in hardware scopes.");
+        out << "symbolic_amp_hardware_events_total{event=\"cycles\"} " << s[cycles] << "\n";
+        out << "symbolic_amp_hardware_events_total{event=\"instructions\"} " << s[instructions] << "\n";
+        out << "symbolic_amp_hardware_events_total{event=\"llc_misses\"} " << s[llc_misses] << "\n";
+        metric("thread_busy_seconds_total", "Time pool threads spent running tasks.");
+        for (auto& t : s.threads)
+            out << "symbolic_amp_thread_busy_seconds_total{thread=\"" << t.id << "\"} " << seconds(t.busy_nanoseconds) << "\n";
+        metric("thread_idle_seconds_total", "Time pool threads spent waiting for work.");
+        for (auto& t : s.threads)
+            out << "symbolic_amp_thread_idle_seconds_total{thread=\"" << t.id << "\"} " << seconds(t.idle_nanoseconds) << "\n";
+        return out.str();
+    }
+}
+
+#define SYMBOLIC_AMP_CONCAT_(a, b) a##b
+#define SYMBOLIC_AMP_CONCAT(a, b) SYMBOLIC_AMP_CONCAT_(a, b)
+
+#if SYMBOLIC_AMP_PROFILE
+// adds n to a profiling::counter of the calling thread
+#define SYMBOLIC_AMP_COUNT(c, n) ::profiling::add(::profiling::c, static_cast<uint64_t>(n))
+// adds n rows evaluated to the count of an opcode
+#define SYMBOLIC_AMP_COUNT_NODES(opcode, n) ::profiling::add_nodes(opcode, static_cast<uint64_t>(n))
+// adds the time until the end of the enclosing scope to a nanoseconds counter
+#define SYMBOLIC_AMP_TIMED(c) ::profiling::scoped_timer SYMBOLIC_AMP_CONCAT(profiling_timer_, __LINE__)(::profiling::c)
+// counts the hardware events until the end of the enclosing scope
+#define SYMBOLIC_AMP_HARDWARE_SCOPE() ::profiling::hardware_scope SYMBOLIC_AMP_CONCAT(profiling_hardware_, __LINE__)
+#else
+#define SYMBOLIC_AMP_COUNT(c, n) ((void)0)
+#define SYMBOLIC_AMP_COUNT_NODES(opcode, n) ((void)0)
+#define SYMBOLIC_AMP_TIMED(c) ((void)0)
+#define SYMBOLIC_AMP_HARDWARE_SCOPE() ((void)0)
+#endif
@@ -1,112 +1,368 @@
 #pragma once
 #include "node.h"
-#include <unordered_map>
+#include "linear_tree.h"
+#include "dataset.h"
+#include "simd.h"
+#include "fitness.h"
+#include "subtree_cache.h"
+#include "operators.h"
+#include "register_allocation.h"
+#include "instrumentation.h"
+#include <stdexcept>
 #include <string>
+#include <algorithm>
+#include <type_traits>
 
-struct instruction
+// instructions are laid out in postfix order: the last child of instruction i is i - 1,
+// and each preceding child ends right before the start of the next one. the columnar evaluation runs them in the
+// order of the schedule and keeps their results in the slots assigned by register_allocation.h
+template<typename T>
+struct basic_instruction
 {
     op_code             opcode;
     int                  arity;
-    int                  index;
-    double               value;
-    double              weight;
-    double               *data;
+    int                 length;
+    int               variable;   // dataset column index (VARIABLE only)
+    T                    value;
+    T                   weight;
+    const T              *data;
+    uint64_t              hash;   // structural hash of the subtree rooted here
+    int                   slot;   // scratch buffer of the result
+    int                  order;   // the instruction executed at this step of the schedule
 };
 
-class interpreter
+typedef basic_instruction<double> instruction;
+
+// T is the precision in which trees are evaluated. Accumulator is the precision of the fitness reductions:
+// T itself, or double on top of float values for the mixed precision mode, which gets the throughput of
+// single precision evaluation without accumulating the rounding errors of the sums over all rows
+template<typename T, typename Accumulator = T>
+class basic_interpreter
 {
 public:
-    interpreter() {}
-    ~interpreter() {}
+    typedef T value_type;
+    typedef basic_instruction<T> instruction;
+    typedef basic_dataset<T> dataset;
+
+    basic_interpreter() {}
+    ~basic_interpreter() {}
+
+    // number of rows processed at once by the columnar evaluation mode
+    static constexpr int block_size = 256;
+
+    static std::vector<instruction> compile(node *root, const dataset& data)
+    {
+        return compile(linear_tree::FromNode(root), data);
+    }
 
-    static std::vector<instruction> compile(node *root, std::unordered_map<std::string, std::vector<double>>& data)
+    // the linear tree is already in postfix order, so compilation is a single pass over it
+    static std::vector<instruction> compile(const linear_tree& tree, const dataset& data)
     {
-        std::vector<instruction> instructions(root->GetLength());
-        instructions[0] = instruction{ root->GetOpCode(), root->SubtreeCount() };
-        auto nodes = root->IterateBreadth();
-        int c = 1;
+        SYMBOLIC_AMP_TIMED(compile_nanoseconds);
+        SYMBOLIC_AMP_COUNT(compilations, 1);
+        auto const & nodes = tree.Nodes();
+        auto hashes = tree.Hashes();
+        std::vector<instruction> instructions(nodes.size());
         for (size_t i = 0; i < nodes.size(); ++i)
         {
-            auto node = nodes[i];
-            if (node->SubtreeCount() == 0)
-                continue;
-            auto subtrees = node->Subtrees();
-            for (size_t j = 0; j != subtrees.size(); ++j)
+            auto const & n = nodes[i];
+            auto & instr = instructions[i];
+            instr.opcode = n.opcode;
+            instr.arity = n.arity;
+            instr.length = n.length;
+            instr.value = static_cast<T>(n.value);
+            instr.weight = static_cast<T>(n.weight);
+            instr.variable = -1;
+            instr.data = nullptr;
+            instr.hash = hashes[i];
+            operators::check_arity(n.opcode, n.arity);
+            if (n.opcode == VARIABLE)
             {
-                auto subtree = subtrees[j];
-                instruction instr;
-                instr.opcode = subtree->GetOpCode();
-                if (subtree->GetOpCode() == VARIABLE)
-                {
-                    instr.data = data[subtree->GetName()].data();
-                    instr.weight = subtree->GetWeight();
-                }
-                if (subtree->GetOpCode() == CONSTANT)
-                {
-                    instr.value = subtree->GetValue();
-                }
-
-                instructions[c + j] = instr;
+                instr.variable = data.variable_index(n.variable);
+                if (instr.variable < 0)
+                    throw std::out_of_range("the variable " + symbol_table::name(n.variable) + " is not present in the dataset.");
+                instr.data = data.column(instr.variable);
             }
-            instructions[i].index = c;
-            instructions[i].arity = node->SubtreeCount();
-            c += node->SubtreeCount();
         }
+        register_allocation::allocate(instructions, false);
         return instructions;
     }
 
-    static double evaluate(node* root, int row, std::unordered_map<std::string, std::vector<double>>& data)
+    // the node overloads compile the tree on every call; basic_program_cache keeps the programs across calls
+    static T evaluate(node* root, int row, const dataset& data)
     {
         auto instructions = compile(root, data);
         return evaluate(instructions, row);
     }
 
-    static std::vector<double> evaluate(node *root, const std::vector<int>& rows, std::unordered_map<std::string, std::vector<double>>& data)
+    static std::vector<T> evaluate(node *root, const std::vector<int>& rows, const dataset& data)
+    {
+        return evaluate(root, row_selection::indices(rows), data);
+    }
+
+    // a contiguous selection is evaluated in place; other selections are gathered into compact columns first,
+    // so they run through the block evaluation rather than one row at a time
+    static std::vector<T> evaluate(node *root, const row_selection& rows, const dataset& data)
+    {
+        if (rows.contiguous())
+            return evaluate(root, rows.start(), rows.size(), data);
+        return evaluate(root, 0, rows.size(), data.gather(rows));
+    }
+
+    static std::vector<T> evaluate(node *root, int start, int count, const dataset& data)
     {
-        auto values = std::vector<double>(rows.size());
-        int row = 0;
+        auto values = std::vector<T>(count);
         auto instructions = compile(root, data);
-        std::generate(begin(values), end(values), [&]() { return evaluate(instructions, rows[row++]); });
+        evaluate(instructions, start, count, values.data());
         return values;
     }
 
-    static double evaluate(std::vector<instruction>& code, int row)
+    // columnar evaluation of rows [start, start + count): each instruction is executed over a whole block of rows,
+    // so the dispatch cost is paid once per block instead of once per row
+    static void evaluate(const std::vector<instruction>& code, int start, int count, T* result)
+    {
+        simd::aligned_vector<T> buffer(buffer_size(code));
+        evaluate(code, start, count, result, buffer.data());
+    }
+
+    // number of scratch values the columnar evaluation of a program needs: a block for every slot, which is at most
+    // code.size() * block_size
+    static size_t buffer_size(const std::vector<instruction>& code)
+    {
+        return static_cast<size_t>(register_allocation::slots(code)) * block_size;
+    }
+
+    // same as above, using a caller-provided scratch buffer of at least buffer_size(code) values.
+    // with a cache, every row block of a subtree found in it is copied instead of evaluated
+    static void evaluate(const std::vector<instruction>& code, int start, int count, T* result, T* buffer, subtree_cache* cache = nullptr)
+    {
+        SYMBOLIC_AMP_TIMED(evaluate_nanoseconds);
+        SYMBOLIC_AMP_COUNT(evaluations, 1);
+        register_allocation::subtree_index subtrees;
+        if (cache)
+            subtrees = register_allocation::subtree_index(code);
+        for (int row = start; row < start + count; row += block_size)
+        {
+            auto n = std::min(block_size, start + count - row);
+            if (cache)
+                evaluate_block(code, row, n, result + (row - start), buffer, *cache, subtrees);
+            else
+                evaluate_block(code, row, n, result + (row - start), buffer);
+        }
+    }
+
+    // fitness of the tree against the target column over the rows [start, start + count)
+    static fitness_statistics evaluate_fitness(node *root, const dataset& data, const std::string& target, int start, int count)
+    {
+        return evaluate_fitness(compile(root, data), data, target, start, count);
+    }
+
+    // same for a program compiled against data
+    static fitness_statistics evaluate_fitness(const std::vector<instruction>& code, const dataset& data, const std::string& target, int start, int count)
+    {
+        if constexpr (std::is_same<T, Accumulator>::value)
+        {
+            return evaluate_fitness(code, data[target], start, count);
+        }
+        else
+        {
+            // only the rows that are evaluated are widened
+            std::vector<Accumulator> y(count);
+            simd::convert(y.data(), data[target] + start, count);
+            simd::aligned_vector<T> buffer(buffer_size(code));
+            return evaluate_fitness(code, y.data(), start, start, count, buffer.data());
+        }
+    }
+
+    static fitness_statistics evaluate_fitness(node *root, const dataset& data, const std::string& target, const row_selection& rows)
+    {
+        if (rows.contiguous())
+            return evaluate_fitness(root, data, target, rows.start(), rows.size());
+        return evaluate_fitness(root, data.gather(rows), target, 0, rows.size());
+    }
+
+    static fitness_statistics evaluate_fitness(const std::vector<instruction>& code, const Accumulator* target, int start, int count)
     {
-        for (auto it = std::rbegin(code); it != std::rend(code); ++it)
+        simd::aligned_vector<T> buffer(buffer_size(code));
+        return evaluate_fitness(code, target, start, count, buffer.data());
+    }
+
+    // fused evaluation and reduction: every block of estimates is folded into the statistics while it is still in L1,
+    // so no prediction vector is written or read back. target is indexed by row, like the dataset columns.
+    // in the mixed precision mode every block of estimates is widened before the reduction
+    static fitness_statistics evaluate_fitness(const std::vector<instruction>& code, const Accumulator* target, int start, int count, T* buffer, subtree_cache* cache = nullptr)
+    {
+        return evaluate_fitness(code, target, 0, start, count, buffer, cache);
+    }
+
+    // same with target holding the values of the rows from first on, e.g. a widened copy of only the evaluated rows
+    static fitness_statistics evaluate_fitness(const std::vector<instruction>& code, const Accumulator* target, int first, int start, int count, T* buffer, subtree_cache* cache = nullptr)
+    {
+        SYMBOLIC_AMP_TIMED(evaluate_nanoseconds);
+        SYMBOLIC_AMP_COUNT(evaluations, 1);
+        fitness_statistics statistics;
+        register_allocation::subtree_index subtrees;
+        if (cache)
+            subtrees = register_allocation::subtree_index(code);
+        // no operand of the root shares its slot, so the slot can hold the estimates
+        auto estimates = buffer + code.back().slot * block_size;
+        for (int row = start; row < start + count; row += block_size)
         {
-            switch (it->opcode)
+            auto n = std::min(block_size, start + count - row);
+            if (cache)
+                evaluate_block(code, row, n, estimates, buffer, *cache, subtrees);
+            else
+                evaluate_block(code, row, n, estimates, buffer);
+            if constexpr (std::is_same<T, Accumulator>::value)
             {
-            case VARIABLE:
+                statistics.add(estimates, target + (row - first), n);
+            }
+            else
             {
-                auto weight = it->weight;
-                it->value = it->data[row] * weight;
-                break;
+                alignas(simd::alignment) Accumulator wide[block_size];
+                simd::convert(wide, estimates, n);
+                statistics.add(wide, target + (row - first), n);
             }
-            case ADD:
+        }
+        return statistics;
+    }
+
+    // value of one row; the value of every instruction is left in its value field
+    static T evaluate(std::vector<instruction>& code, int row)
+    {
+        T local[max_local_arity];
+        std::vector<T> args;
+        for (int i = 0; i < static_cast<int>(code.size()); ++i)
+        {
+            auto& instr = code[i];
+            switch (instr.opcode)
             {
-                it->value = code[it->index].value + code[it->index + 1].value;
+            case VARIABLE:
+                instr.value = instr.data[row] * instr.weight;
                 break;
-            }
-            case SUB:
+            case CONSTANT:
+                break;
+            default:
             {
-                it->value = code[it->index].value - code[it->index + 1].value;
+                auto values = instr.arity <= max_local_arity ? local : (args.resize(instr.arity), args.data());
+                operators::for_each_child(code, i, [&](int k, int c) { values[k] = code[c].value; });
+                instr.value = operators::apply(instr.opcode, values, instr.arity);
                 break;
             }
-            case MUL:
+            }
+        }
+        return code.back().value;
+    }
+
+    // same without writing into the program, so it can be shared (e.g. by a program cache): the values of the
+    // instructions go to values, which holds code.size() of them
+    static T evaluate(const std::vector<instruction>& code, int row, T* values)
+    {
+        T local[max_local_arity];
+        std::vector<T> args;
+        for (int i = 0; i < static_cast<int>(code.size()); ++i)
+        {
+            auto& instr = code[i];
+            switch (instr.opcode)
             {
-                it->value = code[it->index].value * code[it->index + 1].value;
+            case VARIABLE:
+                values[i] = instr.data[row] * instr.weight;
                 break;
-            }
-            case DIV:
+            case CONSTANT:
+                values[i] = instr.value;
+                break;
+            default:
             {
-                it->value = code[it->index].value / code[it->index + 1].value;
+                auto operands = instr.arity <= max_local_arity ? local : (args.resize(instr.arity), args.data());
+                operators::for_each_child(code, i, [&](int k, int c) { operands[k] = values[c]; });
+                values[i] = operators::apply(instr.opcode, operands, instr.arity);
                 break;
             }
+            }
+        }
+        return values[code.size() - 1];
+    }
 
-            default: break;
+    // evaluates n <= block_size rows starting at row and keeps the values of every instruction, the root included,
+    // in its slice of the buffer (code.size() * block_size values). this is the forward sweep of differentiation
+    static void evaluate_nodes(const std::vector<instruction>& code, int row, int n, T* buffer)
+    {
+        for (int i = 0; i < static_cast<int>(code.size()); ++i)
+            execute(code, i, row, n, buffer + i * block_size, buffer, false);
+    }
+
+private:
+    // evaluates n <= block_size rows starting at row in the order of the schedule. every instruction writes into its
+    // slot of the buffer, except the root which writes straight into the result
+    static void evaluate_block(const std::vector<instruction>& code, int row, int n, T* result, T* buffer)
+    {
+        auto root = static_cast<int>(code.size()) - 1;
+        for (int j = 0; j <= root; ++j)
+        {
+            auto i = code[j].order;
+            execute(code, i, row, n, i == root ? result : buffer + code[i].slot * block_size, buffer, true);
+        }
+    }
+
+    // same as above, but subtrees found in the cache are not evaluated. every subtree is looked up at the first step
+    // of its range in the schedule, outermost first, and a hit skips the whole range; the other results are cached
+    static void evaluate_block(const std::vector<instruction>& code, int row, int n, T* result, T* buffer, subtree_cache& cache, const register_allocation::subtree_index& subtrees)
+    {
+        auto root = static_cast<int>(code.size()) - 1;
+        auto output = [&](int i) { return i == root ? result : buffer + code[i].slot * block_size; };
+        for (int j = 0; j <= root;)
+        {
+            auto hit = 0;
+            for (auto k = subtrees.offsets[j]; k < subtrees.offsets[j + 1] && hit == 0; ++k)
+            {
+                auto& s = code[subtrees.roots[k]];
+                if (cache.cacheable(s.length) && cache.lookup(s.hash, row, n, output(subtrees.roots[k])))
+                    hit = s.length;
             }
+            if (hit > 0)
+            {
+                j += hit;
+                continue;
+            }
+            auto i = code[j].order;
+            auto r = output(i);
+            execute(code, i, row, n, r, buffer, true);
+            if (cache.cacheable(code[i].length))
+                cache.insert(code[i].hash, row, n, r);
+            ++j;
         }
-        return code[0].value;
     }
+
+    // runs instruction i over n rows into r; the operands are read from the slots of its children, or with
+    // by_slot false from the slices of the buffer at their instruction index
+    static void execute(const std::vector<instruction>& code, int i, int row, int n, T* r, const T* buffer, bool by_slot)
+    {
+        auto& instr = code[i];
+        SYMBOLIC_AMP_COUNT_NODES(instr.opcode, n);
+        switch (instr.opcode)
+        {
+        case VARIABLE:
+            simd::scale(r, instr.data + row, instr.weight, n);
+            break;
+        case CONSTANT:
+            simd::fill(r, instr.value, n);
+            break;
+        default:
+        {
+            const T* local[max_local_arity];
+            std::vector<const T*> heap;
+            auto args = instr.arity <= max_local_arity ? local : (heap.resize(instr.arity), heap.data());
+            operators::for_each_child(code, i, [&](int k, int c) { args[k] = buffer + (by_slot ? code[c].slot : c) * block_size; });
+            operators::apply(instr.opcode, r, args, instr.arity, n);
+            break;
+        }
+        }
+    }
+
+    // operators with more children than this gather their operands on the heap
+    static constexpr int max_local_arity = 8;
 };
 
+typedef basic_interpreter<double> interpreter;
+typedef basic_interpreter<float> float_interpreter;
+typedef basic_interpreter<float, double> mixed_interpreter;
@@ -0,0 +1,360 @@
+#include "jit.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SYMBOLIC_AMP_JIT_X64 1
+#else
+#define SYMBOLIC_AMP_JIT_X64 0
+#endif
+
+namespace
+{
+    enum gpr { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10 };
+
+    // memory operand [base + index * scale + disp], or [rip + disp] into the constant pool
+    struct operand
+    {
+        int base;
+        int index;   // -1 if none
+        int scale;
+        int32_t disp;
+        int pool;    // constant pool entry for rip-relative operands, -1 otherwise
+    };
+
+    operand at(int base, int32_t disp = 0) { return { base, -1, 1, disp, -1 }; }
+    operand at(int base, int index, int scale) { return { base, index, scale, 0, -1 }; }
+    operand constant(int entry) { return { -1, -1, 1, 0, entry }; }
+
+    // just enough of an x86-64 encoder for the generated loops
+    class assembler
+    {
+    public:
+        vector<uint8_t> bytes;
+
+        void emit(initializer_list<uint8_t> b) { bytes.insert(bytes.end(), b); }
+        void emit32(uint32_t v)
+        {
+            for (int i = 0; i < 4; ++i)
+                bytes.push_back(static_cast<uint8_t>(v >> (8 * i)));
+        }
+        size_t position() const { return bytes.size(); }
+
+        // rex prefix plus opcode for a 64-bit general purpose instruction with a memory operand
+        void gpr_mem(uint8_t opcode, int reg, const operand& m)
+        {
+            bytes.push_back(static_cast<uint8_t>(0x48 | ((reg >> 3) << 2) | (m.index >= 0 ? (m.index >> 3) << 1 : 0) | (m.base >= 0 ? m.base >> 3 : 0)));
+            bytes.push_back(opcode);
+            modrm(reg, m);
+        }
+
+        // opcode r/m64, r64 with both operands in registers
+        void gpr_reg(uint8_t opcode, int reg, int rm)
+        {
+            emit({ static_cast<uint8_t>(0x48 | ((reg >> 3) << 2) | (rm >> 3)), opcode, static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)) });
+        }
+
+        // vex-encoded instruction: map 1 = 0f, 2 = 0f38; pp 1 = 66, 2 = f3, 3 = f2; l selects 256-bit vectors
+        void vex(int map, int pp, int l, uint8_t opcode, int reg, int vvvv, const operand& m)
+        {
+            vex_prefix(map, pp, l, reg >> 3, m.index >= 0 ? m.index >> 3 : 0, m.base >= 0 ? m.base >> 3 : 0, vvvv);
+            bytes.push_back(opcode);
+            modrm(reg, m);
+        }
+
+        void vex(int map, int pp, int l, uint8_t opcode, int reg, int vvvv, int rm)
+        {
+            vex_prefix(map, pp, l, reg >> 3, 0, rm >> 3, vvvv);
+            bytes.push_back(opcode);
+            bytes.push_back(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+        }
+
+        // rel32 jump with the target patched later
+        size_t jump(initializer_list<uint8_t> opcode)
+        {
+            emit(opcode);
+            auto at = position();
+            emit32(0);
+            return at;
+        }
+
+        void patch(size_t at, size_t target)
+        {
+            auto rel = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+            memcpy(bytes.data() + at, &rel, 4);
+        }
+
+        // (position of the rip displacement, constant pool entry)
+        vector<pair<size_t, int>> fixups;
+
+    private:
+        void vex_prefix(int map, int pp, int l, int r, int x, int b, int vvvv)
+        {
+            bytes.push_back(0xC4);
+            bytes.push_back(static_cast<uint8_t>(((~r & 1) << 7) | ((~x & 1) << 6) | ((~b & 1) << 5) | map));
+            bytes.push_back(static_cast<uint8_t>(((~vvvv & 0xF) << 3) | (l << 2) | pp));
+        }
+
+        void modrm(int reg, const operand& m)
+        {
+            if (m.pool >= 0)
+            {
+                bytes.push_back(static_cast<uint8_t>(((reg & 7) << 3) | 5));
+                fixups.push_back({ position(), m.pool });
+                emit32(0);
+                return;
+            }
+            auto sib = m.index >= 0 || (m.base & 7) == RSP;
+            int mod = m.disp == 0 && (m.base & 7) != RBP ? 0 : (m.disp >= -128 && m.disp <= 127 ? 1 : 2);
+            bytes.push_back(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (sib ? 4 : (m.base & 7))));
+            if (sib)
+            {
+                int ss = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+                bytes.push_back(static_cast<uint8_t>((ss << 6) | ((m.index >= 0 ? m.index & 7 : 4) << 3) | (m.base & 7)));
+            }
+            if (mod == 1)
+                bytes.push_back(static_cast<uint8_t>(static_cast<int8_t>(m.disp)));
+            else if (mod == 2)
+                emit32(static_cast<uint32_t>(m.disp));
+        }
+    };
+
+    const int PACKED = 1;  // pp = 66: vaddpd and friends
+    const int SCALAR = 3;  // pp = f2: vaddsd and friends
+
+    // the body of the row loop for one vector (l = 1, four rows) or one row (l = 0). the postfix evaluation
+    // stack is kept in registers: a leaf pushes ymm[depth], an operator folds the top two entries into one
+    void emit_body(assembler& a, const vector<instruction>& code, vector<double>& pool, int l)
+    {
+        auto pp = l ? PACKED : SCALAR;
+        auto entry = [&](double v) {
+            for (int i = 0; i < 4; ++i)
+                pool.push_back(v);
+            return static_cast<int>(pool.size() / 4 - 1);
+        };
+
+        // r9 = start + i, the dataset row of the first lane
+        a.gpr_mem(0x8D, R9, at(RSI, R8, 1));
+        int depth = 0;
+        for (auto& instr : code)
+        {
+            switch (instr.opcode)
+            {
+            case VARIABLE:
+                // rax = columns[variable]; ymm = rax[r9 ...]; ymm *= weight
+                a.gpr_mem(0x8B, RAX, at(RDI, instr.variable * 8));
+                a.vex(1, pp, l, 0x10, depth, 0, at(RAX, R9, 8));
+                if (instr.weight != 1)
+                    a.vex(1, pp, l, 0x59, depth, depth, constant(entry(instr.weight)));
+                ++depth;
+                break;
+            case CONSTANT:
+                a.vex(1, pp, l, 0x10, depth, 0, constant(entry(instr.value)));
+                ++depth;
+                break;
+            default:
+            {
+                static const uint8_t opcodes[] = { 0x58, 0x5C, 0x59, 0x5E }; // add, sub, mul, div
+                --depth;
+                a.vex(1, pp, l, opcodes[instr.opcode], depth - 1, depth - 1, depth);
+                break;
+            }
+            }
+        }
+        // result[i ...] = ymm0
+        a.vex(1, pp, l, 0x11, 0, 0, at(RCX, R8, 8));
+    }
+}
+
+int jit_compiler::registers(const vector<instruction>& code)
+{
+    int depth = 0, max_depth = 0;
+    for (auto& instr : code)
+    {
+        depth += 1 - instr.arity;
+        max_depth = max(max_depth, depth);
+    }
+    return max_depth;
+}
+
+bool jit_compiler::supported()
+{
+#if SYMBOLIC_AMP_JIT_X64
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    auto osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+#else
+    return false;
+#endif
+}
+
+shared_ptr<jit_program> jit_compiler::compile(const vector<instruction>& code)
+{
+    if (code.empty() || !supported() || registers(code) > 16)
+        return nullptr;
+    for (auto& instr : code)
+    {
+        auto leaf = (instr.opcode == VARIABLE || instr.opcode == CONSTANT) && instr.arity == 0;
+        auto binary = (instr.opcode == ADD || instr.opcode == SUB || instr.opcode == MUL || instr.opcode == DIV) && instr.arity == 2;
+        if (!leaf && !binary)
+            return nullptr;
+    }
+
+    // void f(const double* const* columns = rdi, int64_t start = rsi, int64_t count = rdx, double* result = rcx)
+    assembler a;
+    vector<double> pool;
+#if defined(_WIN32)
+    // windows passes the arguments in rcx, rdx, r8, r9, and rdi, rsi and xmm6-xmm15 are callee-saved
+    a.emit({ 0x57, 0x56 });                   // push rdi; push rsi
+    a.emit({ 0x48, 0x81, 0xEC }); a.emit32(168); // sub rsp, 168
+    for (int i = 6; i < 16; ++i)
+        a.vex(1, 2, 0, 0x7F, i, 0, at(RSP, (i - 6) * 16)); // vmovdqu [rsp + 16 * (i - 6)], xmm_i
+    a.gpr_reg(0x89, RCX, RDI);                // mov rdi, rcx
+    a.gpr_reg(0x89, RDX, RSI);                // mov rsi, rdx
+    a.gpr_reg(0x89, R8, RDX);                 // mov rdx, r8
+    a.gpr_reg(0x89, R9, RCX);                 // mov rcx, r9
+#endif
+    a.gpr_reg(0x31, R8, R8);                  // xor r8, r8 (row counter)
+
+    // four rows at a time while i + 4 <= count
+    auto vector_loop = a.position();
+    a.gpr_mem(0x8D, R10, at(R8, 4));          // lea r10, [r8 + 4]
+    a.gpr_reg(0x39, RDX, R10);                // cmp r10, rdx
+    auto to_tail = a.jump({ 0x0F, 0x8F });    // jg tail
+    emit_body(a, code, pool, 1);
+    a.emit({ 0x49, 0x83, 0xC0, 0x04 });       // add r8, 4
+    a.patch(a.jump({ 0xE9 }), vector_loop);
+
+    // one row at a time for the rest
+    auto tail = a.position();
+    a.patch(to_tail, tail);
+    a.gpr_reg(0x39, RDX, R8);                 // cmp r8, rdx
+    auto to_done = a.jump({ 0x0F, 0x8D });    // jge done
+    emit_body(a, code, pool, 0);
+    a.emit({ 0x49, 0x83, 0xC0, 0x01 });       // add r8, 1
+    a.patch(a.jump({ 0xE9 }), tail);
+
+    a.patch(to_done, a.position());
+    a.emit({ 0xC5, 0xF8, 0x77 });             // vzeroupper
+#if defined(_WIN32)
+    for (int i = 6; i < 16; ++i)
+        a.vex(1, 2, 0, 0x6F, i, 0, at(RSP, (i - 6) * 16)); // vmovdqu xmm_i, [rsp + 16 * (i - 6)]
+    a.emit({ 0x48, 0x81, 0xC4 }); a.emit32(168); // add rsp, 168
+    a.emit({ 0x5E, 0x5F });                   // pop rsi; pop rdi
+#endif
+    a.emit({ 0xC3 });                         // ret
+
+    // constant pool, 32-byte aligned after the code
+    while (a.bytes.size() % 32 != 0)
+        a.emit({ 0xCC });
+    auto pool_start = a.position();
+    a.bytes.resize(pool_start + pool.size() * sizeof(double));
+    if (!pool.empty())
+        memcpy(a.bytes.data() + pool_start, pool.data(), pool.size() * sizeof(double));
+    for (auto& f : a.fixups)
+        a.patch(f.first, pool_start + f.second * 4 * sizeof(double));
+
+    vector<instruction> signature(code);
+    for (auto& instr : signature)
+        instr.data = nullptr;
+    return make_shared<jit_program>(a.bytes, std::move(signature));
+}
+
+jit_program::jit_program(const vector<uint8_t>& code, vector<instruction> source)
+    : function(nullptr), memory(nullptr), size(code.size()), signature(std::move(source))
+{
+#if defined(_WIN32)
+    memory = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (memory == nullptr)
+        throw runtime_error("cannot allocate memory for generated code");
+    memcpy(memory, code.data(), size);
+    DWORD old;
+    if (!VirtualProtect(memory, size, PAGE_EXECUTE_READ, &old))
+    {
+        VirtualFree(memory, 0, MEM_RELEASE);
+        throw runtime_error("cannot make generated code executable");
+    }
+    FlushInstructionCache(GetCurrentProcess(), memory, size);
+#else
+    auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        throw runtime_error("cannot allocate memory for generated code");
+    memory = p;
+    memcpy(memory, code.data(), size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, size);
+        throw runtime_error("cannot make generated code executable");
+    }
+#endif
+    function = reinterpret_cast<function_type>(memory);
+}
+
+jit_program::~jit_program()
+{
+#if defined(_WIN32)
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+
+uint64_t jit_cache::hash(const vector<instruction>& code)
+{
+    // fnv-1a over the fields the generated code depends on
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](const void* p, size_t n) {
+        auto b = static_cast<const uint8_t*>(p);
+        for (size_t i = 0; i < n; ++i)
+        {
+            h ^= b[i];
+            h *= 1099511628211ull;
+        }
+    };
+    for (auto& instr : code)
+    {
+        mix(&instr.opcode, sizeof(instr.opcode));
+        mix(&instr.arity, sizeof(instr.arity));
+        mix(&instr.variable, sizeof(instr.variable));
+        mix(&instr.value, sizeof(instr.value));
+        mix(&instr.weight, sizeof(instr.weight));
+    }
+    return h;
+}
+
+bool jit_cache::equal(const vector<instruction>& a, const vector<instruction>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        auto& x = a[i];
+        auto& y = b[i];
+        if (x.opcode != y.opcode || x.arity != y.arity || x.variable != y.variable
+            || memcmp(&x.value, &y.value, sizeof(double)) != 0 || memcmp(&x.weight, &y.weight, sizeof(double)) != 0)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "interpreter.h"
+
+// native code for a compiled tree program: x86-64 with AVX2, generated in-process without an external compiler.
+// intermediates live in ymm registers (the postfix evaluation stack maps to ymm0..ymm15), constants and weights
+// are embedded in a pool after the code, and the row loop handles four rows at a time plus a scalar tail.
+// the code reads the dataset through a table of column pointers, so it does not depend on where the data lives
+class jit_program
+{
+public:
+    typedef void(*function_type)(const double* const* columns, int64_t start, int64_t count, double* result);
+
+    jit_program(const std::vector<uint8_t>& code, std::vector<instruction> signature);
+    ~jit_program();
+
+    jit_program(const jit_program&) = delete;
+    jit_program& operator=(const jit_program&) = delete;
+
+    // values of rows [start, start + count); columns[i] is the start of dataset column i
+    void evaluate(const double* const* columns, int start, int count, double* result) const
+    {
+        function(columns, start, count, result);
+    }
+
+    void evaluate(const dataset& data, int start, int count, double* result) const
+    {
+        std::vector<const double*> columns(data.cols());
+        for (int i = 0; i < data.cols(); ++i)
+            columns[i] = data.column(i);
+        evaluate(columns.data(), start, count, result);
+    }
+
+    std::size_t code_size() const { return size; }
+    // the instructions the program was generated from (without data pointers)
+    const std::vector<instruction>& source() const { return signature; }
+
+private:
+    function_type function;
+    void* memory;
+    std::size_t size;
+    std::vector<instruction> signature;
+};
+
+class jit_compiler
+{
+public:
+    // true on x86-64 when the cpu and the operating system support AVX2
+    static bool supported();
+
+    // returns null if the program cannot be compiled (unsupported platform or opcode, or it needs more than
+    // 16 registers); the caller then falls back to the interpreter
+    static std::shared_ptr<jit_program> compile(const std::vector<instruction>& code);
+
+    // register pressure of a program: the maximum depth of its postfix evaluation stack
+    static int registers(const std::vector<instruction>& code);
+};
+
+// compiled programs keyed by their content (opcodes, columns, constants and weights), so the same tree is only
+// compiled once however often it is evaluated, e.g. during constant tuning. safe to share between threads
+class jit_cache
+{
+public:
+    // capacity is the number of programs kept, the least recently used are evicted first
+    explicit jit_cache(std::size_t capacity = 1 << 12) : limit(std::max<std::size_t>(capacity, 1)), nhits(0), nmisses(0) {}
+
+    jit_cache(const jit_cache&) = delete;
+    jit_cache& operator=(const jit_cache&) = delete;
+
+    std::shared_ptr<jit_program> get(const std::vector<instruction>& code)
+    {
+        auto key = hash(code);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (auto program = find(key, code))
+            {
+                ++nhits;
+                SYMBOLIC_AMP_COUNT(jit_cache_hits, 1);
+                return program;
+            }
+        }
+        auto program = jit_compiler::compile(code);
+        if (!program)
+            return nullptr;
+        std::lock_guard<std::mutex> lock(mutex);
+        ++nmisses;
+        SYMBOLIC_AMP_COUNT(jit_cache_misses, 1);
+        // another thread may have compiled the same program meanwhile
+        if (auto existing = find(key, code))
+            return existing;
+        recent.push_front(entry{ key, program });
+        programs.emplace(key, recent.begin());
+        while (recent.size() > limit)
+        {
+            auto range = programs.equal_range(recent.back().key);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                if (it->second == std::prev(recent.end()))
+                {
+                    programs.erase(it);
+                    break;
+                }
+            }
+            recent.pop_back();
+        }
+        return program;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        programs.clear();
+        recent.clear();
+    }
+
+    std::size_t capacity() const { return limit; }
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return recent.size();
+    }
+    std::size_t hits() const { return nhits; }
+    std::size_t misses() const { return nmisses; }
+
+    static uint64_t hash(const std::vector<instruction>& code);
+    static bool equal(const std::vector<instruction>& a, const std::vector<instruction>& b);
+
+private:
+    struct entry
+    {
+        uint64_t key;
+        std::shared_ptr<jit_program> program;
+    };
+
+    // the program of the code, marked as recently used, or null. the caller holds the lock
+    std::shared_ptr<jit_program> find(uint64_t key, const std::vector<instruction>& code)
+    {
+        auto range = programs.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (equal(it->second->program->source(), code))
+            {
+                recent.splice(recent.begin(), recent, it->second);
+                return it->second->program;
+            }
+        }
+        return nullptr;
+    }
+
+    std::size_t limit;
+    std::list<entry> recent;  // most recently used first
+    std::unordered_multimap<uint64_t, std::list<entry>::iterator> programs;
+    std::atomic<std::size_t> nhits;
+    std::atomic<std::size_t> nmisses;
+    mutable std::mutex mutex;
+};
@@ -0,0 +1,186 @@
+#include "linear_tree.h"
+#include "symbol_table.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+// splitmix64 finalizer
+static uint64_t Mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+static uint64_t Combine(uint64_t seed, uint64_t h)
+{
+    return Mix(seed ^ (h + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)));
+}
+
+static uint64_t Bits(double v)
+{
+    uint64_t b;
+    memcpy(&b, &v, sizeof(b));
+    return b;
+}
+
+static void Flatten(node* n, vector<linear_node>& nodes)
+{
+    auto start = nodes.size();
+    for (auto s : n->Subtrees())
+        Flatten(s, nodes);
+
+    linear_node ln;
+    ln.opcode = n->GetOpCode();
+    ln.arity = n->SubtreeCount();
+    ln.length = static_cast<int>(nodes.size() - start) + 1;
+    ln.variable = n->GetVariable();
+    ln.value = n->GetValue();
+    ln.weight = n->GetWeight();
+    nodes.push_back(ln);
+}
+
+linear_tree linear_tree::FromNode(node* root)
+{
+    vector<linear_node> nodes;
+    nodes.reserve(root->GetLength());
+    Flatten(root, nodes);
+    return linear_tree(std::move(nodes));
+}
+
+node* linear_tree::ToNode(node_arena* arena) const
+{
+    vector<node*> stack;
+    for (auto& ln : nodes_)
+    {
+        node* n;
+        switch (ln.opcode)
+        {
+        case VARIABLE:
+            n = node::variable(ln.variable, ln.weight, arena);
+            break;
+        case CONSTANT:
+            n = node::constant(ln.value, arena);
+            break;
+        default:
+            n = node::Create(ln.opcode, arena);
+            n->SetValue(ln.value);
+            n->SetWeight(ln.weight);
+            break;
+        }
+        // the children are the topmost arity elements of the stack, in left-to-right order
+        auto first = stack.end() - ln.arity;
+        for (auto it = first; it != stack.end(); ++it)
+            n->AddSubtree(*it);
+        stack.erase(first, stack.end());
+        stack.push_back(n);
+    }
+    return stack.empty() ? nullptr : stack.back();
+}
+
+int linear_tree::GetDepth(int i) const
+{
+    // one pass over the subtree range with a stack of child depths
+    vector<int> depths;
+    for (int k = SubtreeStart(i); k <= i; ++k)
+    {
+        auto arity = nodes_[k].arity;
+        int depth = 0;
+        for (int c = 0; c < arity; ++c)
+        {
+            depth = max(depth, depths.back());
+            depths.pop_back();
+        }
+        depths.push_back(depth + 1);
+    }
+    return depths.back();
+}
+
+int linear_tree::Parent(int i) const
+{
+    // the parent is the closest following node whose range contains i
+    auto start = SubtreeStart(i);
+    for (int k = i + 1; k < static_cast<int>(nodes_.size()); ++k)
+    {
+        if (SubtreeStart(k) <= start)
+            return k;
+    }
+    return -1;
+}
+
+vector<int> linear_tree::Children(int i) const
+{
+    vector<int> children(nodes_[i].arity);
+    int c = i - 1;
+    for (int k = nodes_[i].arity - 1; k >= 0; --k)
+    {
+        children[k] = c;
+        c -= nodes_[c].length;
+    }
+    return children;
+}
+
+int linear_tree::ReplaceSubtree(int i, const linear_tree& donor, int j)
+{
+    if (&donor == this)
+    {
+        auto copy = Subtree(j);
+        return ReplaceSubtree(i, copy, copy.Root());
+    }
+
+    auto start = SubtreeStart(i);
+    auto old_length = nodes_[i].length;
+    auto new_length = donor.nodes_[j].length;
+    auto delta = new_length - old_length;
+
+    // every node after i whose range covers the start of the replaced subtree is an ancestor
+    for (int k = i + 1; k < static_cast<int>(nodes_.size()); ++k)
+    {
+        if (SubtreeStart(k) <= start)
+            nodes_[k].length += delta;
+    }
+
+    auto first = donor.nodes_.begin() + donor.SubtreeStart(j);
+    auto last = donor.nodes_.begin() + j + 1;
+    if (delta == 0)
+    {
+        copy(first, last, nodes_.begin() + start);
+    }
+    else
+    {
+        auto pos = nodes_.erase(nodes_.begin() + start, nodes_.begin() + i + 1);
+        nodes_.insert(pos, first, last);
+    }
+    return start + new_length - 1;
+}
+
+linear_tree linear_tree::Subtree(int i) const
+{
+    return linear_tree(vector<linear_node>(nodes_.begin() + SubtreeStart(i), nodes_.begin() + i + 1));
+}
+
+vector<uint64_t> linear_tree::Hashes() const
+{
+    vector<uint64_t> hashes(nodes_.size());
+    for (size_t i = 0; i < nodes_.size(); ++i)
+    {
+        auto& n = nodes_[i];
+        auto h = Mix((static_cast<uint64_t>(n.opcode) << 32) | static_cast<uint32_t>(n.arity));
+        if (n.opcode == VARIABLE)
+            h = Combine(Combine(h, static_cast<uint64_t>(n.variable)), Bits(n.weight));
+        else if (n.opcode == CONSTANT)
+            h = Combine(h, Bits(n.value));
+        // children are visited right to left, so the last one mixed in is the leftmost
+        int c = static_cast<int>(i) - 1;
+        for (int k = 0; k < n.arity; ++k)
+        {
+            h = Combine(h, hashes[c]);
+            c -= nodes_[c].length;
+        }
+        hashes[i] = h;
+    }
+    return hashes;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "node.h"
+
+// compact, trivially copyable tree node. a linear tree stores these in postfix order,
+// so the children of a node always precede it and every subtree is a contiguous range
+struct linear_node
+{
+    op_code opcode;
+    int      arity;
+    int     length;   // length of the subtree rooted at this node, including the node itself
+    int   variable;   // symbol id of the variable name (VARIABLE nodes only), -1 otherwise
+    double   value;
+    double  weight;
+};
+
+class linear_tree
+{
+private:
+    std::vector<linear_node> nodes_;
+
+public:
+    linear_tree() {}
+    explicit linear_tree(std::vector<linear_node> nodes) : nodes_(std::move(nodes)) {}
+
+    // conversion from and to the pointer-based representation
+    static linear_tree FromNode(node* root);
+    node* ToNode(node_arena* arena = nullptr) const;
+
+    linear_tree Clone() const { return *this; }
+
+    std::vector<linear_node> const & Nodes() const { return nodes_; }
+    linear_node& operator[](int i) { return nodes_[i]; }
+    linear_node const & operator[](int i) const { return nodes_[i]; }
+
+    // the root is the last node in postfix order
+    int Root() const { return static_cast<int>(nodes_.size()) - 1; }
+    int GetLength() const { return static_cast<int>(nodes_.size()); }
+    int GetDepth() const { return GetDepth(Root()); }
+    int GetDepth(int i) const;
+
+    // subtree rooted at i occupies the index range [SubtreeStart(i), i]
+    int SubtreeStart(int i) const { return i - nodes_[i].length + 1; }
+    // index of the parent of node i, or -1 for the root
+    int Parent(int i) const;
+    // indices of the children of node i, in left-to-right order
+    std::vector<int> Children(int i) const;
+
+    // replaces the subtree rooted at i with a copy of the donor subtree rooted at j,
+    // and updates the cached lengths of all the ancestors of i. returns the new index of the spliced root
+    int ReplaceSubtree(int i, const linear_tree& donor, int j);
+    // extracts a copy of the subtree rooted at i
+    linear_tree Subtree(int i) const;
+
+    // merkle-style structural hash of every subtree: the hash of a node combines its opcode, variable,
+    // weight and value with the hashes of its children in order, so equal subtrees hash equally in any tree
+    std::vector<uint64_t> Hashes() const;
+};
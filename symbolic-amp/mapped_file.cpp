@@ -0,0 +1,122 @@
+#include "mapped_file.h"
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#if defined(_WIN32)
+
+mapped_file::mapped_file(const string& path, mode m, size_t size)
+    : path_(path), data_(nullptr), size_(0), file_(INVALID_HANDLE_VALUE), mapping_(nullptr)
+{
+    auto writable = m == mode::read_write;
+    file_ = CreateFileA(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr,
+        writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE)
+        throw runtime_error("cannot open " + path);
+
+    LARGE_INTEGER length;
+    if (writable)
+    {
+        length.QuadPart = static_cast<LONGLONG>(size);
+        if (!SetFilePointerEx(file_, length, nullptr, FILE_BEGIN) || !SetEndOfFile(file_))
+        {
+            CloseHandle(file_);
+            throw runtime_error("cannot resize " + path);
+        }
+    }
+    else if (!GetFileSizeEx(file_, &length))
+    {
+        CloseHandle(file_);
+        throw runtime_error("cannot read the size of " + path);
+    }
+    size_ = static_cast<size_t>(length.QuadPart);
+    if (size_ == 0)
+        return;
+
+    DWORD protect = m == mode::read_only ? PAGE_READONLY : m == mode::copy_on_write ? PAGE_WRITECOPY : PAGE_READWRITE;
+    DWORD access = m == mode::read_only ? FILE_MAP_READ : m == mode::copy_on_write ? FILE_MAP_COPY : FILE_MAP_WRITE;
+    mapping_ = CreateFileMappingA(file_, nullptr, protect, 0, 0, nullptr);
+    if (mapping_ != nullptr)
+        data_ = static_cast<char*>(MapViewOfFile(mapping_, access, 0, 0, 0));
+    if (data_ == nullptr)
+    {
+        if (mapping_ != nullptr)
+            CloseHandle(mapping_);
+        CloseHandle(file_);
+        throw runtime_error("cannot map " + path);
+    }
+}
+
+mapped_file::~mapped_file()
+{
+    if (data_ != nullptr)
+        UnmapViewOfFile(data_);
+    if (mapping_ != nullptr)
+        CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE)
+        CloseHandle(file_);
+}
+
+#else
+
+mapped_file::mapped_file(const string& path, mode m, size_t size)
+    : path_(path), data_(nullptr), size_(0), fd_(-1)
+{
+    auto writable = m == mode::read_write;
+    fd_ = ::open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd_ < 0)
+        throw runtime_error("cannot open " + path);
+
+    if (writable)
+    {
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0)
+        {
+            ::close(fd_);
+            throw runtime_error("cannot resize " + path);
+        }
+        size_ = size;
+    }
+    else
+    {
+        struct stat st;
+        if (fstat(fd_, &st) != 0)
+        {
+            ::close(fd_);
+            throw runtime_error("cannot read the size of " + path);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+    }
+    if (size_ == 0)
+        return;
+
+    int protect = m == mode::read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    int flags = m == mode::copy_on_write ? MAP_PRIVATE : MAP_SHARED;
+    auto p = mmap(nullptr, size_, protect, flags, fd_, 0);
+    if (p == MAP_FAILED)
+    {
+        ::close(fd_);
+        throw runtime_error("cannot map " + path);
+    }
+    data_ = static_cast<char*>(p);
+}
+
+mapped_file::~mapped_file()
+{
+    if (data_ != nullptr)
+        munmap(data_, size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// memory mapping of a whole file (mmap on posix, MapViewOfFile on windows)
+class mapped_file
+{
+public:
+    enum class mode
+    {
+        read_only,      // shared read-only view
+        copy_on_write,  // private view: writes are allowed but never reach the file
+        read_write      // shared writable view; the file is created or resized to the requested size
+    };
+
+    mapped_file(const std::string& path, mode m = mode::read_only, std::size_t size = 0);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+    char* data_;
+    std::size_t size_;
+#if defined(_WIN32)
+    void* file_;
+    void* mapping_;
+#else
+    int fd_;
+#endif
+};
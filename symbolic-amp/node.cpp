@@ -1,6 +1,7 @@
 #include "node.h"
 #include <numeric>
 #include <algorithm>
+#include <atomic>
 #include "dataset.h"
 
 using namespace std;
@@ -8,48 +9,89 @@ using namespace std;
 node::~node()
 {
     for (auto s : subtrees_)
-        delete s;
+    {
+        if (!s->pooled_)
+            delete s;
+    }
+}
+
+node* node::Create(op_code opcode, node_arena* arena)
+{
+    if (arena == nullptr)
+        return new node(opcode, nullptr);
+    return new (arena->allocate(sizeof(node), alignof(node))) node(opcode, arena);
+}
+
+int node::OpSymbol(op_code opcode)
+{
+    // interned once, so creating an operator node never takes the symbol table lock
+    static const int symbols[] = {
+        symbol_table::intern("+"), symbol_table::intern("-"), symbol_table::intern("*"), symbol_table::intern("/"),
+        symbol_table::intern("!"), symbol_table::intern("exp"), symbol_table::intern("log"), symbol_table::intern("sin"),
+        symbol_table::intern("cos"), symbol_table::intern("sqrt"), symbol_table::intern("square"), symbol_table::intern("pow"),
+        symbol_table::intern("tanh"), symbol_table::intern("aq"), symbol_table::intern("C"), symbol_table::intern("")
+    };
+    return symbols[opcode];
+}
+
+uint64_t node::NextStamp()
+{
+    // every thread takes its stamps from a block of its own, so building and editing trees on many threads does
+    // not contend on the shared counter. stamps stay unique, they are just not in creation order across threads
+    constexpr uint64_t block = 4096;
+    static std::atomic<uint64_t> blocks(0);
+    thread_local uint64_t next = 0, end = 0;
+    if (next == end)
+    {
+        next = blocks.fetch_add(block, std::memory_order_relaxed) + 1;
+        end = next + block;
+    }
+    return next++;
 }
 
 // deep cloning
-node* node::Clone() const
+node* node::Clone(node_arena* arena) const
 {
-    auto n = new node(*this);
+    auto n = Create(opcode_, arena);
+    n->symbol_ = symbol_;
+    n->value_ = value_;
+    n->weight_ = weight_;
+    n->subtrees_.reserve(subtrees_.size());
     for (auto s : subtrees_)
-        n->AddSubtree(s->Clone());
+        n->AddSubtree(s->Clone(arena));
     return n;
 }
 
-static void Grow(random *rnd, node* n, std::unordered_map<std::string, std::vector<double>>& data, int depth, int max_depth)
+static void Grow(rng *rnd, node* n, const dataset& data, int depth, int max_depth, node_arena* arena)
 {
     for (int i = 0; i < 2; ++i)
     {
         auto op = depth < max_depth ? (rnd->next_double() > 0.5 ? static_cast<op_code>(rnd->next(DIV)) : VARIABLE) : VARIABLE;
-        auto subtree = new node(op, "");
+        node* subtree;
 
         if (op == VARIABLE)
         {
-            auto random_it = std::next(std::begin(data), rnd->next(0, static_cast<int>(data.size() - 1u))); // reserve one for the target
-            subtree->SetName(random_it->first);
-            subtree->SetWeight(rnd->next_double(-5, +5));
+            auto column = rnd->next(0, data.cols() - 1);
+            subtree = node::variable(data.symbol(column), rnd->next_double(-5, +5), arena);
         }
         else if (op == CONSTANT)
         {
-            subtree->SetValue(rnd->next_double(-5, +5));
+            subtree = node::constant(rnd->next_double(-5, +5), arena);
         }
         else
         {
-            Grow(rnd, subtree, data, depth + 1, max_depth);
+            subtree = node::Create(op, arena);
+            Grow(rnd, subtree, data, depth + 1, max_depth, arena);
         }
         n->AddSubtree(subtree);
     }
 }
 
-node* node::Random(random *rnd, std::unordered_map<std::string, std::vector<double>>& data, int max_depth)
+node* node::Random(rng *rnd, const dataset& data, int max_depth, node_arena* arena)
 {
     auto op = static_cast<op_code>(rnd->next(DIV));
-    auto root = new node(op, "");
-    Grow(rnd, root, data, 2, max_depth);
+    auto root = Create(op, arena);
+    Grow(rnd, root, data, 2, max_depth, arena);
     return root;
 }
 
@@ -70,10 +112,31 @@ int node::GetDepth()
     return depth_;
 }
 
+void node::Invalidate()
+{
+    // the cached length and depth of every ancestor depend on this subtree, and so do their stamps
+    auto stamp = NextStamp();
+    for (auto n = this; n != nullptr; n = n->parent_)
+    {
+        n->length_ = 0;
+        n->depth_ = 0;
+        n->stamp_ = stamp;
+    }
+}
+
+void node::Touch()
+{
+    // one stamp serves the whole path: no other node can have it
+    auto stamp = NextStamp();
+    for (auto n = this; n != nullptr; n = n->parent_)
+        n->stamp_ = stamp;
+}
+
 void node::AddSubtree(node* s)
 {
     subtrees_.push_back(s);
     s->SetParent(this);
+    Invalidate();
 }
 
 void node::InsertSubtree(node* s, int index)
@@ -81,12 +144,25 @@ void node::InsertSubtree(node* s, int index)
     auto it = begin(subtrees_) + index;
     subtrees_.insert(it, s);
     s->SetParent(this);
+    Invalidate();
 }
 
 void node::RemoveSubtree(node* s)
 {
-    remove(begin(subtrees_), end(subtrees_), s);
+    subtrees_.erase(remove(begin(subtrees_), end(subtrees_), s), end(subtrees_));
     s->SetParent(nullptr); // set the parent to null
+    Invalidate();
+}
+
+void node::ReplaceSubtree(node* s, node* replacement)
+{
+    auto i = IndexOfSubtree(s);
+    if (i < 0)
+        return;
+    subtrees_[i] = replacement;
+    s->SetParent(nullptr);
+    replacement->SetParent(this);
+    Invalidate();
 }
 
 int node::IndexOfSubtree(node* s) const
@@ -2,67 +2,73 @@
 #define NODE_H
 
 #include <vector>
+#include <cstdint>
 #include <stack>
 #include <sstream>
-#include <unordered_map>
+#include <memory_resource>
 #include "random.h"
+#include "symbol_table.h"
+#include "node_arena.h"
 
-class dataset;
+template<typename T> class basic_dataset;
+typedef basic_dataset<double> dataset;
 
-enum op_code { ADD, SUB, MUL, DIV, NEG, EXP, LOG, CONSTANT, VARIABLE };
+// ADD, SUB, MUL and DIV take any number of children (see operators.h), POW and AQ (the analytic quotient
+// a / sqrt(1 + b^2)) two, and the other functions one
+enum op_code { ADD, SUB, MUL, DIV, NEG, EXP, LOG, SIN, COS, SQRT, SQUARE, POW, TANH, AQ, CONSTANT, VARIABLE };
 
 class node
 {
 private:
     op_code opcode_;
-    std::string name_;
-    std::vector<node*> subtrees_;
+    int symbol_; // interned name: the operator symbol, or the variable name
+    std::pmr::vector<node*> subtrees_;
     node* parent_;
+    bool pooled_; // allocated in a node_arena
 
     int length_;
     int depth_;
+    uint64_t stamp_;
     double value_;
     double weight_;
 
+    static uint64_t NextStamp();
+
+    node(op_code opcode, node_arena* arena)
+        : opcode_(opcode), symbol_(OpSymbol(opcode)), subtrees_(arena ? arena->get_resource() : std::pmr::get_default_resource()), parent_(nullptr), pooled_(arena != nullptr), length_(0), depth_(0), stamp_(NextStamp()), value_(0), weight_(0)
+    {
+    }
+
 public:
     virtual ~node();
 
-    node(op_code opcode) : opcode_(opcode), parent_(nullptr)
+    node(op_code opcode) : node(opcode, nullptr)
     {
-        switch (opcode)
-        {
-        case ADD:
-            name_ = "+";
-            break;
-        case SUB:
-            name_ = "-";
-            break;
-        case DIV:
-            name_ = "/";
-            break;
-        case MUL:
-            name_ = "-";
-            break;
-        case EXP:
-            name_ = "exp";
-            break;
-        case LOG:
-            name_ = "log";
-            break;
-        }
     }
 
+    node(op_code opcode, const std::string& name, node* parent = nullptr) : node(opcode, nullptr)
+    {
+        if (!name.empty())
+            symbol_ = symbol_table::intern(name);
+        parent_ = parent;
+    }
 
-    node(op_code opcode, const std::string& name, node* parent = nullptr)
-        : opcode_(opcode), name_(name), parent_(parent), length_(0), depth_(0), value_(0), weight_(0)
+    node(const node& other) : node(other.opcode_, nullptr)
     {
+        symbol_ = other.symbol_;
+        value_ = other.value_;
+        weight_ = other.weight_;
     }
 
-    node(const node& other) : node(other.opcode_, other.name_, other.parent_) {}
+    // allocates a node in the arena, or on the heap if arena is null.
+    // a tree should live entirely in one arena: arena nodes are freed by node_arena::release, never by delete
+    static node* Create(op_code opcode, node_arena* arena = nullptr);
+    // interned default name of each operator
+    static int OpSymbol(op_code opcode);
 
-    node* Clone() const;
+    node* Clone(node_arena* arena = nullptr) const;
 
-    static node* Random(random* rnd, std::unordered_map<std::string, std::vector<double>>& data, int max_depth);
+    static node* Random(rng* rnd, const dataset& data, int max_depth, node_arena* arena = nullptr);
 
     virtual std::string ToString() const
     {
@@ -70,52 +76,82 @@ public:
         if (opcode_ == CONSTANT)
             ss << value_;
         else if (opcode_ == VARIABLE)
-            ss << weight_ << " " << name_;
+            ss << weight_ << " " << GetName();
         else
-            ss << name_;
+            ss << GetName();
         return ss.str();
     }
 
     node const * GetParent() const { return parent_; }
+    node* GetParent() { return parent_; }
     void SetParent(node* parent) { parent_ = parent; }
-    std::vector<node*> const & Subtrees() const { return subtrees_; }
+    std::pmr::vector<node*> const & Subtrees() const { return subtrees_; }
     int SubtreeCount() const { return static_cast<int>(subtrees_.size()); }
     op_code GetOpCode() const { return opcode_; }
 
-    const std::string& GetName() const { return name_; }
-    void SetName(const std::string& name) { name_ = name; }
+    const std::string& GetName() const { return symbol_table::name(symbol_); }
+    void SetName(const std::string& name) { symbol_ = symbol_table::intern(name); Touch(); }
+    int GetSymbol() const { return symbol_; }
+    // symbol of the variable name (VARIABLE nodes only), -1 otherwise
+    int GetVariable() const { return opcode_ == VARIABLE ? symbol_ : -1; }
+    void SetVariable(int symbol) { symbol_ = symbol; Touch(); }
+    bool IsPooled() const { return pooled_; }
     double GetValue() const { return value_; }
-    void SetValue(double value) { value_ = value; }
+    void SetValue(double value) { value_ = value; Touch(); }
     double GetWeight() const { return weight_; }
-    void SetWeight(double weight) { weight_ = weight; }
+    void SetWeight(double weight) { weight_ = weight; Touch(); }
     int GetLength();
     int GetDepth();
     void AddSubtree(node* s);
     void InsertSubtree(node *s, int index);
     void RemoveSubtree(node* s);
+    // puts replacement in the place of the subtree s, which is detached but not deleted
+    void ReplaceSubtree(node* s, node* replacement);
     int IndexOfSubtree(node *s) const;
+    // resets the cached length and depth of this node and all its ancestors (called by the structural edits above)
+    void Invalidate();
+
+    // identifies the current contents of the subtree rooted here: every edit of the subtree (the setters and the
+    // structural edits) gives it a new stamp, and stamps are never reused, not even by other nodes. a program
+    // compiled from a tree is valid for as long as its root keeps the same stamp
+    uint64_t GetStamp() const { return stamp_; }
+    // gives this node and all its ancestors a new stamp
+    void Touch();
 
     // traversal
     std::vector<node*> IteratePrefix();
     std::vector<node*> IterateBreadth();
 
-    static node* add() { return new node(ADD, "+"); }
-    static node* sub() { return new node(SUB, "-"); }
-    static node* mul() { return new node(MUL, "*"); }
-    static node* div() { return new node(DIV, "/"); }
-    static node* neg() { return new node(NEG, "!"); }
-    static node* exp() { return new node(EXP, "exp"); }
-    static node* log() { return new node(LOG, "log"); }
-    static node* constant(double value)
+    static node* add(node_arena* arena = nullptr) { return Create(ADD, arena); }
+    static node* sub(node_arena* arena = nullptr) { return Create(SUB, arena); }
+    static node* mul(node_arena* arena = nullptr) { return Create(MUL, arena); }
+    static node* div(node_arena* arena = nullptr) { return Create(DIV, arena); }
+    static node* neg(node_arena* arena = nullptr) { return Create(NEG, arena); }
+    static node* exp(node_arena* arena = nullptr) { return Create(EXP, arena); }
+    static node* log(node_arena* arena = nullptr) { return Create(LOG, arena); }
+    static node* sin(node_arena* arena = nullptr) { return Create(SIN, arena); }
+    static node* cos(node_arena* arena = nullptr) { return Create(COS, arena); }
+    static node* sqrt(node_arena* arena = nullptr) { return Create(SQRT, arena); }
+    static node* square(node_arena* arena = nullptr) { return Create(SQUARE, arena); }
+    static node* pow(node_arena* arena = nullptr) { return Create(POW, arena); }
+    static node* tanh(node_arena* arena = nullptr) { return Create(TANH, arena); }
+    static node* aq(node_arena* arena = nullptr) { return Create(AQ, arena); }
+    static node* constant(double value, node_arena* arena = nullptr)
     {
-        auto n = new node(CONSTANT, "C");
-        n->SetValue(value);
+        // a new node already has a stamp of its own, the setters would only draw another one
+        auto n = Create(CONSTANT, arena);
+        n->value_ = value;
         return n;
     }
-    static node* variable(const std::string& name, double weight = 1)
+    static node* variable(const std::string& name, double weight = 1, node_arena* arena = nullptr)
+    {
+        return variable(symbol_table::intern(name), weight, arena);
+    }
+    static node* variable(int symbol, double weight = 1, node_arena* arena = nullptr)
     {
-        auto v = new node(VARIABLE, name);
-        v->SetWeight(weight);
+        auto v = Create(VARIABLE, arena);
+        v->symbol_ = symbol;
+        v->weight_ = weight;
         return v;
     }
 };
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+// bump allocator for the nodes of a whole population or generation. nodes allocated here (and their subtree lists)
+// are never deleted one by one: release frees all of them at once, without walking the trees.
+// an arena is not thread safe; give each thread its own, so that tree generation and crossover never contend on the heap
+class node_arena
+{
+public:
+    explicit node_arena(std::size_t initial_size = 1 << 20) : resource(initial_size) {}
+
+    node_arena(const node_arena&) = delete;
+    node_arena& operator=(const node_arena&) = delete;
+
+    void* allocate(std::size_t bytes, std::size_t align) { return resource.allocate(bytes, align); }
+    std::pmr::memory_resource* get_resource() { return &resource; }
+
+    // invalidates every tree allocated in the arena
+    void release() { resource.release(); }
+
+private:
+    std::pmr::monotonic_buffer_resource resource;
+};
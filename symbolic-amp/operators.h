@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include "node.h"
+#include "simd_math.h"
+
+// semantics of the operators for any number of children, shared by the evaluators. ADD and MUL fold over all
+// children; SUB and DIV take the first child minus the sum (divided by the product) of the others, and with a
+// single child they are the negation and the reciprocal. POW and AQ are binary, the other functions unary
+namespace operators
+{
+    inline bool valid_arity(op_code opcode, int arity)
+    {
+        switch (opcode)
+        {
+        case ADD: case SUB: case MUL: case DIV:
+            return arity >= 1;
+        case POW: case AQ:
+            return arity == 2;
+        case CONSTANT: case VARIABLE:
+            return arity == 0;
+        default:
+            return arity == 1;
+        }
+    }
+
+    // throws if a node has the wrong number of children for its operator
+    inline void check_arity(op_code opcode, int arity)
+    {
+        if (!valid_arity(opcode, arity))
+            throw std::invalid_argument("the operator " + symbol_table::name(node::OpSymbol(opcode)) + " cannot take " + std::to_string(arity) + " arguments.");
+    }
+
+    // value of the operator for one row; args holds the values of the children in order
+    template<typename T>
+    T apply(op_code opcode, const T* args, int arity)
+    {
+        auto a = args[0];
+        switch (opcode)
+        {
+        case ADD: case MUL:
+        {
+            auto r = args[arity - 1];
+            for (int k = arity - 2; k >= 0; --k)
+                r = opcode == ADD ? args[k] + r : args[k] * r;
+            return r;
+        }
+        case SUB: case DIV:
+        {
+            if (arity == 1)
+                return opcode == SUB ? -a : T(1) / a;
+            auto r = args[arity - 1];
+            for (int k = arity - 2; k >= 1; --k)
+                r = opcode == SUB ? args[k] + r : args[k] * r;
+            return opcode == SUB ? a - r : a / r;
+        }
+        case NEG: return -a;
+        case EXP: return std::exp(a);
+        case LOG: return std::log(a);
+        case SIN: return std::sin(a);
+        case COS: return std::cos(a);
+        case SQRT: return std::sqrt(a);
+        case SQUARE: return a * a;
+        case POW: return std::pow(a, args[1]);
+        case TANH: return std::tanh(a);
+        case AQ: return a / std::sqrt(1 + args[1] * args[1]);
+        default: return T(0);
+        }
+    }
+
+    // same over n rows with the simd kernels: args points to the columns of the children in order. r may not be one
+    // of them, but the folds use it as the accumulator
+    template<typename T>
+    void apply(op_code opcode, T* r, const T* const* args, int arity, int n)
+    {
+        auto a = args[0];
+        switch (opcode)
+        {
+        case ADD: case MUL:
+        {
+            if (arity == 1)
+            {
+                std::copy(a, a + n, r);
+                break;
+            }
+            auto op = opcode == ADD ? simd::add<T> : simd::mul<T>;
+            op(r, args[arity - 2], args[arity - 1], n);
+            for (int k = arity - 3; k >= 0; --k)
+                op(r, args[k], r, n);
+            break;
+        }
+        case SUB: case DIV:
+        {
+            if (arity == 1)
+            {
+                if (opcode == SUB)
+                    simd::neg(r, a, n);
+                else
+                {
+                    simd::fill(r, T(1), n);
+                    simd::div(r, r, a, n);
+                }
+                break;
+            }
+            auto fold = opcode == SUB ? simd::add<T> : simd::mul<T>;
+            auto op = opcode == SUB ? simd::sub<T> : simd::div<T>;
+            if (arity == 2)
+            {
+                op(r, a, args[1], n);
+                break;
+            }
+            fold(r, args[arity - 2], args[arity - 1], n);
+            for (int k = arity - 3; k >= 1; --k)
+                fold(r, args[k], r, n);
+            op(r, a, r, n);
+            break;
+        }
+        case NEG: simd::neg(r, a, n); break;
+        case EXP: simd::exp(r, a, n); break;
+        case LOG: simd::log(r, a, n); break;
+        case SIN: simd::sin(r, a, n); break;
+        case COS: simd::cos(r, a, n); break;
+        case SQRT: simd::sqrt(r, a, n); break;
+        case SQUARE: simd::square(r, a, n); break;
+        case POW: simd::pow(r, a, args[1], n); break;
+        case TANH: simd::tanh(r, a, n); break;
+        case AQ: simd::aq(r, a, args[1], n); break;
+        default: break;
+        }
+    }
+
+    // the children of instruction i of a postfix program in order: the last one ends at i - 1
+    // and each one ends right before the start of the next
+    template<typename Instruction, typename F>
+    void for_each_child(const std::vector<Instruction>& code, int i, F f)
+    {
+        auto arity = code[i].arity;
+        for (int k = arity - 1, c = i - 1; k >= 0; --k)
+        {
+            f(k, c);
+            c -= code[c].length;
+        }
+    }
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "interpreter.h"
+#include "thread_pool.h"
+#include "program_cache.h"
+#include <vector>
+#include <string>
+
+// evaluates a whole population on a work-stealing thread pool. the work is split into (tree, row range) tasks,
+// so a few large trees cannot leave the other cores idle and populations smaller than the number of cores still scale.
+// T and Accumulator select the precision, as for basic_interpreter
+template<typename T, typename Accumulator = T>
+class basic_population_evaluator
+{
+public:
+    typedef basic_interpreter<T, Accumulator> interpreter;
+    typedef typename interpreter::instruction instruction;
+    typedef typename interpreter::dataset dataset;
+
+    // rows_per_task is rounded up to a multiple of the interpreter block size
+    explicit basic_population_evaluator(int nthreads = 0, int rows_per_task = 16 * interpreter::block_size)
+        : pool(nthreads), cache(nullptr), programs_cache(nullptr), chunk_size(std::max(1, (rows_per_task + interpreter::block_size - 1) / interpreter::block_size) * interpreter::block_size)
+    {
+        buffers.resize(pool.size());
+    }
+
+    int threads() const { return pool.size(); }
+    thread_pool& get_pool() { return pool; }
+    // shares evaluated subtrees between the programs of the population (and across calls). null disables caching
+    void set_cache(subtree_cache* c) { cache = c; }
+    subtree_cache* get_cache() const { return cache; }
+    // keeps the compiled programs of the trees across calls, e.g. for the elites of the next generation. null compiles every time
+    void set_program_cache(basic_program_cache<T, Accumulator>* c) { programs_cache = c; }
+    basic_program_cache<T, Accumulator>* get_program_cache() const { return programs_cache; }
+
+    // returns one column of count values per tree, for the rows [start, start + count)
+    std::vector<std::vector<T>> evaluate_population(const std::vector<node*>& trees, const dataset& data, int start, int count)
+    {
+        return evaluate_population(trees, data, start, count, cache);
+    }
+
+    // values of every tree on the selected rows. a strided or indexed selection (e.g. a mini-batch) is gathered once
+    // for the whole population instead of once per tree. the subtree cache is not used on the gathered rows: it is
+    // keyed by row number, and row 0 of one batch is not row 0 of the next
+    std::vector<std::vector<T>> evaluate_population(const std::vector<node*>& trees, const dataset& data, const row_selection& rows)
+    {
+        if (rows.contiguous())
+            return evaluate_population(trees, data, rows.start(), rows.size());
+        return evaluate_population(trees, gather(data, rows), 0, rows.size(), nullptr);
+    }
+
+    // writes the values of program i for the rows [start, start + count) into columns[i]
+    void evaluate_population(const std::vector<std::vector<instruction>>& programs, int start, int count, const std::vector<T*>& columns)
+    {
+        evaluate_population(programs, start, count, columns, cache);
+    }
+
+    // fitness statistics of every tree against the target column, without materializing the estimated values
+    std::vector<fitness_statistics> evaluate_fitness(const std::vector<node*>& trees, const dataset& data, const std::string& target, int start, int count)
+    {
+        if constexpr (std::is_same<T, Accumulator>::value)
+        {
+            return evaluate_fitness(compile_population(trees, data), data[target], start, count);
+        }
+        else
+        {
+            std::vector<Accumulator> y(count);
+            simd::convert(y.data(), data[target] + start, count);
+            return evaluate_fitness(compile_population(trees, data), y.data(), start, start, count, cache);
+        }
+    }
+
+    std::vector<fitness_statistics> evaluate_fitness(const std::vector<node*>& trees, const dataset& data, const std::string& target, const row_selection& rows)
+    {
+        if (rows.contiguous())
+            return evaluate_fitness(trees, data, target, rows.start(), rows.size());
+        auto batch = gather(data, rows);
+        auto programs = compile_population(trees, batch);
+        if constexpr (std::is_same<T, Accumulator>::value)
+        {
+            return evaluate_fitness(programs, batch[target], 0, 0, rows.size(), nullptr);
+        }
+        else
+        {
+            std::vector<Accumulator> y(rows.size());
+            simd::convert(y.data(), batch[target], rows.size());
+            return evaluate_fitness(programs, y.data(), 0, 0, rows.size(), nullptr);
+        }
+    }
+
+    std::vector<fitness_statistics> evaluate_fitness(const std::vector<std::vector<instruction>>& programs, const Accumulator* target, int start, int count)
+    {
+        return evaluate_fitness(programs, target, 0, start, count, cache);
+    }
+
+    // the selected rows of every column in compact form, gathered on the thread pool. programs compiled against
+    // the result can be evaluated on it repeatedly, e.g. for every step of a generation on the same mini-batch
+    dataset gather(const dataset& data, const row_selection& rows)
+    {
+        data.check(rows);
+        dataset batch(data.Variables(), rows.size());
+        auto chunks = (rows.size() + chunk_size - 1) / chunk_size;
+        pool.parallel_for(data.cols() * chunks, [&](int task, int) {
+            auto column = task / chunks;
+            auto offset = (task % chunks) * chunk_size;
+            rows.gather(data.column(column), batch.column(column) + offset, offset, std::min(chunk_size, rows.size() - offset));
+        });
+        return batch;
+    }
+
+    // compiles every tree; compilation only reads the dataset, so it runs in parallel as well. with a program cache,
+    // the programs of the trees found in it are copied instead
+    std::vector<std::vector<instruction>> compile_population(const std::vector<node*>& trees, const dataset& data)
+    {
+        std::vector<std::vector<instruction>> programs(trees.size());
+        pool.parallel_for(static_cast<int>(trees.size()), [&](int i, int) {
+            programs[i] = programs_cache ? *programs_cache->get(trees[i], data) : interpreter::compile(trees[i], data);
+        });
+        return programs;
+    }
+
+private:
+    std::vector<std::vector<T>> evaluate_population(const std::vector<node*>& trees, const dataset& data, int start, int count, subtree_cache* c)
+    {
+        auto programs = compile_population(trees, data);
+        std::vector<std::vector<T>> values(trees.size(), std::vector<T>(count));
+        std::vector<T*> columns(trees.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            columns[i] = values[i].data();
+        evaluate_population(programs, start, count, columns, c);
+        return values;
+    }
+
+    void evaluate_population(const std::vector<std::vector<instruction>>& programs, int start, int count, const std::vector<T*>& columns, subtree_cache* c)
+    {
+        auto chunks = prepare(programs, count);
+        pool.parallel_for(static_cast<int>(programs.size()) * chunks, [&](int task, int worker) {
+            auto tree = task / chunks;
+            auto offset = (task % chunks) * chunk_size;
+            auto n = std::min(chunk_size, count - offset);
+            interpreter::evaluate(programs[tree], start + offset, n, columns[tree] + offset, buffers[worker].data(), c);
+        });
+    }
+
+    // target holds the values of the rows from first on
+    std::vector<fitness_statistics> evaluate_fitness(const std::vector<std::vector<instruction>>& programs, const Accumulator* target, int first, int start, int count, subtree_cache* c)
+    {
+        auto chunks = prepare(programs, count);
+        std::vector<fitness_statistics> partial(programs.size() * chunks);
+        pool.parallel_for(static_cast<int>(partial.size()), [&](int task, int worker) {
+            auto tree = task / chunks;
+            auto offset = (task % chunks) * chunk_size;
+            auto n = std::min(chunk_size, count - offset);
+            partial[task] = interpreter::evaluate_fitness(programs[tree], target, first, start + offset, n, buffers[worker].data(), c);
+        });
+
+        // merging in chunk order keeps the result independent of the number of threads
+        std::vector<fitness_statistics> statistics(programs.size());
+        for (size_t task = 0; task < partial.size(); ++task)
+            statistics[task / chunks].merge(partial[task]);
+        return statistics;
+    }
+
+    // sizes the scratch buffers for the longest program and returns the number of row chunks per program.
+    // tasks are numbered tree-major, so neighbouring tasks (which land in the same worker queue) share a program
+    int prepare(const std::vector<std::vector<instruction>>& programs, int count)
+    {
+        if (programs.empty() || count <= 0)
+            return 0;
+
+        size_t max_size = 0;
+        for (auto& p : programs)
+            max_size = std::max(max_size, interpreter::buffer_size(p));
+        for (auto& b : buffers)
+        {
+            if (b.size() < max_size)
+                b.resize(max_size);
+        }
+        return (count + chunk_size - 1) / chunk_size;
+    }
+
+    thread_pool pool;
+    subtree_cache* cache;
+    basic_program_cache<T, Accumulator>* programs_cache;
+    int chunk_size;
+    // per-worker interpreter scratch space
+    std::vector<simd::aligned_vector<T>> buffers;
+};
+
+typedef basic_population_evaluator<double> population_evaluator;
+typedef basic_population_evaluator<float> float_population_evaluator;
+typedef basic_population_evaluator<float, double> mixed_population_evaluator;
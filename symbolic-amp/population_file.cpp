@@ -0,0 +1,194 @@
+#include "population_file.h"
+#include "operators.h"
+#include "symbol_table.h"
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+static uint64_t Align(uint64_t n)
+{
+    return (n + 7) / 8 * 8;
+}
+
+vector<char> population_file::serialize(const vector<node*>& trees)
+{
+    // variables are numbered in the file by order of appearance, since symbols are only valid within a process
+    unordered_map<int, uint32_t> indices;
+    vector<int> names;
+    vector<uint64_t> offsets{ 0 };
+    vector<serialized_node> records;
+    for (auto t : trees)
+    {
+        auto tree = linear_tree::FromNode(t);
+        for (auto& n : tree.Nodes())
+        {
+            if (n.arity > numeric_limits<uint16_t>::max())
+                throw invalid_argument("a node has too many children to be serialized.");
+            serialized_node r = {};
+            r.opcode = static_cast<uint8_t>(n.opcode);
+            r.arity = static_cast<uint16_t>(n.arity);
+            if (n.opcode == VARIABLE)
+            {
+                auto it = indices.emplace(n.variable, static_cast<uint32_t>(names.size())).first;
+                if (it->second == names.size())
+                    names.push_back(n.variable);
+                r.variable = it->second;
+                r.coefficient = n.weight;
+            }
+            else if (n.opcode == CONSTANT)
+            {
+                r.coefficient = n.value;
+            }
+            records.push_back(r);
+        }
+        offsets.push_back(records.size());
+    }
+
+    population_header header;
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.byte_order = byte_order;
+    header.trees = trees.size();
+    header.nodes = records.size();
+    header.symbols = names.size();
+
+    vector<char> bytes(sizeof(header));
+    for (auto symbol : names)
+    {
+        auto& name = symbol_table::name(symbol);
+        auto length = static_cast<uint32_t>(name.size());
+        auto p = reinterpret_cast<const char*>(&length);
+        bytes.insert(bytes.end(), p, p + sizeof(length));
+        bytes.insert(bytes.end(), name.begin(), name.end());
+    }
+    header.offsets_offset = Align(bytes.size());
+    header.nodes_offset = header.offsets_offset + offsets.size() * sizeof(uint64_t);
+    bytes.resize(header.nodes_offset + records.size() * sizeof(serialized_node), 0);
+    memcpy(bytes.data(), &header, sizeof(header));
+    memcpy(bytes.data() + header.offsets_offset, offsets.data(), offsets.size() * sizeof(uint64_t));
+    if (!records.empty())
+        memcpy(bytes.data() + header.nodes_offset, records.data(), records.size() * sizeof(serialized_node));
+    return bytes;
+}
+
+void population_file::save(const string& path, const vector<node*>& trees)
+{
+    auto bytes = serialize(trees);
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out)
+        throw runtime_error("cannot open " + path);
+    out.write(bytes.data(), static_cast<streamsize>(bytes.size()));
+    if (!out)
+        throw runtime_error("cannot write " + path);
+}
+
+population_file::population_file(const string& path) : path_(path), file(make_shared<mapped_file>(path, mapped_file::mode::read_only))
+{
+    parse(file->data(), file->size());
+}
+
+population_file::population_file(vector<char> data) : path_("the serialized population"), bytes(move(data))
+{
+    parse(bytes.data(), bytes.size());
+}
+
+void population_file::parse(const char* p, uint64_t size)
+{
+    if (size < sizeof(header))
+        throw runtime_error(path_ + " is not a population file.");
+    memcpy(&header, p, sizeof(header));
+    if (memcmp(header.magic, magic, sizeof(header.magic)) != 0 || header.version != version)
+        throw runtime_error(path_ + " is not a population file.");
+    if (header.byte_order != byte_order)
+        throw runtime_error(path_ + " was written with a different byte order.");
+    if (header.trees >= static_cast<uint64_t>(numeric_limits<int>::max()) || header.offsets_offset % 8 != 0 || header.offsets_offset > size
+        || (size - header.offsets_offset) / sizeof(uint64_t) < header.trees + 1
+        || header.nodes_offset != header.offsets_offset + (header.trees + 1) * sizeof(uint64_t)
+        || (size - header.nodes_offset) / sizeof(serialized_node) < header.nodes)
+        throw runtime_error(path_ + " is truncated or corrupt.");
+
+    auto end = p + header.offsets_offset;
+    auto q = p + sizeof(header);
+    symbols_.clear();
+    for (uint64_t i = 0; i < header.symbols; ++i)
+    {
+        uint32_t length;
+        if (end - q < static_cast<ptrdiff_t>(sizeof(length)))
+            throw runtime_error(path_ + " is truncated or corrupt.");
+        memcpy(&length, q, sizeof(length));
+        q += sizeof(length);
+        if (end - q < static_cast<ptrdiff_t>(length))
+            throw runtime_error(path_ + " is truncated or corrupt.");
+        symbols_.push_back(symbol_table::intern(string(q, length)));
+        q += length;
+    }
+
+    offsets = reinterpret_cast<const uint64_t*>(p + header.offsets_offset);
+    records = reinterpret_cast<const serialized_node*>(p + header.nodes_offset);
+    if (offsets[0] != 0 || offsets[header.trees] != header.nodes)
+        throw runtime_error(path_ + " is truncated or corrupt.");
+    for (uint64_t i = 0; i < header.trees; ++i)
+    {
+        if (offsets[i + 1] <= offsets[i] || offsets[i + 1] - offsets[i] > static_cast<uint64_t>(numeric_limits<int>::max()))
+            throw runtime_error(path_ + " is truncated or corrupt.");
+    }
+}
+
+linear_tree population_file::tree(int i) const
+{
+    if (i < 0 || i >= size())
+        throw out_of_range("the population has no tree " + to_string(i) + ".");
+    auto first = records + offsets[i];
+    auto count = length(i);
+    vector<linear_node> nodes(count);
+    // postfix order: the lengths of the pending subtrees are on a stack, and every node pops those of its children
+    vector<int> pending;
+    for (int k = 0; k < count; ++k)
+    {
+        auto& r = first[k];
+        auto& n = nodes[k];
+        if (r.opcode > VARIABLE || !operators::valid_arity(static_cast<op_code>(r.opcode), r.arity) || r.arity > static_cast<int>(pending.size())
+            || (r.opcode == VARIABLE && r.variable >= symbols_.size()))
+            throw runtime_error(path_ + " is truncated or corrupt.");
+        n.opcode = static_cast<op_code>(r.opcode);
+        n.arity = r.arity;
+        n.length = 1;
+        for (int c = 0; c < r.arity; ++c)
+        {
+            n.length += pending.back();
+            pending.pop_back();
+        }
+        pending.push_back(n.length);
+        n.variable = r.opcode == VARIABLE ? symbols_[r.variable] : -1;
+        n.value = r.opcode == CONSTANT ? r.coefficient : 0;
+        n.weight = r.opcode == VARIABLE ? r.coefficient : 0;
+    }
+    if (pending.size() != 1)
+        throw runtime_error(path_ + " is truncated or corrupt.");
+    return linear_tree(move(nodes));
+}
+
+vector<node*> population_file::load(node_arena* arena) const
+{
+    vector<node*> trees;
+    trees.reserve(size());
+    try
+    {
+        for (int i = 0; i < size(); ++i)
+            trees.push_back(load(i, arena));
+    }
+    catch (...)
+    {
+        if (arena == nullptr)
+        {
+            for (auto t : trees)
+                delete t;
+        }
+        throw;
+    }
+    return trees;
+}
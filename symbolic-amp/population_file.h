@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "node.h"
+#include "linear_tree.h"
+#include "mapped_file.h"
+
+// header of the binary population format. it is followed by the variable names (each one a uint32 length and the
+// characters), zero padding up to offsets_offset, trees + 1 uint64 node offsets (tree i is made of the nodes
+// [offsets[i], offsets[i + 1])), then the node records. both tables start on an 8 byte boundary
+struct population_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // 0x01020304 in the byte order of the machine that wrote the file
+    uint64_t trees;
+    uint64_t nodes;
+    uint64_t symbols;
+    uint64_t offsets_offset;
+    uint64_t nodes_offset;
+};
+
+// one node in 16 bytes. the nodes of a tree are stored in postfix order, the layout of linear_tree and of the
+// compiled programs, so a tree is read in one pass without rebuilding pointers
+struct serialized_node
+{
+    uint8_t opcode;
+    uint8_t reserved;
+    uint16_t arity;
+    uint32_t variable;   // index into the names of the file (VARIABLE nodes only)
+    double coefficient;  // the value of a constant, or the weight of a variable
+};
+
+// trees and populations in a compact binary form, for checkpoints and restarts. a saved file is mapped rather than
+// read: opening it checks the header and the tree offsets and interns the variable names, and every tree is decoded
+// on demand straight from the mapping, into a node tree, a linear tree or an evaluator program
+class population_file
+{
+public:
+    // maps a file written by save
+    explicit population_file(const std::string& path);
+    // decodes bytes written by serialize
+    explicit population_file(std::vector<char> bytes);
+
+    // the tables point into the mapping or the bytes, which a move keeps
+    population_file(const population_file&) = delete;
+    population_file& operator=(const population_file&) = delete;
+    population_file(population_file&&) = default;
+    population_file& operator=(population_file&&) = default;
+
+    // the binary form of a tree or of a population
+    static std::vector<char> serialize(const std::vector<node*>& trees);
+    static std::vector<char> serialize(node* tree) { return serialize(std::vector<node*>{ tree }); }
+    static void save(const std::string& path, const std::vector<node*>& trees);
+    static void save(const std::string& path, node* tree) { save(path, std::vector<node*>{ tree }); }
+
+    int size() const { return static_cast<int>(header.trees); }
+    // number of nodes of tree i
+    int length(int i) const { return static_cast<int>(offsets[i + 1] - offsets[i]); }
+    // symbols of the variable names of the file
+    const std::vector<int>& symbols() const { return symbols_; }
+
+    // tree i, checked for consistency (std::runtime_error if it is corrupt)
+    linear_tree tree(int i) const;
+    node* load(int i, node_arena* arena = nullptr) const { return tree(i).ToNode(arena); }
+    std::vector<node*> load(node_arena* arena = nullptr) const;
+
+    // the program of tree i for the given dataset, without going through a node tree
+    template<typename Interpreter>
+    std::vector<typename Interpreter::instruction> compile(int i, const typename Interpreter::dataset& data) const
+    {
+        return Interpreter::compile(tree(i), data);
+    }
+
+private:
+    static constexpr char magic[8] = { 'S', 'Y', 'M', 'A', 'M', 'P', 'P', 'T' };
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t byte_order = 0x01020304;
+
+    void parse(const char* p, uint64_t size);
+
+    std::string path_;
+    std::shared_ptr<mapped_file> file;
+    std::vector<char> bytes;
+    population_header header;
+    const uint64_t* offsets;
+    const serialized_node* records;
+    std::vector<int> symbols_;
+};
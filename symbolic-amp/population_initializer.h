@@ -0,0 +1,193 @@
+#pragma once
+#include "node.h"
+#include "dataset.h"
+#include "operators.h"
+#include "random.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+enum class initialization
+{
+    ramped_half_and_half,   // depths ramped over [min_depth, max_depth], half of the trees full and half grown
+    exact_size              // lengths drawn from [min_length, max_length], every tree built to its length (PTC2)
+};
+
+struct initializer_options
+{
+    initialization method = initialization::ramped_half_and_half;
+    // depth counts levels: a single leaf has depth 1
+    int min_depth = 2;
+    int max_depth = 6;
+    int min_length = 5;
+    int max_length = 50;
+    // n-ary operators get two children
+    std::vector<op_code> functions = { ADD, SUB, MUL, DIV };
+    // symbols of the variables the leaves may use (e.g. every input but the target), all the columns if empty
+    std::vector<int> variables;
+    // probability that a leaf is a constant rather than a variable
+    double constant_probability = 0;
+    // range of the constants and of the variable weights
+    double min_value = -5;
+    double max_value = 5;
+    uint64_t seed = 1234;
+};
+
+// generates initial populations in parallel. tree i draws its numbers from stream i of a counter-based generator,
+// so the population only depends on the options and the seed: it is bit-identical for any number of threads and
+// any scheduling. the trees go to the arena of the worker that built them, or to the heap
+class population_initializer
+{
+public:
+    explicit population_initializer(initializer_options options = initializer_options(), int nthreads = 0) : opts(options), pool(nthreads) {}
+
+    initializer_options& options() { return opts; }
+    const initializer_options& options() const { return opts; }
+    int threads() const { return pool.size(); }
+
+    // arenas holds one arena per worker (threads() of them), or none to allocate the trees on the heap.
+    // first is the index of the first tree, so populations can be extended (e.g. immigrants) with new trees
+    template<typename Dataset>
+    std::vector<node*> generate(int count, const Dataset& data, const std::vector<node_arena*>& arenas = {}, int first = 0)
+    {
+        validate(data);
+        if (!arenas.empty() && static_cast<int>(arenas.size()) < pool.size())
+            throw std::invalid_argument("the initializer needs one arena per worker.");
+        std::vector<node*> trees(count);
+        pool.parallel_for(count, [&](int i, int worker) {
+            trees[i] = generate_tree(first + i, data, arenas.empty() ? nullptr : arenas[worker]);
+        });
+        return trees;
+    }
+
+    // tree index of the population, the same as generate would build at that index
+    template<typename Dataset>
+    node* generate_tree(int index, const Dataset& data, node_arena* arena = nullptr) const
+    {
+        counter_rng rnd(opts.seed, static_cast<uint64_t>(index));
+        if (opts.method == initialization::exact_size)
+            return exact(rnd, data, rnd.next(opts.min_length, opts.max_length), arena);
+        // consecutive trees walk through the depths, and every other round of depths is full
+        auto ndepths = opts.max_depth - opts.min_depth + 1;
+        auto depth = opts.min_depth + index % ndepths;
+        auto full = (index / ndepths) % 2 == 0;
+        return build(rnd, data, 1, depth, full, arena);
+    }
+
+    // a grown tree of at most the given depth, drawn from rnd (e.g. the new subtree of a mutation)
+    template<typename Dataset>
+    node* grow(counter_rng& rnd, const Dataset& data, int depth, node_arena* arena = nullptr) const
+    {
+        return build(rnd, data, 1, depth, false, arena);
+    }
+
+    // throws std::invalid_argument if the options or the dataset cannot produce trees
+    template<typename Dataset>
+    void validate(const Dataset& data) const
+    {
+        if (data.cols() == 0)
+            throw std::invalid_argument("the dataset has no variables to build trees from.");
+        for (auto v : opts.variables)
+        {
+            if (data.variable_index(v) < 0)
+                throw std::invalid_argument("the variable " + symbol_table::name(v) + " is not present in the dataset.");
+        }
+        if (opts.min_depth < 1 || opts.max_depth < opts.min_depth || opts.min_length < 1 || opts.max_length < opts.min_length)
+            throw std::invalid_argument("the depth and length ranges of the initializer are empty.");
+        for (auto f : opts.functions)
+        {
+            if (f == CONSTANT || f == VARIABLE)
+                throw std::invalid_argument("leaves cannot be used as functions.");
+        }
+    }
+
+private:
+    static int arity(op_code f)
+    {
+        // add, sub, mul and div take any number of children, and one child would make them a negation or a reciprocal
+        return operators::valid_arity(f, 2) ? 2 : 1;
+    }
+
+    template<typename Dataset>
+    node* leaf(counter_rng& rnd, const Dataset& data, node_arena* arena) const
+    {
+        if (opts.constant_probability > 0 && rnd.next_double() < opts.constant_probability)
+            return node::constant(rnd.next_double(opts.min_value, opts.max_value), arena);
+        auto symbol = opts.variables.empty() ? data.symbol(rnd.next(data.cols() - 1)) : opts.variables[rnd.next(static_cast<int>(opts.variables.size()) - 1)];
+        return node::variable(symbol, rnd.next_double(opts.min_value, opts.max_value), arena);
+    }
+
+    // full trees have every leaf at the given depth; grown trees choose between a function and a leaf at every level
+    // below it, with even odds, as node::Random does
+    template<typename Dataset>
+    node* build(counter_rng& rnd, const Dataset& data, int level, int depth, bool full, node_arena* arena) const
+    {
+        if (level >= depth || opts.functions.empty() || (level > 1 && !full && rnd.next_double() < 0.5))
+            return leaf(rnd, data, arena);
+        auto f = opts.functions[rnd.next(static_cast<int>(opts.functions.size()) - 1)];
+        auto n = node::Create(f, arena);
+        for (int k = arity(f); k > 0; --k)
+            n->AddSubtree(build(rnd, data, level + 1, depth, full, arena));
+        return n;
+    }
+
+    // probabilistic tree creation (Luke, 2000): open child slots are filled in random order, with a function as long
+    // as the nodes placed plus the open slots are fewer than the target, then with leaves. the length is exact unless
+    // the function set cannot reach it (with binary functions only, every tree has an odd length)
+    template<typename Dataset>
+    node* exact(counter_rng& rnd, const Dataset& data, int target, node_arena* arena) const
+    {
+        struct pending
+        {
+            op_code op;
+            std::vector<int> children;
+        };
+        std::vector<pending> nodes;
+        std::vector<std::pair<int, int>> open{ { -1, 0 } };  // (parent, position) of the empty slots
+        std::vector<op_code> fitting;
+        while (!open.empty())
+        {
+            auto k = rnd.next(static_cast<int>(open.size()) - 1);
+            std::swap(open[k], open.back());
+            auto slot = open.back();
+            open.pop_back();
+
+            // every function adds its arity to the nodes placed plus the open slots, and a leaf adds nothing
+            auto total = static_cast<int>(nodes.size() + open.size()) + 1;
+            fitting.clear();
+            for (auto f : opts.functions)
+            {
+                if (total + arity(f) <= target)
+                    fitting.push_back(f);
+            }
+            auto id = static_cast<int>(nodes.size());
+            if (slot.first >= 0)
+                nodes[slot.first].children[slot.second] = id;
+            if (fitting.empty())
+            {
+                nodes.push_back({ VARIABLE, {} });
+                continue;
+            }
+            auto f = fitting[rnd.next(static_cast<int>(fitting.size()) - 1)];
+            nodes.push_back({ f, std::vector<int>(arity(f), -1) });
+            for (int c = 0; c < arity(f); ++c)
+                open.push_back({ id, c });
+        }
+        return materialize(rnd, data, nodes, 0, arena);
+    }
+
+    template<typename Dataset, typename Pending>
+    node* materialize(counter_rng& rnd, const Dataset& data, const std::vector<Pending>& nodes, int i, node_arena* arena) const
+    {
+        if (nodes[i].children.empty())
+            return leaf(rnd, data, arena);
+        auto n = node::Create(nodes[i].op, arena);
+        for (auto c : nodes[i].children)
+            n->AddSubtree(materialize(rnd, data, nodes, c, arena));
+        return n;
+    }
+
+    initializer_options opts;
+    thread_pool pool;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+// number of representable values of T between a and b (0 if they are equal, both zeros or both nan;
+// the maximum if only one of them is nan)
+template<typename T>
+uint64_t ulp_distance(T a, T b)
+{
+    static_assert(std::is_floating_point<T>::value, "ulp_distance needs a floating point type");
+    typedef typename std::conditional<sizeof(T) == 4, int32_t, int64_t>::type bits;
+    if (std::isnan(a) || std::isnan(b))
+        return std::isnan(a) && std::isnan(b) ? 0 : std::numeric_limits<uint64_t>::max();
+
+    // map the sign-magnitude representation onto a monotonic integer line, with both zeros at 0
+    auto ordered = [](T x) {
+        bits i;
+        std::memcpy(&i, &x, sizeof(i));
+        return i < 0 ? static_cast<bits>(std::numeric_limits<bits>::min() - i) : i;
+    };
+    auto x = ordered(a), y = ordered(b);
+    return x > y ? static_cast<uint64_t>(x) - static_cast<uint64_t>(y) : static_cast<uint64_t>(y) - static_cast<uint64_t>(x);
+}
+
+// how far values computed in precision T are from the double precision reference
+struct precision_divergence
+{
+    uint64_t max_ulp = 0;         // in ulps of T, against the reference rounded to T
+    double max_abs_error = 0;
+    double max_rel_error = 0;
+    int nonfinite = 0;            // rows where exactly one of the two is not finite
+};
+
+template<typename T>
+precision_divergence compare_precision(const double* reference, const T* values, int n)
+{
+    precision_divergence d;
+    for (int i = 0; i < n; ++i)
+    {
+        auto r = reference[i];
+        auto v = static_cast<double>(values[i]);
+        if (std::isfinite(r) != std::isfinite(v))
+        {
+            ++d.nonfinite;
+            continue;
+        }
+        if (!std::isfinite(r))
+            continue;
+        d.max_ulp = std::max(d.max_ulp, ulp_distance(static_cast<T>(r), values[i]));
+        auto e = std::abs(r - v);
+        d.max_abs_error = std::max(d.max_abs_error, e);
+        if (r != 0)
+            d.max_rel_error = std::max(d.max_rel_error, e / std::abs(r));
+    }
+    return d;
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include "interpreter.h"
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// compiled programs kept across evaluations, so a tree that survives from one generation to the next (an elite,
+// or a tree that is only re-evaluated on a new batch of rows) is compiled once. programs are found by the identity
+// of the root node and its stamp, which every edit of the tree changes, so a mutated tree misses and is compiled
+// again; copies of a tree are found by their structural hash. a program compiled against one dataset is rebound
+// to another by resolving its variables again, without going through the tree. safe to share between threads
+template<typename T, typename Accumulator = T>
+class basic_program_cache
+{
+public:
+    typedef basic_interpreter<T, Accumulator> interpreter;
+    typedef typename interpreter::instruction instruction;
+    typedef typename interpreter::dataset dataset;
+    // programs are immutable once cached; holders keep theirs when the entry is rebound or evicted
+    typedef std::shared_ptr<const std::vector<instruction>> program;
+
+    // capacity is the number of distinct trees (by structure) kept, the least recently used are evicted first
+    explicit basic_program_cache(size_t capacity = 1 << 14) : limit(std::max<size_t>(capacity, 1)) {}
+
+    basic_program_cache(const basic_program_cache&) = delete;
+    basic_program_cache& operator=(const basic_program_cache&) = delete;
+
+    // the program of the tree, bound to the columns of data
+    program get(node* root, const dataset& data)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = identities.find(root);
+        if (it != identities.end() && it->second.stamp == root->GetStamp())
+        {
+            if (auto e = it->second.shape.lock())
+            {
+                ++nhits;
+                SYMBOLIC_AMP_COUNT(program_cache_hits, 1);
+                return use(*e, data);
+            }
+        }
+        lock.unlock();
+
+        // by structure: linearizing is the cheap half of compiling
+        auto tree = linear_tree::FromNode(root);
+        auto hash = tree.Hashes().back();
+        lock.lock();
+        std::shared_ptr<entry> e;
+        auto range = shapes.equal_range(hash);
+        for (auto s = range.first; s != range.second && !e; ++s)
+        {
+            if (same(s->second->nodes, tree.Nodes()))
+                e = s->second;
+        }
+        if (e)
+        {
+            ++nhits;
+            SYMBOLIC_AMP_COUNT(program_cache_hits, 1);
+        }
+        else
+        {
+            lock.unlock();
+            auto code = std::make_shared<const std::vector<instruction>>(interpreter::compile(tree, data));
+            lock.lock();
+            ++nmisses;
+            SYMBOLIC_AMP_COUNT(program_cache_misses, 1);
+            e = std::make_shared<entry>();
+            e->hash = hash;
+            e->nodes = tree.Nodes();
+            e->code = code;
+            e->generation = data.generation();
+            recent.push_front(e);
+            e->position = recent.begin();
+            shapes.emplace(hash, e);
+            evict();
+        }
+        identities[root] = identity{ root->GetStamp(), e };
+        if (identities.size() > 2 * limit)
+            prune();
+        return use(*e, data);
+    }
+
+    // forgets the program of the tree, e.g. before the tree is deleted (stale entries are never used, but they
+    // take space until they are evicted)
+    void erase(node* root)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        identities.erase(root);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        identities.clear();
+        shapes.clear();
+        recent.clear();
+    }
+
+    size_t capacity() const { return limit; }
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return recent.size();
+    }
+    size_t hits() const { return nhits; }
+    size_t misses() const { return nmisses; }
+    size_t rebinds() const { return nrebinds; }
+
+    // interpreter::evaluate and evaluate_fitness with the compilation cached
+    T evaluate(node* root, int row, const dataset& data)
+    {
+        auto code = get(root, data);
+        std::vector<T> values(code->size());
+        return interpreter::evaluate(*code, row, values.data());
+    }
+
+    std::vector<T> evaluate(node* root, int start, int count, const dataset& data)
+    {
+        std::vector<T> values(count);
+        interpreter::evaluate(*get(root, data), start, count, values.data());
+        return values;
+    }
+
+    fitness_statistics evaluate_fitness(node* root, const dataset& data, const std::string& target, int start, int count)
+    {
+        return interpreter::evaluate_fitness(*get(root, data), data, target, start, count);
+    }
+
+private:
+    struct entry;
+
+    struct identity
+    {
+        uint64_t stamp;
+        std::weak_ptr<entry> shape;
+    };
+
+    struct entry
+    {
+        uint64_t hash;
+        std::vector<linear_node> nodes;
+        program code;
+        uint64_t generation;  // of the dataset the program reads
+        typename std::list<std::shared_ptr<entry>>::iterator position;
+    };
+
+    static bool same(const std::vector<linear_node>& a, const std::vector<linear_node>& b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            // coefficients are compared bitwise, as the structural hash sees them, so a nan matches its copies
+            if (a[i].opcode != b[i].opcode || a[i].arity != b[i].arity || a[i].variable != b[i].variable
+                || std::memcmp(&a[i].value, &b[i].value, sizeof(double)) != 0 || std::memcmp(&a[i].weight, &b[i].weight, sizeof(double)) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // marks the entry as recently used and returns its program bound to data, rebinding it if needed
+    program use(entry& e, const dataset& data)
+    {
+        recent.splice(recent.begin(), recent, e.position);
+        if (e.generation != data.generation())
+        {
+            auto code = std::make_shared<std::vector<instruction>>(*e.code);
+            for (size_t i = 0; i < code->size(); ++i)
+            {
+                auto& instr = (*code)[i];
+                if (instr.opcode != VARIABLE)
+                    continue;
+                instr.variable = data.variable_index(e.nodes[i].variable);
+                if (instr.variable < 0)
+                    throw std::out_of_range("the variable " + symbol_table::name(e.nodes[i].variable) + " is not present in the dataset.");
+                instr.data = data.column(instr.variable);
+            }
+            e.code = code;
+            e.generation = data.generation();
+            ++nrebinds;
+        }
+        return e.code;
+    }
+
+    void evict()
+    {
+        while (recent.size() > limit)
+        {
+            auto e = recent.back();
+            auto range = shapes.equal_range(e->hash);
+            for (auto s = range.first; s != range.second; ++s)
+            {
+                if (s->second == e)
+                {
+                    shapes.erase(s);
+                    break;
+                }
+            }
+            recent.pop_back();
+        }
+    }
+
+    // drops the identities of evicted programs. the nodes themselves may be gone, so they are not looked at; if
+    // that is not enough (many live copies of the same trees), the identities start over, as they are only a shortcut
+    void prune()
+    {
+        for (auto it = identities.begin(); it != identities.end();)
+        {
+            if (it->second.shape.expired())
+                it = identities.erase(it);
+            else
+                ++it;
+        }
+        if (identities.size() > limit)
+            identities.clear();
+    }
+
+    size_t limit;
+    std::unordered_map<const node*, identity> identities;
+    std::unordered_multimap<uint64_t, std::shared_ptr<entry>> shapes;
+    std::list<std::shared_ptr<entry>> recent;  // most recently used first
+    size_t nhits = 0;
+    size_t nmisses = 0;
+    size_t nrebinds = 0;
+    mutable std::mutex mutex;
+};
+
+typedef basic_program_cache<double> program_cache;
+typedef basic_program_cache<float> float_program_cache;
+typedef basic_program_cache<float, double> mixed_program_cache;
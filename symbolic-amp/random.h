@@ -1,18 +1,22 @@
 #pragma once
 
+#include <cstdint>
+#include <limits>
 #include <random>
 
 typedef std::mt19937 engine_type;
 
-// implementation
-class random
+// random number generator for trees and datasets (not named random, which posix declares as a function)
+class rng
 {
 public:
-    random()
+    rng()
     {
         std::random_device rd;
         twister_ = engine_type(rd());
     }
+    explicit rng(engine_type::result_type s) : twister_(s) {}
+
     int next(int end)
     {
         if (end == 0) return 0;
@@ -52,4 +56,54 @@ public:
 
 private:
     engine_type twister_;
-};
\ No newline at end of file
+};
+// counter-based generator: the n-th number of stream s under a seed is a pure function of (seed, s, n), the SplitMix64
+// finalizer applied to a Weyl sequence whose start and odd increment both derive from the seed and the stream.
+// every tree, task or thread can have its own stream without jumps or shared state, so parallel generation gives the
+// same numbers for any number of threads. the distributions are computed here rather than by <random>, so the
+// numbers are also the same with every standard library
+class counter_rng
+{
+public:
+    explicit counter_rng(uint64_t seed = 0, uint64_t stream = 0)
+        : start(mix(seed ^ mix(stream ^ 0x6a09e667f3bcc909ull))), gamma(mix(seed + mix(stream + 0x9e3779b97f4a7c15ull)) | 1), counter(0)
+    {
+    }
+
+    uint64_t next_u64() { return mix(start + gamma * ++counter); }
+
+    // uniform in [0, end]
+    int next(int end) { return next(0, end); }
+
+    // uniform in [begin, end], without modulo bias
+    int next(int begin, int end)
+    {
+        if (begin >= end) return begin;
+        auto range = static_cast<uint64_t>(static_cast<int64_t>(end) - begin) + 1;
+        auto limit = std::numeric_limits<uint64_t>::max() - std::numeric_limits<uint64_t>::max() % range;
+        uint64_t x;
+        do { x = next_u64(); } while (x >= limit);
+        return static_cast<int>(begin + static_cast<int64_t>(x % range));
+    }
+
+    // uniform in [0, 1) with 53 random bits
+    double next_double() { return static_cast<double>(next_u64() >> 11) * 0x1.0p-53; }
+    double next_double(double end) { return next_double() * end; }
+    double next_double(double begin, double end) { return begin + next_double() * (end - begin); }
+
+    // numbers drawn so far; seek(n) continues the stream from the n-th number
+    uint64_t position() const { return counter; }
+    void seek(uint64_t n) { counter = n; }
+
+private:
+    static uint64_t mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t start;
+    uint64_t gamma;
+    uint64_t counter;
+};
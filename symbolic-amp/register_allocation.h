@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+
+// evaluation order and scratch buffer assignment for postfix programs, as a compiler allocates registers.
+// the children of every node are scheduled in decreasing order of the number of buffers they need (Sethi-Ullman
+// order, generalized to any arity), and every result gets a buffer (slot) that is released as soon as its parent
+// has read it. a tree of n nodes then needs O(log n) slots instead of one per node when it is balanced, and never
+// more than its length. the program keeps its postfix layout: code[j].order is the instruction executed at step j,
+// and code[i].slot is the buffer that holds the result of instruction i
+namespace register_allocation
+{
+    // in_place: operators write their result over their first child (the C++ AMP kernels), otherwise the result
+    // needs a buffer of its own (the block kernels, whose folds use it as an accumulator). returns the number of slots
+    template<typename Instruction>
+    int allocate(std::vector<Instruction>& code, bool in_place)
+    {
+        auto size = static_cast<int>(code.size());
+        if (size == 0)
+            return 0;
+
+        // children of every node, in schedule order; need[i] is the number of slots the subtree i uses at its peak
+        std::vector<int> need(size), first(size + 1), children;
+        children.reserve(size);
+        for (int i = 0; i < size; ++i)
+        {
+            first[i] = static_cast<int>(children.size());
+            auto arity = code[i].arity;
+            children.resize(children.size() + arity);
+            auto c = children.begin() + first[i];
+            for (int k = arity - 1, j = i - 1; k >= 0; --k, j -= code[j].length)
+                c[k] = j;
+            std::stable_sort(c, children.end(), [&](int a, int b) { return need[a] > need[b]; });
+            auto n = 1;
+            for (int k = 0; k < arity; ++k)
+                n = std::max(n, need[c[k]] + k);
+            need[i] = in_place || arity == 0 ? n : std::max(n, arity + 1);
+        }
+        first[size] = static_cast<int>(children.size());
+
+        // depth-first schedule from the root
+        std::vector<std::pair<int, int>> stack{ { size - 1, 0 } };
+        int step = 0;
+        while (!stack.empty())
+        {
+            auto& top = stack.back();
+            auto i = top.first;
+            if (first[i] + top.second < first[i + 1])
+            {
+                auto c = children[first[i] + top.second++];
+                stack.push_back({ c, 0 });
+            }
+            else
+            {
+                code[step++].order = i;
+                stack.pop_back();
+            }
+        }
+
+        // liveness: a slot is free again once the parent of its value has run; the lowest free slot is reused first
+        std::priority_queue<int, std::vector<int>, std::greater<int>> released;
+        int slots = 0;
+        auto acquire = [&]() {
+            if (released.empty())
+                return slots++;
+            auto s = released.top();
+            released.pop();
+            return s;
+        };
+        for (int j = 0; j < size; ++j)
+        {
+            auto i = code[j].order;
+            auto& instr = code[i];
+            if (instr.arity == 0)
+            {
+                instr.slot = acquire();
+                continue;
+            }
+            auto operand0 = i - 1;
+            for (int k = instr.arity - 1, c = i - 1; k >= 0; --k, c -= code[c].length)
+                operand0 = c;
+            if (in_place)
+            {
+                instr.slot = code[operand0].slot;
+            }
+            else
+            {
+                instr.slot = acquire();
+                released.push(code[operand0].slot);
+            }
+            for (int k = first[i]; k < first[i + 1]; ++k)
+            {
+                if (children[k] != operand0)
+                    released.push(code[children[k]].slot);
+            }
+        }
+        return slots;
+    }
+
+    // number of slots used by an allocated program
+    template<typename Instruction>
+    int slots(const std::vector<Instruction>& code)
+    {
+        int n = 0;
+        for (auto& instr : code)
+            n = std::max(n, instr.slot + 1);
+        return n;
+    }
+
+    // the subtrees that start at every step of the schedule, outermost first: roots[offsets[j]] .. roots[offsets[j + 1] - 1].
+    // the schedule is depth-first, so a subtree rooted at i runs in the steps [j, j + code[i].length), and looking up
+    // cached subtrees at their first step finds the largest hits first, like a top-down walk of the tree
+    struct subtree_index
+    {
+        std::vector<int> offsets;
+        std::vector<int> roots;
+
+        subtree_index() {}
+
+        template<typename Instruction>
+        explicit subtree_index(const std::vector<Instruction>& code) : offsets(code.size() + 1), roots(code.size())
+        {
+            std::vector<int> start(code.size());
+            for (size_t j = 0; j < code.size(); ++j)
+            {
+                auto i = code[j].order;
+                start[i] = static_cast<int>(j) - code[i].length + 1;
+                ++offsets[start[i] + 1];
+            }
+            for (size_t j = 0; j < code.size(); ++j)
+                offsets[j + 1] += offsets[j];
+            for (size_t i = 0; i < code.size(); ++i)
+                roots[i] = static_cast<int>(i);
+            std::stable_sort(roots.begin(), roots.end(), [&](int a, int b) {
+                return start[a] != start[b] ? start[a] < start[b] : code[a].length > code[b].length;
+            });
+        }
+    };
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// a set of dataset rows to evaluate on: a contiguous range, which evaluators read in place, or a strided set or an
+// index list (e.g. a random mini-batch), which is gathered into compact columns once and then shared by every tree.
+// index lists are best sorted, so the gather walks every column in one direction
+class row_selection
+{
+public:
+    enum class kind { range, strided, indices };
+
+    row_selection() : type_(kind::range), first(0), step(1), count(0) {}
+
+    static row_selection range(int start, int count)
+    {
+        return row_selection(kind::range, start, 1, count);
+    }
+
+    // rows start, start + stride, ..., count of them
+    static row_selection strided(int start, int stride, int count)
+    {
+        if (stride < 1)
+            throw std::invalid_argument("the stride of a row selection must be positive.");
+        return stride == 1 ? range(start, count) : row_selection(kind::strided, start, stride, count);
+    }
+
+    static row_selection indices(std::vector<int> rows)
+    {
+        row_selection s(kind::indices, 0, 0, static_cast<int>(rows.size()));
+        s.list = std::make_shared<const std::vector<int>>(std::move(rows));
+        return s;
+    }
+
+    kind type() const { return type_; }
+    int size() const { return count; }
+    // contiguous selections need no gather: they are the rows [start(), start() + size())
+    bool contiguous() const { return type_ == kind::range; }
+    int start() const { return first; }
+    int stride() const { return step; }
+
+    // dataset row of the i-th selected row
+    int operator[](int i) const
+    {
+        return type_ == kind::indices ? (*list)[i] : first + i * step;
+    }
+
+    // largest row index, to validate the selection against a dataset
+    int max_row() const
+    {
+        if (count == 0)
+            return -1;
+        if (type_ != kind::indices)
+            return first + (count - 1) * step;
+        int m = (*list)[0];
+        for (auto r : *list)
+            m = r > m ? r : m;
+        return m;
+    }
+
+    int min_row() const
+    {
+        if (count == 0)
+            return 0;
+        if (type_ != kind::indices)
+            return first;
+        int m = (*list)[0];
+        for (auto r : *list)
+            m = r < m ? r : m;
+        return m;
+    }
+
+    // out[i] = column[(*this)[offset + i]] for i in [0, n)
+    template<typename T>
+    void gather(const T* column, T* out, int offset, int n) const
+    {
+        switch (type_)
+        {
+        case kind::range:
+            std::copy(column + first + offset, column + first + offset + n, out);
+            break;
+        case kind::strided:
+        {
+            auto p = column + first + static_cast<size_t>(offset) * step;
+            for (int i = 0; i < n; ++i, p += step)
+                out[i] = *p;
+            break;
+        }
+        case kind::indices:
+        {
+            auto rows = list->data() + offset;
+            for (int i = 0; i < n; ++i)
+                out[i] = column[rows[i]];
+            break;
+        }
+        }
+    }
+
+private:
+    row_selection(kind t, int start, int stride, int n) : type_(t), first(start), step(stride), count(n) {}
+
+    kind type_;
+    int first;
+    int step;
+    int count;
+    std::shared_ptr<const std::vector<int>> list;  // shared by copies of the selection
+};
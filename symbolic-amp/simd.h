@@ -0,0 +1,390 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <limits>
+#include <vector>
+
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// element-wise kernels used by the block (columnar) interpreter.
+// the instruction set is selected at compile time (/arch:AVX2, /arch:AVX512 or -march=...),
+// with a scalar fallback that the compiler is still free to auto-vectorize.
+// besides arithmetic, a pack provides comparisons (with a mask type), selection, rounding and access to the
+// binary exponent; simd_math.h builds the transcendental functions on top of them
+namespace simd
+{
+    // cache line alignment, also enough for 512-bit loads
+    constexpr std::size_t alignment = 64;
+
+    template<typename T>
+    class aligned_allocator
+    {
+    public:
+        typedef T value_type;
+
+        aligned_allocator() noexcept {}
+        template<typename U> aligned_allocator(const aligned_allocator<U>&) noexcept {}
+
+        T* allocate(std::size_t n)
+        {
+            if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+                throw std::bad_alloc();
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+        }
+
+        void deallocate(T* p, std::size_t) noexcept
+        {
+            ::operator delete(p, std::align_val_t(alignment));
+        }
+
+        template<typename U> struct rebind { typedef aligned_allocator<U> other; };
+    };
+
+    template<typename T, typename U>
+    bool operator==(const aligned_allocator<T>&, const aligned_allocator<U>&) { return true; }
+    template<typename T, typename U>
+    bool operator!=(const aligned_allocator<T>&, const aligned_allocator<U>&) { return false; }
+
+    template<typename T>
+    using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+    // vector operations on T lanes; width lanes per register
+    template<typename T> struct pack;
+
+#if defined(__AVX512F__)
+    // the unmasked forms of several avx-512 intrinsics start from an undefined register, which gcc reports as
+    // possibly uninitialized; the zero-masked forms with every lane selected compute the same without it
+    template<> struct pack<double>
+    {
+        static constexpr int width = 8;
+        typedef __m512d type;
+        static type load(const double* p) { return _mm512_loadu_pd(p); }
+        static void store(double* p, type v) { _mm512_storeu_pd(p, v); }
+        static type broadcast(double v) { return _mm512_set1_pd(v); }
+        static type add(type a, type b) { return _mm512_add_pd(a, b); }
+        static type sub(type a, type b) { return _mm512_sub_pd(a, b); }
+        static type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+        static type div(type a, type b) { return _mm512_div_pd(a, b); }
+        static type abs(type a) { return _mm512_abs_pd(a); }
+        static double hsum(type a)
+        {
+            auto h = _mm256_add_pd(_mm512_maskz_extractf64x4_pd(0xf, a, 0), _mm512_maskz_extractf64x4_pd(0xf, a, 1));
+            auto s = _mm_add_pd(_mm256_castpd256_pd128(h), _mm256_extractf128_pd(h, 1));
+            return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+        }
+
+        typedef __mmask8 mask;
+        static mask lt(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+        static mask le(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+        static mask eq(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+        static mask unordered(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_UNORD_Q); }
+        static mask mask_or(mask a, mask b) { return a | b; }
+        static mask mask_and(mask a, mask b) { return a & b; }
+        static type select(mask m, type a, type b) { return _mm512_mask_blend_pd(m, b, a); }
+        static type fma(type a, type b, type c) { return _mm512_fmadd_pd(a, b, c); }
+        static type sqrt(type a) { return _mm512_maskz_sqrt_pd(0xff, a); }
+        static type round(type a) { return _mm512_maskz_roundscale_pd(0xff, a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+        static type floor(type a) { return _mm512_maskz_roundscale_pd(0xff, a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+        // 2^n for integral n in [-1022, 1023]
+        static type pow2(type n) { return _mm512_maskz_scalef_pd(0xff, _mm512_set1_pd(1.0), n); }
+        // floor(log2(x)) and x / 2^floor(log2(x)) in [1, 2), for positive normal x
+        static type exponent(type x) { return _mm512_maskz_getexp_pd(0xff, x); }
+        static type mantissa(type x) { return _mm512_maskz_getmant_pd(0xff, x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero); }
+    };
+
+    template<> struct pack<float>
+    {
+        static constexpr int width = 16;
+        typedef __m512 type;
+        static type load(const float* p) { return _mm512_loadu_ps(p); }
+        static void store(float* p, type v) { _mm512_storeu_ps(p, v); }
+        static type broadcast(float v) { return _mm512_set1_ps(v); }
+        static type add(type a, type b) { return _mm512_add_ps(a, b); }
+        static type sub(type a, type b) { return _mm512_sub_ps(a, b); }
+        static type mul(type a, type b) { return _mm512_mul_ps(a, b); }
+        static type div(type a, type b) { return _mm512_div_ps(a, b); }
+        static type abs(type a) { return _mm512_abs_ps(a); }
+        static float hsum(type a)
+        {
+            auto halves = _mm512_castps_pd(a);
+            auto h = _mm256_add_ps(_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, halves, 0)), _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, halves, 1)));
+            auto s = _mm_add_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehdup_ps(s)));
+        }
+
+        typedef __mmask16 mask;
+        static mask lt(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+        static mask le(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+        static mask eq(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+        static mask unordered(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_UNORD_Q); }
+        static mask mask_or(mask a, mask b) { return a | b; }
+        static mask mask_and(mask a, mask b) { return a & b; }
+        static type select(mask m, type a, type b) { return _mm512_mask_blend_ps(m, b, a); }
+        static type fma(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+        static type sqrt(type a) { return _mm512_maskz_sqrt_ps(0xffff, a); }
+        static type round(type a) { return _mm512_maskz_roundscale_ps(0xffff, a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+        static type floor(type a) { return _mm512_maskz_roundscale_ps(0xffff, a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+        // 2^n for integral n in [-126, 127]
+        static type pow2(type n) { return _mm512_maskz_scalef_ps(0xffff, _mm512_set1_ps(1.0f), n); }
+        static type exponent(type x) { return _mm512_maskz_getexp_ps(0xffff, x); }
+        static type mantissa(type x) { return _mm512_maskz_getmant_ps(0xffff, x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero); }
+    };
+#elif defined(__AVX2__)
+    template<> struct pack<double>
+    {
+        static constexpr int width = 4;
+        typedef __m256d type;
+        static type load(const double* p) { return _mm256_loadu_pd(p); }
+        static void store(double* p, type v) { _mm256_storeu_pd(p, v); }
+        static type broadcast(double v) { return _mm256_set1_pd(v); }
+        static type add(type a, type b) { return _mm256_add_pd(a, b); }
+        static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+        static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+        static type div(type a, type b) { return _mm256_div_pd(a, b); }
+        static type abs(type a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+        static double hsum(type a)
+        {
+            auto s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+            return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+        }
+
+        typedef __m256d mask;
+        static mask lt(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+        static mask le(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+        static mask eq(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+        static mask unordered(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_UNORD_Q); }
+        static mask mask_or(mask a, mask b) { return _mm256_or_pd(a, b); }
+        static mask mask_and(mask a, mask b) { return _mm256_and_pd(a, b); }
+        static type select(mask m, type a, type b) { return _mm256_blendv_pd(b, a, m); }
+#if defined(__FMA__)
+        static type fma(type a, type b, type c) { return _mm256_fmadd_pd(a, b, c); }
+#else
+        static type fma(type a, type b, type c) { return _mm256_add_pd(_mm256_mul_pd(a, b), c); }
+#endif
+        static type sqrt(type a) { return _mm256_sqrt_pd(a); }
+        static type round(type a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+        static type floor(type a) { return _mm256_floor_pd(a); }
+        // 2^n for integral n in [-1022, 1023]: n + 1023 goes into the exponent field. adding 2^52 puts the integer
+        // in the low bits of the significand, where it can be read without a 64-bit conversion instruction
+        static type pow2(type n)
+        {
+            auto magic = _mm256_set1_pd(4503599627370496.0);
+            auto biased = _mm256_add_pd(_mm256_add_pd(n, _mm256_set1_pd(1023.0)), magic);
+            auto bits = _mm256_sub_epi64(_mm256_castpd_si256(biased), _mm256_castpd_si256(magic));
+            return _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52));
+        }
+        static type exponent(type x)
+        {
+            auto magic = _mm256_set1_pd(4503599627370496.0);
+            auto biased = _mm256_or_si256(_mm256_srli_epi64(_mm256_castpd_si256(x), 52), _mm256_castpd_si256(magic));
+            return _mm256_sub_pd(_mm256_castsi256_pd(biased), _mm256_set1_pd(4503599627370496.0 + 1023.0));
+        }
+        static type mantissa(type x)
+        {
+            auto bits = _mm256_and_si256(_mm256_castpd_si256(x), _mm256_set1_epi64x(0x000fffffffffffffll));
+            return _mm256_castsi256_pd(_mm256_or_si256(bits, _mm256_set1_epi64x(0x3ff0000000000000ll)));
+        }
+    };
+
+    template<> struct pack<float>
+    {
+        static constexpr int width = 8;
+        typedef __m256 type;
+        static type load(const float* p) { return _mm256_loadu_ps(p); }
+        static void store(float* p, type v) { _mm256_storeu_ps(p, v); }
+        static type broadcast(float v) { return _mm256_set1_ps(v); }
+        static type add(type a, type b) { return _mm256_add_ps(a, b); }
+        static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+        static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+        static type div(type a, type b) { return _mm256_div_ps(a, b); }
+        static type abs(type a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+        static float hsum(type a)
+        {
+            auto s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+        }
+
+        typedef __m256 mask;
+        static mask lt(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static mask le(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+        static mask eq(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+        static mask unordered(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_UNORD_Q); }
+        static mask mask_or(mask a, mask b) { return _mm256_or_ps(a, b); }
+        static mask mask_and(mask a, mask b) { return _mm256_and_ps(a, b); }
+        static type select(mask m, type a, type b) { return _mm256_blendv_ps(b, a, m); }
+#if defined(__FMA__)
+        static type fma(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+        static type fma(type a, type b, type c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+        static type sqrt(type a) { return _mm256_sqrt_ps(a); }
+        static type round(type a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+        static type floor(type a) { return _mm256_floor_ps(a); }
+        // 2^n for integral n in [-126, 127]
+        static type pow2(type n)
+        {
+            auto bits = _mm256_cvtps_epi32(_mm256_add_ps(n, _mm256_set1_ps(127.0f)));
+            return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+        }
+        static type exponent(type x)
+        {
+            auto bits = _mm256_srli_epi32(_mm256_castps_si256(x), 23);
+            return _mm256_sub_ps(_mm256_cvtepi32_ps(bits), _mm256_set1_ps(127.0f));
+        }
+        static type mantissa(type x)
+        {
+            auto bits = _mm256_and_si256(_mm256_castps_si256(x), _mm256_set1_epi32(0x007fffff));
+            return _mm256_castsi256_ps(_mm256_or_si256(bits, _mm256_set1_epi32(0x3f800000)));
+        }
+    };
+#else
+    template<typename T> struct pack
+    {
+        static constexpr int width = 1;
+        typedef T type;
+        static type load(const T* p) { return *p; }
+        static void store(T* p, type v) { *p = v; }
+        static type broadcast(T v) { return v; }
+        static type add(type a, type b) { return a + b; }
+        static type sub(type a, type b) { return a - b; }
+        static type mul(type a, type b) { return a * b; }
+        static type div(type a, type b) { return a / b; }
+        static type abs(type a) { return a < 0 ? -a : a; }
+        static T hsum(type a) { return a; }
+
+        typedef bool mask;
+        static mask lt(type a, type b) { return a < b; }
+        static mask le(type a, type b) { return a <= b; }
+        static mask eq(type a, type b) { return a == b; }
+        static mask unordered(type a, type b) { return std::isnan(a) || std::isnan(b); }
+        static mask mask_or(mask a, mask b) { return a || b; }
+        static mask mask_and(mask a, mask b) { return a && b; }
+        static type select(mask m, type a, type b) { return m ? a : b; }
+        // without fma hardware std::fma is a slow software routine, so the product is rounded
+        static type fma(type a, type b, type c) { return a * b + c; }
+        static type sqrt(type a) { return std::sqrt(a); }
+        static type round(type a) { return std::nearbyint(a); }
+        static type floor(type a) { return std::floor(a); }
+        static type pow2(type n) { return std::ldexp(T(1), static_cast<int>(n)); }
+        static type exponent(type x) { return static_cast<T>(std::ilogb(x)); }
+        static type mantissa(type x) { return std::scalbn(x, -std::ilogb(x)); }
+    };
+#endif
+
+    // the double precision operations, used by the reductions
+    constexpr int width = pack<double>::width;
+    typedef pack<double>::type vector_type;
+    inline vector_type load(const double* p) { return pack<double>::load(p); }
+    inline void store(double* p, vector_type v) { pack<double>::store(p, v); }
+    inline vector_type broadcast(double v) { return pack<double>::broadcast(v); }
+    inline vector_type add(vector_type a, vector_type b) { return pack<double>::add(a, b); }
+    inline vector_type sub(vector_type a, vector_type b) { return pack<double>::sub(a, b); }
+    inline vector_type mul(vector_type a, vector_type b) { return pack<double>::mul(a, b); }
+    inline vector_type div(vector_type a, vector_type b) { return pack<double>::div(a, b); }
+    inline vector_type abs(vector_type a) { return pack<double>::abs(a); }
+    inline double hsum(vector_type a) { return pack<double>::hsum(a); }
+
+    // element-wise kernels on double or float columns
+
+    // r[i] = a[i] + b[i]
+    template<typename T>
+    inline void add(T* r, const T* a, const T* b, int n)
+    {
+        typedef pack<T> P;
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+            P::store(r + i, P::add(P::load(a + i), P::load(b + i)));
+        for (; i < n; ++i)
+            r[i] = a[i] + b[i];
+    }
+
+    // r[i] = a[i] - b[i]
+    template<typename T>
+    inline void sub(T* r, const T* a, const T* b, int n)
+    {
+        typedef pack<T> P;
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+            P::store(r + i, P::sub(P::load(a + i), P::load(b + i)));
+        for (; i < n; ++i)
+            r[i] = a[i] - b[i];
+    }
+
+    // r[i] = a[i] * b[i]
+    template<typename T>
+    inline void mul(T* r, const T* a, const T* b, int n)
+    {
+        typedef pack<T> P;
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+            P::store(r + i, P::mul(P::load(a + i), P::load(b + i)));
+        for (; i < n; ++i)
+            r[i] = a[i] * b[i];
+    }
+
+    // r[i] = a[i] / b[i]
+    template<typename T>
+    inline void div(T* r, const T* a, const T* b, int n)
+    {
+        typedef pack<T> P;
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+            P::store(r + i, P::div(P::load(a + i), P::load(b + i)));
+        for (; i < n; ++i)
+            r[i] = a[i] / b[i];
+    }
+
+    // r[i] = -a[i]
+    template<typename T>
+    inline void neg(T* r, const T* a, int n)
+    {
+        typedef pack<T> P;
+        auto zero = P::broadcast(0);
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+            P::store(r + i, P::sub(zero, P::load(a + i)));
+        for (; i < n; ++i)
+            r[i] = -a[i];
+    }
+
+    // r[i] = x[i] * w (weighted variable)
+    template<typename T>
+    inline void scale(T* r, const T* x, T w, int n)
+    {
+        typedef pack<T> P;
+        auto v = P::broadcast(w);
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+            P::store(r + i, P::mul(P::load(x + i), v));
+        for (; i < n; ++i)
+            r[i] = x[i] * w;
+    }
+
+    // r[i] = v (constant)
+    template<typename T>
+    inline void fill(T* r, T v, int n)
+    {
+        typedef pack<T> P;
+        auto b = P::broadcast(v);
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+            P::store(r + i, b);
+        for (; i < n; ++i)
+            r[i] = v;
+    }
+
+    // r[i] = a[i], converting between precisions
+    template<typename T, typename U>
+    inline void convert(T* r, const U* a, int n)
+    {
+        for (int i = 0; i < n; ++i)
+            r[i] = static_cast<T>(a[i]);
+    }
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include "simd.h"
+
+// vectorized elementary functions for the block interpreter, built on the pack operations of simd.h, so every
+// instruction set and both precisions share one implementation. each function reduces its argument to a small
+// interval and evaluates a polynomial there, without per-row library calls or branches.
+// error bounds, in ulps of the result over the whole domain unless noted (checked by the FunctionAccuracyTest):
+//   sqrt, square, neg   correctly rounded (0.5 ulp)
+//   exp                 2 ulp; gradual underflow below the smallest normal result, inf above the largest
+//   log                 2 ulp; nan below zero, -inf at zero, subnormal arguments are supported
+//   sin, cos            2 ulp for |x| < 1e5 (double) or 8192 (float; up to 8 ulp near the limit without fma).
+//                       larger arguments are rare in trees, so those lanes are recomputed with the library
+//                       function instead of running a long argument reduction for every lane
+//   tanh                2 ulp
+//   aq                  3 ulp (analytic quotient a / sqrt(1 + b^2))
+//   pow                 (2 + 2 |b ln a|) ulp, since the error of log(a) is scaled by b. a negative base needs an
+//                       integral exponent (nan otherwise) like std::pow, which also makes pow(1, b) and pow(a, 0) one
+//                       for a nan operand, and pow(-1, +-inf) one
+// the tails of the arrays are padded into a whole pack, so a row gets the same value wherever it is in a block
+namespace simd
+{
+    namespace math
+    {
+        template<typename T> struct constants;
+
+        template<> struct constants<double>
+        {
+            static constexpr double log2e = 1.4426950408889634074;
+            static constexpr double ln2_hi = 6.93147180369123816490e-01;  // the top bits of ln 2, so n ln2_hi is exact
+            static constexpr double ln2_lo = 1.90821492927058770002e-10;
+            static constexpr double exp_max = 709.782712893383973096;     // above: inf
+            static constexpr double exp_min = -745.133219101941108420;    // below: 0
+            static constexpr double sqrt2 = 1.41421356237309504880;
+            static constexpr double subnormal_scale = 18014398509481984.0; // 2^54
+            static constexpr double subnormal_exponent = 54;
+            // 1/k! for the taylor polynomial of exp on |r| <= ln2 / 2, highest degree first
+            static constexpr int exp_degree = 13;
+            static constexpr double exp_coefficients[] = {
+                1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0,
+                1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5, 1.0, 1.0
+            };
+            // log(1 + f) = f - hfsq + s (hfsq + R(s^2)), s = f / (2 + f) (fdlibm), highest degree first
+            static constexpr int log_degree = 7;
+            static constexpr double log_coefficients[] = {
+                1.479819860511658591e-01, 1.531383769920937332e-01, 1.818357216161805012e-01, 2.222219843214978396e-01,
+                2.857142874366239149e-01, 3.999999999940941908e-01, 6.666666666666735130e-01
+            };
+            // pi / 2 in three parts with trailing zeros, so k * part is exact for the reduction
+            static constexpr double two_over_pi = 6.36619772367581382433e-01;
+            static constexpr double pio2_1 = 1.57079632673412561417e+00;
+            static constexpr double pio2_2 = 6.07710050630396597660e-11;
+            static constexpr double pio2_3 = 2.02226624871116645580e-21;
+            static constexpr double trig_limit = 1e5;
+            // minimax polynomials on |r| <= pi / 4 (fdlibm), highest degree first
+            static constexpr int sin_degree = 6;
+            static constexpr double sin_coefficients[] = {
+                1.58969099521155010221e-10, -2.50507602534068634195e-08, 2.75573137070700676789e-06,
+                -1.98412698298579493134e-04, 8.33333333332248946124e-03, -1.66666666666666324348e-01
+            };
+            static constexpr int cos_degree = 6;
+            static constexpr double cos_coefficients[] = {
+                -1.13596475577881948265e-11, 2.08757232129817482790e-09, -2.75573143513906633035e-07,
+                2.48015872894767294178e-05, -1.38888888888741095749e-03, 4.16666666666666019037e-02
+            };
+            // tanh(x) = x + x z P(z) / Q(z) for |x| < 0.625 (cephes), highest degree first, Q monic
+            static constexpr int tanh_degree = 3;
+            static constexpr double tanh_p[] = { -9.64399179425052238628e-01, -9.92877231001918586564e+01, -1.61468768441708447952e+03 };
+            static constexpr double tanh_q[] = { 1.12811678491632931402e+02, 2.23548839060100448583e+03, 4.84406305325125486048e+03 };
+        };
+
+        template<> struct constants<float>
+        {
+            static constexpr float log2e = 1.44269504088896341f;
+            static constexpr float ln2_hi = 6.93359375e-01f;
+            static constexpr float ln2_lo = -2.12194440e-04f;
+            static constexpr float exp_max = 88.7228391f;
+            static constexpr float exp_min = -103.972084f;
+            static constexpr float sqrt2 = 1.41421356f;
+            static constexpr float subnormal_scale = 33554432.0f; // 2^25
+            static constexpr float subnormal_exponent = 25;
+            static constexpr int exp_degree = 7;
+            static constexpr float exp_coefficients[] = {
+                1.0f / 5040.0f, 1.0f / 720.0f, 1.0f / 120.0f, 1.0f / 24.0f, 1.0f / 6.0f, 0.5f, 1.0f, 1.0f
+            };
+            static constexpr int log_degree = 4;
+            static constexpr float log_coefficients[] = { 2.4279078841e-01f, 2.8498786688e-01f, 4.0000972152e-01f, 6.6666662693e-01f };
+            static constexpr float two_over_pi = 6.36619772e-01f;
+            static constexpr float pio2_1 = 1.5703125f;
+            static constexpr float pio2_2 = 4.837512969970703125e-4f;
+            static constexpr float pio2_3 = 7.54978995489188216e-8f;
+            static constexpr float trig_limit = 8192.0f;
+            static constexpr int sin_degree = 3;
+            static constexpr float sin_coefficients[] = { -1.9515295891e-4f, 8.3321608736e-3f, -1.6666654611e-1f };
+            static constexpr int cos_degree = 3;
+            static constexpr float cos_coefficients[] = { 2.443315711809948e-5f, -1.388731625493765e-3f, 4.166664568298827e-2f };
+            // tanh(x) = x + x z P(z) for |x| < 0.625 (cephes)
+            static constexpr int tanh_degree = 5;
+            static constexpr float tanh_p[] = { -5.70498872745e-3f, 2.06390887954e-2f, -5.37397155531e-2f, 1.33314422036e-1f, -3.33332819422e-1f };
+        };
+
+        // c[0] x^degree + ... + c[degree]
+        template<typename T>
+        inline typename pack<T>::type horner(typename pack<T>::type x, const T* c, int degree)
+        {
+            typedef pack<T> P;
+            auto y = P::broadcast(c[0]);
+            for (int i = 1; i <= degree; ++i)
+                y = P::fma(y, x, P::broadcast(c[i]));
+            return y;
+        }
+
+        template<typename T>
+        inline typename pack<T>::type exp(typename pack<T>::type x)
+        {
+            typedef pack<T> P;
+            typedef constants<T> C;
+            auto overflow = P::lt(P::broadcast(C::exp_max), x);
+            auto underflow = P::lt(x, P::broadcast(C::exp_min));
+            // keep the exponent of the clamped argument in range; nan compares false and passes through
+            auto clamped = P::select(overflow, P::broadcast(C::exp_max), P::select(underflow, P::broadcast(C::exp_min), x));
+
+            // x = n ln2 + r, |r| <= ln2 / 2
+            auto n = P::round(P::mul(clamped, P::broadcast(C::log2e)));
+            auto r = P::sub(P::sub(clamped, P::mul(n, P::broadcast(C::ln2_hi))), P::mul(n, P::broadcast(C::ln2_lo)));
+            auto y = horner<T>(r, C::exp_coefficients, C::exp_degree);
+
+            // 2^n in two factors, so results below the smallest normal number underflow gradually
+            auto n1 = P::floor(P::mul(n, P::broadcast(T(0.5))));
+            auto n2 = P::sub(n, n1);
+            y = P::mul(P::mul(y, P::pow2(n1)), P::pow2(n2));
+            y = P::select(overflow, P::broadcast(std::numeric_limits<T>::infinity()), y);
+            return P::select(underflow, P::broadcast(T(0)), y);
+        }
+
+        template<typename T>
+        inline typename pack<T>::type log(typename pack<T>::type x)
+        {
+            typedef pack<T> P;
+            typedef constants<T> C;
+            auto zero = P::broadcast(T(0)), one = P::broadcast(T(1));
+            // subnormal arguments are scaled into the normal range first
+            auto subnormal = P::lt(x, P::broadcast(std::numeric_limits<T>::min()));
+            auto scaled = P::select(subnormal, P::mul(x, P::broadcast(C::subnormal_scale)), x);
+            auto e = P::sub(P::exponent(scaled), P::select(subnormal, P::broadcast(C::subnormal_exponent), zero));
+            auto m = P::mantissa(scaled);
+
+            // m in [sqrt(2) / 2, sqrt(2)), so f = m - 1 is small and exact
+            auto big = P::lt(P::broadcast(C::sqrt2), m);
+            m = P::select(big, P::mul(m, P::broadcast(T(0.5))), m);
+            e = P::select(big, P::add(e, one), e);
+            auto f = P::sub(m, one);
+            auto s = P::div(f, P::add(P::broadcast(T(2)), f));
+            auto z = P::mul(s, s);
+            auto hfsq = P::mul(P::broadcast(T(0.5)), P::mul(f, f));
+            auto R = P::mul(z, horner<T>(z, C::log_coefficients, C::log_degree - 1));
+            // e ln2_hi - ((hfsq - (s (hfsq + R) + e ln2_lo)) - f)
+            auto y = P::sub(P::mul(e, P::broadcast(C::ln2_hi)),
+                P::sub(P::sub(hfsq, P::fma(s, P::add(hfsq, R), P::mul(e, P::broadcast(C::ln2_lo)))), f));
+
+            auto inf = P::broadcast(std::numeric_limits<T>::infinity());
+            y = P::select(P::eq(x, inf), inf, y);
+            y = P::select(P::eq(x, zero), P::broadcast(-std::numeric_limits<T>::infinity()), y);
+            return P::select(P::mask_or(P::lt(x, zero), P::unordered(x, x)), P::broadcast(std::numeric_limits<T>::quiet_NaN()), y);
+        }
+
+        // sin(x) for phase 0 and cos(x) for phase 1
+        template<typename T>
+        inline typename pack<T>::type sincos(typename pack<T>::type x, int phase)
+        {
+            typedef pack<T> P;
+            typedef constants<T> C;
+            // x = k pi / 2 + r, |r| <= pi / 4
+            auto k = P::round(P::mul(x, P::broadcast(C::two_over_pi)));
+            auto r = P::sub(x, P::mul(k, P::broadcast(C::pio2_1)));
+            r = P::sub(r, P::mul(k, P::broadcast(C::pio2_2)));
+            r = P::sub(r, P::mul(k, P::broadcast(C::pio2_3)));
+            auto z = P::mul(r, r);
+
+            auto sin_r = P::fma(P::mul(r, z), horner<T>(z, C::sin_coefficients, C::sin_degree - 1), r);
+            auto hz = P::mul(P::broadcast(T(0.5)), z);
+            auto w = P::sub(P::broadcast(T(1)), hz);
+            auto cos_r = P::add(w, P::fma(P::mul(z, z), horner<T>(z, C::cos_coefficients, C::cos_degree - 1), P::sub(P::sub(P::broadcast(T(1)), w), hz)));
+
+            // the quadrant (k + phase) mod 4 picks sin or cos of r and the sign
+            auto q = P::add(k, P::broadcast(T(phase)));
+            q = P::sub(q, P::mul(P::broadcast(T(4)), P::floor(P::mul(q, P::broadcast(T(0.25))))));
+            auto odd = P::eq(P::sub(q, P::mul(P::broadcast(T(2)), P::floor(P::mul(q, P::broadcast(T(0.5)))))), P::broadcast(T(1)));
+            auto y = P::select(odd, cos_r, sin_r);
+            return P::select(P::le(P::broadcast(T(2)), q), P::sub(P::broadcast(T(0)), y), y);
+        }
+
+        template<typename T>
+        inline typename pack<T>::type tanh(typename pack<T>::type x)
+        {
+            typedef pack<T> P;
+            typedef constants<T> C;
+            auto a = P::abs(x);
+            auto z = P::mul(x, x);
+            typename P::type small;
+            if constexpr (sizeof(T) == 8)
+            {
+                auto p = horner<T>(z, C::tanh_p, C::tanh_degree - 1);
+                auto q = P::add(z, P::broadcast(C::tanh_q[0]));
+                q = P::fma(q, z, P::broadcast(C::tanh_q[1]));
+                q = P::fma(q, z, P::broadcast(C::tanh_q[2]));
+                small = P::fma(P::mul(x, z), P::div(p, q), x);
+            }
+            else
+            {
+                small = P::fma(P::mul(x, z), horner<T>(z, C::tanh_p, C::tanh_degree - 1), x);
+            }
+            // 1 - 2 / (exp(2 |x|) + 1), which saturates to 1 once exp overflows
+            auto e = exp<T>(P::add(a, a));
+            auto large = P::sub(P::broadcast(T(1)), P::div(P::broadcast(T(2)), P::add(e, P::broadcast(T(1)))));
+            large = P::select(P::lt(x, P::broadcast(T(0))), P::sub(P::broadcast(T(0)), large), large);
+            return P::select(P::lt(a, P::broadcast(T(0.625))), small, large);
+        }
+
+        template<typename T>
+        inline typename pack<T>::type pow(typename pack<T>::type a, typename pack<T>::type b)
+        {
+            typedef pack<T> P;
+            auto zero = P::broadcast(T(0)), one = P::broadcast(T(1)), two = P::broadcast(T(2));
+            auto y = exp<T>(P::mul(b, log<T>(P::abs(a))));
+            // a negative base needs an integral exponent; odd exponents keep the sign
+            auto negative = P::lt(a, zero);
+            auto integral = P::eq(P::floor(b), b);
+            auto odd = P::mask_and(integral, P::eq(P::sub(b, P::mul(two, P::floor(P::mul(b, P::broadcast(T(0.5)))))), one));
+            y = P::select(P::mask_and(negative, odd), P::sub(zero, y), y);
+            y = P::select(negative, P::select(integral, y, P::broadcast(std::numeric_limits<T>::quiet_NaN())), y);
+            // as std::pow: 1 for a zero exponent and for a base of one, whatever the other operand (nan included),
+            // and for a base of -1 raised to an infinite power
+            auto unit = P::mask_or(P::eq(b, zero), P::eq(a, one));
+            unit = P::mask_or(unit, P::mask_and(P::eq(a, P::broadcast(T(-1))), P::eq(P::abs(b), P::broadcast(std::numeric_limits<T>::infinity()))));
+            return P::select(unit, one, y);
+        }
+
+        template<typename T>
+        inline typename pack<T>::type aq(typename pack<T>::type a, typename pack<T>::type b)
+        {
+            typedef pack<T> P;
+            return P::div(a, P::sqrt(P::fma(b, b, P::broadcast(T(1)))));
+        }
+    }
+
+    // applies f to whole packs and to the tail padded into one more pack
+    template<typename T, typename F>
+    inline void map(T* r, const T* a, int n, F f)
+    {
+        typedef pack<T> P;
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+            P::store(r + i, f(P::load(a + i)));
+        if (i < n)
+        {
+            T x[P::width] = {}, y[P::width];
+            for (int j = i; j < n; ++j)
+                x[j - i] = a[j];
+            P::store(y, f(P::load(x)));
+            for (int j = i; j < n; ++j)
+                r[j] = y[j - i];
+        }
+    }
+
+    template<typename T, typename F>
+    inline void map(T* r, const T* a, const T* b, int n, F f)
+    {
+        typedef pack<T> P;
+        int i = 0;
+        for (; i + P::width <= n; i += P::width)
+            P::store(r + i, f(P::load(a + i), P::load(b + i)));
+        if (i < n)
+        {
+            T x[P::width] = {}, z[P::width] = {}, y[P::width];
+            for (int j = i; j < n; ++j)
+            {
+                x[j - i] = a[j];
+                z[j - i] = b[j];
+            }
+            P::store(y, f(P::load(x), P::load(z)));
+            for (int j = i; j < n; ++j)
+                r[j] = y[j - i];
+        }
+    }
+
+    template<typename T>
+    inline void exp(T* r, const T* a, int n)
+    {
+        map(r, a, n, [](typename pack<T>::type x) { return math::exp<T>(x); });
+    }
+
+    template<typename T>
+    inline void log(T* r, const T* a, int n)
+    {
+        map(r, a, n, [](typename pack<T>::type x) { return math::log<T>(x); });
+    }
+
+    template<typename T>
+    inline void sin(T* r, const T* a, int n)
+    {
+        map(r, a, n, [](typename pack<T>::type x) { return math::sincos<T>(x, 0); });
+        for (int i = 0; i < n; ++i)
+        {
+            if (std::abs(a[i]) > math::constants<T>::trig_limit)
+                r[i] = std::sin(a[i]);
+        }
+    }
+
+    template<typename T>
+    inline void cos(T* r, const T* a, int n)
+    {
+        map(r, a, n, [](typename pack<T>::type x) { return math::sincos<T>(x, 1); });
+        for (int i = 0; i < n; ++i)
+        {
+            if (std::abs(a[i]) > math::constants<T>::trig_limit)
+                r[i] = std::cos(a[i]);
+        }
+    }
+
+    template<typename T>
+    inline void tanh(T* r, const T* a, int n)
+    {
+        map(r, a, n, [](typename pack<T>::type x) { return math::tanh<T>(x); });
+    }
+
+    template<typename T>
+    inline void sqrt(T* r, const T* a, int n)
+    {
+        map(r, a, n, [](typename pack<T>::type x) { return pack<T>::sqrt(x); });
+    }
+
+    template<typename T>
+    inline void square(T* r, const T* a, int n)
+    {
+        mul(r, a, a, n);
+    }
+
+    template<typename T>
+    inline void pow(T* r, const T* a, const T* b, int n)
+    {
+        map(r, a, b, n, [](typename pack<T>::type x, typename pack<T>::type y) { return math::pow<T>(x, y); });
+    }
+
+    template<typename T>
+    inline void aq(T* r, const T* a, const T* b, int n)
+    {
+        map(r, a, b, n, [](typename pack<T>::type x, typename pack<T>::type y) { return math::aq<T>(x, y); });
+    }
+}
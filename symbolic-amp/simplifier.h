@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "linear_tree.h"
+#include "operators.h"
+
+struct simplifier_options
+{
+    // also apply the rewrites that only hold for finite values (x - x = 0, 0 * x = 0), which change the rows
+    // where a subtree is inf or nan
+    bool assume_finite = false;
+    // together with assume_finite, also x / x = 1 and 0 / x = 0, which change the rows where x is zero as well
+    bool assume_nonzero = false;
+};
+
+struct simplifier_result
+{
+    int initial_length = 0;
+    int length = 0;
+    int folded = 0;            // operators replaced by the constant they evaluate to
+    int merged_weights = 0;    // constant factors and negations moved into the weight of a variable
+
+    int removed() const { return initial_length - length; }
+};
+
+// algebraic simplification before compilation: constant folding, identity elimination and propagation of constant
+// factors into variable weights. every node removed is one instruction less on every row of every evaluation.
+// the default rewrites give the same values for every input, up to the rounding of merged constants; constants
+// are folded with the kernels of the block interpreter, so a folded subtree has the value it would have had there
+class simplifier
+{
+public:
+    explicit simplifier(simplifier_options options = simplifier_options()) : opts(options) {}
+
+    simplifier_options& options() { return opts; }
+    const simplifier_options& options() const { return opts; }
+
+    // simplified copy of the tree (a new tree in the arena, or on the heap if arena is null)
+    node* simplify(node* root, node_arena* arena = nullptr, simplifier_result* result = nullptr) const
+    {
+        return simplify(linear_tree::FromNode(root), result).ToNode(arena);
+    }
+
+    // one postfix pass: the children of every node are already simplified when it is reached, so rewrites
+    // cascade up the tree (a folded subtree can make its parent foldable)
+    linear_tree simplify(const linear_tree& tree, simplifier_result* result = nullptr) const
+    {
+        simplifier_result r;
+        r.initial_length = tree.GetLength();
+        std::vector<linear_node> out;
+        out.reserve(tree.GetLength());
+        std::vector<int> starts;  // start in out of every finished subtree, as a stack
+        std::vector<int> children;
+        for (auto& n : tree.Nodes())
+        {
+            children.assign(starts.end() - n.arity, starts.end());
+            starts.resize(starts.size() - n.arity);
+            auto start = static_cast<int>(out.size());
+            if (n.arity > 0)
+            {
+                start = children[0];
+                reduce(n, children, out, r);
+            }
+            else
+            {
+                out.push_back(n);
+                out.back().length = 1;
+            }
+            starts.push_back(start);
+        }
+        r.length = static_cast<int>(out.size());
+        if (result)
+            *result = r;
+        return linear_tree(std::move(out));
+    }
+
+private:
+    // simplifies the operator n over the (already simplified) subtrees that start at children and end at the end of out,
+    // and leaves the result at children[0]
+    void reduce(linear_node n, std::vector<int>& children, std::vector<linear_node>& out, simplifier_result& r) const
+    {
+        auto end = [&](size_t j) { return j + 1 < children.size() ? children[j + 1] : static_cast<int>(out.size()); };
+        // the root of child j is the last node of its range
+        auto root = [&](size_t j) -> linear_node& { return out[end(j) - 1]; };
+        auto constant = [&](size_t j) { return root(j).opcode == CONSTANT; };
+        auto value = [&](size_t j) { return root(j).value; };
+        auto erase = [&](size_t j) {
+            auto first = children[j], last = end(j);
+            out.erase(out.begin() + first, out.begin() + last);
+            children.erase(children.begin() + j);
+            for (auto k = j; k < children.size(); ++k)
+                children[k] -= last - first;
+        };
+        auto replace_with_constant = [&](double v) {
+            out.resize(children[0]);
+            out.push_back(leaf(CONSTANT, v));
+            children.assign(1, children[0]);
+        };
+        auto same = [&](size_t i, size_t j) {
+            if (end(i) - children[i] != end(j) - children[j])
+                return false;
+            for (int k = 0; k < end(i) - children[i]; ++k)
+            {
+                auto& a = out[children[i] + k];
+                auto& b = out[children[j] + k];
+                if (a.opcode != b.opcode || a.arity != b.arity || a.variable != b.variable || a.value != b.value || a.weight != b.weight)
+                    return false;
+            }
+            return true;
+        };
+
+        // constant folding
+        bool foldable = true;
+        for (size_t j = 0; j < children.size(); ++j)
+            foldable = foldable && constant(j);
+        if (foldable)
+        {
+            std::vector<double> values(children.size());
+            std::vector<const double*> args(children.size());
+            for (size_t j = 0; j < children.size(); ++j)
+            {
+                values[j] = value(j);
+                args[j] = &values[j];
+            }
+            double v;
+            operators::apply(n.opcode, &v, args.data(), n.arity, 1);
+            replace_with_constant(v);
+            ++r.folded;
+            return;
+        }
+
+        auto finite = opts.assume_finite;
+        auto nonzero = finite && opts.assume_nonzero;
+        switch (n.opcode)
+        {
+        case ADD:
+        case MUL:
+        {
+            // the constant operands are combined into one, which is dropped if it is the identity
+            auto add = n.opcode == ADD;
+            auto identity = add ? 0.0 : 1.0;
+            double c = identity;
+            for (size_t j = children.size(); j-- > 0;)
+            {
+                if (constant(j))
+                {
+                    c = add ? value(j) + c : value(j) * c;
+                    erase(j);
+                }
+            }
+            if (!add && c == 0 && finite)
+            {
+                replace_with_constant(0);
+                return;
+            }
+            // a constant factor goes into the weight of a variable operand
+            if (!add && c != identity)
+            {
+                for (size_t j = 0; j < children.size(); ++j)
+                {
+                    if (root(j).opcode == VARIABLE)
+                    {
+                        root(j).weight *= c;
+                        c = identity;
+                        ++r.merged_weights;
+                        break;
+                    }
+                }
+            }
+            if (c != identity)
+            {
+                out.push_back(leaf(CONSTANT, c));
+                children.push_back(static_cast<int>(out.size()) - 1);
+            }
+            if (children.size() == 1)
+                return; // the remaining operand takes the place of the operator
+            break;
+        }
+        case SUB:
+        case DIV:
+        {
+            auto sub = n.opcode == SUB;
+            if (children.size() == 1)
+            {
+                // -(w x) = (-w) x, and -(-x) = x
+                auto& child = root(0);
+                if (sub && child.opcode == VARIABLE)
+                {
+                    child.weight = -child.weight;
+                    ++r.merged_weights;
+                    return;
+                }
+                if (sub && ((child.opcode == SUB && child.arity == 1) || child.opcode == NEG))
+                {
+                    out.erase(out.begin() + (out.size() - 1));
+                    return;
+                }
+                break;
+            }
+            // subtracting zero and dividing by one
+            for (size_t j = children.size(); j-- > 1;)
+            {
+                if (constant(j) && value(j) == (sub ? 0.0 : 1.0))
+                    erase(j);
+            }
+            if (children.size() == 1)
+                return; // the first operand alone, not its negation or reciprocal
+            // (w x) / c = (w / c) x
+            if (!sub && children.size() == 2 && constant(1) && root(0).opcode == VARIABLE)
+            {
+                root(0).weight /= value(1);
+                erase(1);
+                ++r.merged_weights;
+                return;
+            }
+            if ((sub ? finite : nonzero) && children.size() == 2 && same(0, 1))
+            {
+                replace_with_constant(sub ? 0.0 : 1.0);
+                return;
+            }
+            if (nonzero && !sub && constant(0) && value(0) == 0)
+            {
+                replace_with_constant(0);
+                return;
+            }
+            break;
+        }
+        case NEG:
+        {
+            auto& child = root(0);
+            if (child.opcode == VARIABLE)
+            {
+                child.weight = -child.weight;
+                ++r.merged_weights;
+                return;
+            }
+            if (child.opcode == NEG || (child.opcode == SUB && child.arity == 1))
+            {
+                out.erase(out.begin() + (out.size() - 1));
+                return;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+        n.arity = static_cast<int>(children.size());
+        n.length = static_cast<int>(out.size()) - children[0] + 1;
+        out.push_back(n);
+    }
+
+    static linear_node leaf(op_code opcode, double value)
+    {
+        linear_node n;
+        n.opcode = opcode;
+        n.arity = 0;
+        n.length = 1;
+        n.variable = -1;
+        n.value = value;
+        n.weight = 0;
+        return n;
+    }
+
+    simplifier_options opts;
+};
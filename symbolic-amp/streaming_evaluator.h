@@ -0,0 +1,227 @@
+#pragma once
+#include "population_evaluator.h"
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+
+// out-of-core evaluation of a population on a binary dataset file that need not fit in memory. the rows are
+// streamed in chunks through two staging datasets: while the population is evaluated on one chunk, a background
+// thread reads the next one into the other, so the disk and the cores are busy at the same time. the fitness
+// statistics of every chunk are merged in file order, so the result does not depend on the chunk size or the
+// timing of the reads, and the memory footprint is two chunks whatever the number of rows
+template<typename T, typename Accumulator = T>
+class basic_streaming_evaluator
+{
+public:
+    typedef basic_population_evaluator<T, Accumulator> population_evaluator;
+    typedef typename population_evaluator::interpreter interpreter;
+    typedef typename population_evaluator::instruction instruction;
+    typedef typename population_evaluator::dataset dataset;
+
+    // chunk_rows is rounded up to a whole number of interpreter blocks
+    explicit basic_streaming_evaluator(const std::string& path, int chunk_rows = 1 << 16, int nthreads = 0)
+        : file_path(path), evaluator(nthreads)
+    {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in)
+            throw std::runtime_error("cannot open " + path + ".");
+        auto file_size = static_cast<uint64_t>(in.tellg());
+        std::vector<char> bytes(std::min<uint64_t>(file_size, sizeof(dataset_header)));
+        in.seekg(0);
+        in.read(bytes.data(), bytes.size());
+        std::vector<std::string> names;
+        header = dataset::parse_header(bytes.data(), file_size, path, names, bytes.size());
+        bytes.resize(header.data_offset);
+        in.seekg(0);
+        in.read(bytes.data(), bytes.size());
+        if (!in)
+            throw std::runtime_error(path + " is truncated or corrupt.");
+        dataset::parse_header(bytes.data(), file_size, path, names, bytes.size());
+
+        auto block = interpreter::block_size;
+        chunk = std::max(block, (std::min(chunk_rows, std::max(rows(), 1)) + block - 1) / block * block);
+        for (auto& s : staging)
+            s = dataset(names, chunk);
+        reader = std::thread([this]() { read_loop(); });
+    }
+
+    ~basic_streaming_evaluator()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        changed.notify_all();
+        reader.join();
+    }
+
+    basic_streaming_evaluator(const basic_streaming_evaluator&) = delete;
+    basic_streaming_evaluator& operator=(const basic_streaming_evaluator&) = delete;
+
+    int rows() const { return static_cast<int>(header.rows); }
+    int cols() const { return static_cast<int>(header.cols); }
+    int chunk_rows() const { return chunk; }
+    std::vector<std::string> Variables() const { return staging[0].Variables(); }
+    population_evaluator& get_evaluator() { return evaluator; }
+
+    // bytes held by the staging datasets, independent of the number of rows in the file
+    size_t footprint() const { return 2 * static_cast<size_t>(staging[0].stride()) * cols() * sizeof(T); }
+
+    // fitness statistics of every tree against the target variable over all the rows of the file.
+    // only the columns that the trees or the target refer to are read
+    std::vector<fitness_statistics> evaluate_fitness(const std::vector<node*>& trees, const std::string& target)
+    {
+        std::vector<std::vector<instruction>> programs[2];
+        for (int b = 0; b < 2; ++b)
+            programs[b] = evaluator.compile_population(trees, staging[b]);
+
+        std::vector<char> used(cols());
+        used[staging[0].index(target)] = 1;
+        for (auto& p : programs[0])
+            for (auto& instr : p)
+                if (instr.opcode == VARIABLE)
+                    used[instr.variable] = 1;
+        wait_idle();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            columns.clear();
+            for (int c = 0; c < cols(); ++c)
+                if (used[c])
+                    columns.push_back(c);
+        }
+
+        std::vector<fitness_statistics> statistics(trees.size());
+        std::vector<Accumulator> y;
+        auto nchunks = (rows() + chunk - 1) / chunk;
+        if (nchunks > 0)
+            request(0, 0);
+        for (int k = 0; k < nchunks; ++k)
+        {
+            auto b = k % 2;
+            auto n = wait(b);
+            if (k + 1 < nchunks)
+                request(k + 1, 1 - b);
+
+            const Accumulator* t;
+            if constexpr (std::is_same<T, Accumulator>::value)
+            {
+                t = staging[b][target];
+            }
+            else
+            {
+                y.resize(n);
+                simd::convert(y.data(), staging[b][target], n);
+                t = y.data();
+            }
+            auto partial = evaluator.evaluate_fitness(programs[b], t, 0, n);
+            for (size_t i = 0; i < statistics.size(); ++i)
+                statistics[i].merge(partial[i]);
+        }
+        return statistics;
+    }
+
+private:
+    // asks the reader for chunk k in staging dataset b
+    void request(int k, int b)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending_chunk = k;
+            pending_buffer = b;
+            loaded[b] = -1;
+        }
+        changed.notify_all();
+    }
+
+    // blocks until staging dataset b is filled and returns its number of rows; a read error is rethrown here
+    int wait(int b)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return loaded[b] >= 0 || error; });
+        if (error)
+        {
+            auto e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+        return loaded[b];
+    }
+
+    // blocks until the reader has no request left, e.g. the prefetch of an evaluation that ended with an exception
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return pending_chunk < 0 && !busy; });
+        error = nullptr;
+    }
+
+    void read_loop()
+    {
+        std::ifstream in(file_path, std::ios::binary);
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            changed.wait(lock, [&]() { return stop || pending_chunk >= 0; });
+            if (stop)
+                return;
+            auto k = pending_chunk, b = pending_buffer;
+            auto cs = columns;
+            pending_chunk = -1;
+            busy = true;
+            lock.unlock();
+
+            auto first = static_cast<uint64_t>(k) * chunk;
+            auto n = static_cast<int>(std::min<uint64_t>(chunk, header.rows - first));
+            std::exception_ptr e;
+            try
+            {
+                for (auto c : cs)
+                {
+                    in.seekg(static_cast<std::streamoff>(header.data_offset + (c * header.stride + first) * sizeof(T)));
+                    in.read(reinterpret_cast<char*>(staging[b].column(c)), static_cast<std::streamsize>(n) * sizeof(T));
+                    if (!in)
+                        throw std::runtime_error("cannot read " + file_path + ".");
+                }
+            }
+            catch (...)
+            {
+                e = std::current_exception();
+                in.clear();
+            }
+
+            lock.lock();
+            busy = false;
+            if (e)
+                error = e;
+            else
+                loaded[b] = n;
+            changed.notify_all();
+        }
+    }
+
+    std::string file_path;
+    dataset_header header;
+    int chunk;
+    population_evaluator evaluator;
+    dataset staging[2];
+
+    // state shared with the reader thread
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<int> columns;     // columns to read
+    int pending_chunk = -1;
+    int pending_buffer = 0;
+    int loaded[2] = { -1, -1 };   // rows in each staging dataset, -1 while it is being read
+    bool busy = false;
+    bool stop = false;
+    std::exception_ptr error;
+    std::thread reader;
+};
+
+typedef basic_streaming_evaluator<double> streaming_evaluator;
+typedef basic_streaming_evaluator<float> float_streaming_evaluator;
+typedef basic_streaming_evaluator<float, double> mixed_streaming_evaluator;
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <atomic>
+#include "simd.h"
+#include "instrumentation.h"
+
+// memory-bounded LRU cache of evaluated subtrees, keyed by the structural hash of the subtree and the range of rows
+// it was evaluated on (a row block for the cpu interpreter, the whole dataset for the gpu one). populations are full of
+// repeated subtrees after crossover, and the interpreters skip the whole subtree on a hit.
+// the cache is tied to one dataset: the hash covers variable names, not values. entries of double and float
+// evaluations are kept apart. it is safe to share between threads
+class subtree_cache
+{
+public:
+    // subtrees shorter than min_length are cheaper to recompute than to look up
+    explicit subtree_cache(std::size_t capacity_bytes, int min_length = 3)
+        : capacity(capacity_bytes), used(0), min_len(min_length), nhits(0), nmisses(0)
+    {
+    }
+
+    int min_length() const { return min_len; }
+    bool cacheable(int length) const { return length >= min_len; }
+
+    // copies the cached values of the subtree into result and returns true, or returns false on a miss
+    template<typename T>
+    bool lookup(uint64_t hash, int row, int n, T* result)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(key{ hash, row, n, sizeof(T) });
+            if (it != entries.end())
+            {
+                order.splice(order.begin(), order, it->second);
+                std::memcpy(result, it->second->values.data(), n * sizeof(T));
+                ++nhits;
+                SYMBOLIC_AMP_COUNT(subtree_cache_hits, 1);
+                return true;
+            }
+        }
+        ++nmisses;
+        SYMBOLIC_AMP_COUNT(subtree_cache_misses, 1);
+        return false;
+    }
+
+    // stores a copy of the values, evicting the least recently used entries to stay within the capacity
+    template<typename T>
+    void insert(uint64_t hash, int row, int n, const T* values)
+    {
+        auto bytes = footprint(n, sizeof(T));
+        if (bytes > capacity)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        key k{ hash, row, n, sizeof(T) };
+        if (entries.find(k) != entries.end())
+            return;
+        while (used + bytes > capacity)
+        {
+            auto& last = order.back();
+            used -= footprint(last.id.n, last.id.scalar_size);
+            entries.erase(last.id);
+            order.pop_back();
+        }
+        auto first = reinterpret_cast<const char*>(values);
+        order.push_front(entry{ k, simd::aligned_vector<char>(first, first + n * sizeof(T)) });
+        entries.emplace(k, order.begin());
+        used += bytes;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        order.clear();
+        used = 0;
+        nhits = 0;
+        nmisses = 0;
+    }
+
+    std::size_t hits() const { return nhits; }
+    std::size_t misses() const { return nmisses; }
+    double hit_rate() const
+    {
+        auto total = hits() + misses();
+        return total == 0 ? 0 : static_cast<double>(hits()) / total;
+    }
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+    std::size_t bytes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return used;
+    }
+
+private:
+    struct key
+    {
+        uint64_t hash;
+        int row;
+        int n;
+        std::size_t scalar_size;
+        bool operator==(const key& other) const { return hash == other.hash && row == other.row && n == other.n && scalar_size == other.scalar_size; }
+    };
+
+    struct key_hash
+    {
+        std::size_t operator()(const key& k) const
+        {
+            return static_cast<std::size_t>(k.hash ^ ((static_cast<uint64_t>(k.row) << 32 | static_cast<uint32_t>(k.n)) * 0x9e3779b97f4a7c15ull) ^ k.scalar_size);
+        }
+    };
+
+    struct entry
+    {
+        key id;
+        simd::aligned_vector<char> values;
+    };
+
+    // values plus a rough estimate of the bookkeeping overhead
+    static std::size_t footprint(int n, std::size_t scalar_size) { return n * scalar_size + sizeof(entry) + 4 * sizeof(void*); }
+
+    std::size_t capacity;
+    std::size_t used;
+    int min_len;
+    std::atomic<std::size_t> nhits;
+    std::atomic<std::size_t> nmisses;
+    std::list<entry> order;  // most recently used first
+    std::unordered_map<key, std::list<entry>::iterator, key_hash> entries;
+    mutable std::mutex mutex;
+};
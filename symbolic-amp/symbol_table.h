@@ -0,0 +1,68 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// process-wide table of interned names. compact tree encodings store the integer id
+// instead of a string, and the id is stable for the lifetime of the process
+class symbol_table
+{
+public:
+    static int intern(const std::string& name)
+    {
+        auto& t = instance();
+        {
+            std::shared_lock<std::shared_mutex> lock(t.mutex);
+            auto it = t.ids.find(name);
+            if (it != t.ids.end())
+                return it->second;
+        }
+        std::unique_lock<std::shared_mutex> lock(t.mutex);
+        auto it = t.ids.find(name);
+        if (it != t.ids.end())
+            return it->second;
+        auto id = static_cast<int>(t.names.size());
+        t.names.push_back(name);
+        t.ids[name] = id;
+        return id;
+    }
+
+    // returns -1 if the name was never interned
+    static int find(const std::string& name)
+    {
+        auto& t = instance();
+        std::shared_lock<std::shared_mutex> lock(t.mutex);
+        auto it = t.ids.find(name);
+        return it == t.ids.end() ? -1 : it->second;
+    }
+
+    static const std::string& name(int id)
+    {
+        auto& t = instance();
+        std::shared_lock<std::shared_mutex> lock(t.mutex);
+        return t.names.at(id); // deque elements never move, so the reference stays valid
+    }
+
+    static int size()
+    {
+        auto& t = instance();
+        std::shared_lock<std::shared_mutex> lock(t.mutex);
+        return static_cast<int>(t.names.size());
+    }
+
+private:
+    symbol_table() {}
+
+    static symbol_table& instance()
+    {
+        static symbol_table table;
+        return table;
+    }
+
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, int> ids;
+    std::deque<std::string> names;
+};
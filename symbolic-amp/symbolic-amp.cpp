@@ -1,19 +1,25 @@
 #include <iostream>
 #include <memory>
 #include <chrono>
-#include <unordered_map>
 #include <numeric>
-#include <execution>
+#include <algorithm>
 
-#include "amp.h"
+#include "config.h"
 #include "node.h"
 #include "interpreter.h"
+#include "backend.h"
+#include "instrumentation.h"
 #include "random.h"
-#include "amp_interpreter.h"
 #include "util.h"
 #include "hierarchicalformatter.h"
+#if SYMBOLIC_AMP_HAS_AMP
+#include "amp.h"
+#include "amp_interpreter.h"
+#endif
 
 using namespace std;
+
+#if SYMBOLIC_AMP_HAS_AMP
 using namespace concurrency;
 
 void gpu_info()
@@ -22,96 +28,78 @@ void gpu_info()
     for (auto &a : accelerator::get_all())
         wcout << a.description << endl;
 }
+#endif
 
 int main(int argc, char* argv[])
 {
     if (argc < 5)
     {
-        cout << "Usage: symbolic-amp.exe <ntrees> <nrows> <nvars> <tree_depth>" << endl;
+        cout << "Usage: symbolic-amp.exe <ntrees> <nrows> <nvars> <tree_depth> [json|prometheus]" << endl;
         return -1;
     }
 
     //gpu_info();
 
-    auto rnd = make_unique<random>();
+    auto rnd = make_unique<rng>();
     rnd->seed(1234);
 
     auto ntrees = atol(argv[1]);
     auto nrows = atol(argv[2]);
     auto nvars = atol(argv[3]);
     auto depth = atol(argv[4]);
-
-    // generate rows
-    auto rows = vector<int>(nrows);
-    int i = 0;
-    generate(begin(rows), end(rows), [&i]() { return i++; }); // will rows with consecutive values
+    // prints the profile of the run in this format (the counters need a build with SYMBOLIC_AMP_PROFILE)
+    string profile = argc > 5 ? argv[5] : "";
 
     // generate random variable values
-    vector<vector<double>> variables(nvars);
-    unordered_map<string, vector<double>> data;
-    for (int i = 0; i < nvars; ++i)
-    {
-        vector<double> values(nrows);
-        generate(begin(values), end(values), [&rnd] { return rnd->next_double(); });
-        data["x" + std::to_string(i + 1)] = std::move(values);
-    }
+    auto data = util::random_dataset(rnd.get(), nvars, nrows);
 
-    // create some trees
+    // create some trees; the arena frees all of them at once when it goes out of scope
+    node_arena arena;
     vector<node*> trees(ntrees);
-    generate(begin(trees), end(trees), [=, &rnd, &data]() { return node::Random(rnd.get(), data, depth); });
+    generate(begin(trees), end(trees), [=, &rnd, &data, &arena]() { return node::Random(rnd.get(), data, depth, &arena); });
     unsigned long long nodes = accumulate(begin(trees), end(trees), 0, [=](unsigned long len, node* p) { return len + p->GetLength(); });
 
     //cout << "nodes = " << nodes << endl;
 
-    auto ac = accelerator::get_all()[0];
-    accelerator::set_default(ac.device_path);
-
-    auto hrc = make_unique<chrono::high_resolution_clock>();
-    auto start = hrc->now();
-    vector<double> eval(nrows);
-    std::for_each(execution::seq, begin(trees), end(trees), [&](node *t) {
-        auto instructions = interpreter::compile(t, data);
-        for (int i = 0; i < nrows; ++i)
-        {
-            interpreter::evaluate(instructions, i);
-        }
-    });
-    auto cpu_single_time = chrono::duration_cast<chrono::milliseconds>(hrc->now() - start).count() / 1e3;
-    auto cpu_single_speed = nodes / cpu_single_time / 1e6 * nrows;
-
-    start = hrc->now();
-    std::for_each(execution::par, begin(trees), end(trees), [&](node *t) {
-        auto instructions = interpreter::compile(t, data);
-        for (int i = 0; i < nrows; ++i)
-        {
-            interpreter::evaluate(instructions, i);
-        }
-    });
-    auto cpu_multi_time = chrono::duration_cast<chrono::milliseconds>(hrc->now() - start).count() / 1e3;
-    auto cpu_multi_speed = nodes / cpu_multi_time / 1e6 * nrows;
+    // seconds elapsed since start, at the resolution of the steady clock
+    auto elapsed = [](chrono::steady_clock::time_point start) { return chrono::duration<double>(chrono::steady_clock::now() - start).count(); };
 
+    // every backend is timed through the same interface; the dispatcher picks one of the others for each tree.
+    // C++ AMP kernels are compiled by the GPU driver on their first use, so every backend gets a warm-up pass
+    vector<unique_ptr<backend>> backends;
+    backends.push_back(make_unique<block_backend>());
+    backends.push_back(make_unique<parallel_backend>());
+#if SYMBOLIC_AMP_HAS_AMP
     try
     {
-        // C++ AMP kernels are Just-In-Time (JIT) compiled from High Level Shader Language (HLSL) bytecode to machine code by the GPU driver at run time. 
-        // Compiled kernels are cached until the process terminates.This means that there is an additional compilation overhead that occurs for each call 
-        // site of lambda or function marked with restrict(amp). Run the kernel once to force the JIT compiler to run prior to executing the timed kernel.
-        auto interp = make_unique<amp_interpreter>(data);
-
-        start = hrc->now();
-        std::for_each(execution::seq, begin(trees), end(trees), [&](node *t) {
-            interp->evaluate(t);
-        });
-        auto gpu_time = chrono::duration_cast<chrono::milliseconds>(hrc->now() - start).count() / 1e3;
-        auto gpu_speed = nodes / gpu_time / 1e6 * nrows;
-        cout << cpu_single_speed << ";" << cpu_multi_speed << ";" << gpu_speed << endl;
+        if (amp_backend::available())
+            backends.push_back(make_unique<amp_backend>());
     }
-    catch (exception e)
+    catch (const exception& e)
     {
         cout << "ERROR: " << e.what() << endl;
     }
+#endif
+    backends.push_back(make_unique<dispatcher>());
+
+    vector<double> eval(nrows);
+    for (size_t b = 0; b < backends.size(); ++b)
+    {
+        backends[b]->evaluate(trees[0], data, 0, nrows, eval.data());
+        SYMBOLIC_AMP_HARDWARE_SCOPE();
+        auto start = chrono::steady_clock::now();
+        for_each(begin(trees), end(trees), [&](node *t) {
+            backends[b]->evaluate(t, data, 0, nrows, eval.data());
+        });
+        auto speed = nodes / elapsed(start) / 1e6 * nrows;
+        cout << (b > 0 ? ";" : "") << speed;
+    }
+    cout << endl;
 
-    for (auto t : trees)
-        delete t;
+    if (profile == "json")
+        cout << profiling::to_json() << endl;
+    else if (profile == "prometheus")
+        cout << profiling::to_prometheus();
 
     return 0;
 }
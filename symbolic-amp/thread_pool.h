@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "instrumentation.h"
+
+// fixed-size pool of persistent threads with one task queue per worker. a parallel loop hands every worker
+// a contiguous range of task indices; workers consume their own queue from the back and, once it is empty,
+// steal from the front of the other queues, so uneven task sizes do not leave cores idle.
+// the calling thread takes part in the loop as worker 0. parallel loops must not be nested
+class thread_pool
+{
+public:
+    explicit thread_pool(int nthreads = 0)
+    {
+        if (nthreads <= 0)
+            nthreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+        for (int i = 0; i < nthreads; ++i)
+            queues.push_back(std::make_unique<task_queue>());
+        for (int i = 1; i < nthreads; ++i)
+            threads.emplace_back([this, i]() { worker(i); });
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads)
+            t.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // number of workers, including the calling thread
+    int size() const { return static_cast<int>(queues.size()); }
+
+    // calls body(task, worker) for every task in [0, ntasks) and returns once all of them have completed.
+    // worker is in [0, size()) and can be used to index per-thread scratch space
+    void parallel_for(int ntasks, const std::function<void(int, int)>& body)
+    {
+        if (ntasks <= 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &body;
+            error = nullptr;
+            auto n = size();
+            for (int w = 0; w < n; ++w)
+            {
+                auto& q = *queues[w];
+                std::lock_guard<std::mutex> qlock(q.mutex);
+                for (int t = static_cast<int>(static_cast<long long>(ntasks) * w / n); t < static_cast<long long>(ntasks) * (w + 1) / n; ++t)
+                    q.tasks.push_back(t);
+            }
+            ++generation;
+        }
+        wake.notify_all();
+
+        {
+            SYMBOLIC_AMP_TIMED(busy_nanoseconds);
+            run(0);
+        }
+
+        SYMBOLIC_AMP_TIMED(idle_nanoseconds);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return busy == 0; });
+        job = nullptr;
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    struct task_queue
+    {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    void worker(int id)
+    {
+        unsigned long long seen = 0;
+        for (;;)
+        {
+            {
+                SYMBOLIC_AMP_TIMED(idle_nanoseconds);
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stop || generation != seen; });
+                if (stop)
+                    return;
+                seen = generation;
+                ++busy;
+            }
+            {
+                SYMBOLIC_AMP_TIMED(busy_nanoseconds);
+                run(id);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busy == 0)
+                    done.notify_all();
+            }
+        }
+    }
+
+    bool pop(int id, int& task)
+    {
+        auto& q = *queues[id];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+            return false;
+        task = q.tasks.back();
+        q.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(int id, int& task)
+    {
+        auto n = size();
+        for (int k = 1; k < n; ++k)
+        {
+            auto& q = *queues[(id + k) % n];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty())
+            {
+                task = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(int id)
+    {
+        int task;
+        while (pop(id, task) || steal(id, task))
+        {
+            try
+            {
+                (*job)(task, id);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int, int)>* job = nullptr;
+    std::exception_ptr error;
+    unsigned long long generation = 0;
+    int busy = 0;
+    bool stop = false;
+};
@@ -6,17 +6,18 @@
 
 namespace util
 {
-  static dataset random_dataset(random* rnd, int nvariables, int nrows)
+  static dataset random_dataset(rng* rnd, int nvariables, int nrows)
   {
-    dataset ds;
+    std::vector<std::string> names;
     for (int i = 0; i < nvariables; ++i)
     {
       std::stringstream ss;
       ss << "x" << (i + 1);
-      auto values = std::vector<double>(nrows);
-      std::generate(begin(values), end(values), [&rnd]() { return rnd->next_double(); });
-      ds.add(ss.str(), values);
+      names.push_back(ss.str());
     }
+    dataset ds(names, nrows);
+    for (int i = 0; i < nvariables; ++i)
+      std::generate(ds.column(i), ds.column(i) + nrows, [&rnd]() { return rnd->next_double(); });
     return ds;
   }
 }